@@ -0,0 +1,111 @@
+/*
+ * Per-tcb scratch memory of the syscall decoders.
+ *
+ * The memory returned by tcb_alloc is released all at once when the
+ * syscall exits, along with the private data of the decoder.  Every tcb
+ * keeps one chunk of it that is reused by all its syscalls, and by the
+ * next tracee when the tcb is dropped, so the decoders that save their
+ * state between syscall entering and exiting do not touch the heap.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "xmalloc.h"
+
+/* The alignment of the memory returned by tcb_alloc.  */
+#define TCB_ARENA_ALIGN		16
+/* The size of the first chunk of a tcb.  */
+#define TCB_ARENA_MIN_SIZE	1024
+/* The chunks larger than that are not kept for the following syscalls.  */
+#define TCB_ARENA_MAX_KEEP	(64 * 1024)
+
+struct tcb_arena {
+	struct tcb_arena *prev;	/* The chunk filled before this one */
+	size_t size;		/* The size of data */
+	size_t used;		/* The number of the bytes of data in use */
+};
+
+#define TCB_ARENA_HDR_SIZE	ROUNDUP(sizeof(struct tcb_arena), TCB_ARENA_ALIGN)
+
+static struct tcb_arena *
+alloc_chunk(const size_t size, struct tcb_arena *const prev)
+{
+	struct tcb_arena *const a = xmalloc(TCB_ARENA_HDR_SIZE + size);
+
+	a->prev = prev;
+	a->size = size;
+	a->used = 0;
+
+	return a;
+}
+
+void *
+tcb_alloc(struct tcb *const tcp, const size_t size)
+{
+	if (size > SIZE_MAX / 2)
+		error_msg_and_die("Out of memory");
+
+	const size_t len = ROUNDUP(size ?: 1, TCB_ARENA_ALIGN);
+	struct tcb_arena *a = tcp->arena;
+
+	if (!a || a->size - a->used < len) {
+		size_t chunk_size = a ? a->size * 2 : TCB_ARENA_MIN_SIZE;
+
+		if (chunk_size < len)
+			chunk_size = len;
+		a = tcp->arena = alloc_chunk(chunk_size, a);
+	}
+
+	void *const p = (char *) a + TCB_ARENA_HDR_SIZE + a->used;
+	a->used += len;
+
+	return p;
+}
+
+void *
+tcb_zalloc(struct tcb *const tcp, const size_t size)
+{
+	return memset(tcb_alloc(tcp, size), 0, size);
+}
+
+char *
+tcb_strdup(struct tcb *const tcp, const char *const str)
+{
+	const size_t size = strlen(str) + 1;
+
+	return memcpy(tcb_alloc(tcp, size), str, size);
+}
+
+void
+tcb_arena_reset(struct tcb *const tcp)
+{
+	struct tcb_arena *a = tcp->arena;
+
+	if (!a)
+		return;
+
+	a->used = 0;
+	if (!a->prev && a->size <= TCB_ARENA_MAX_KEEP)
+		return;
+
+	/*
+	 * The last syscall needed more than one chunk,
+	 * replace them with a single one that is large enough.
+	 */
+	size_t total = 0;
+
+	while (a) {
+		struct tcb_arena *const prev = a->prev;
+
+		total += a->size;
+		free(a);
+		a = prev;
+	}
+
+	tcp->arena = total <= TCB_ARENA_MAX_KEEP ? alloc_chunk(total, NULL)
+						 : NULL;
+}
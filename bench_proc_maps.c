@@ -0,0 +1,161 @@
+/*
+ * A microbenchmark of the /proc/PID/maps parser on a synthetic maps file,
+ * compared with the fgets/sscanf based parsing it replaced.
+ *
+ * Usage: bench_proc_maps [LINES [ITERATIONS]]
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <limits.h>
+#include <time.h>
+#include "proc_maps.h"
+
+#ifndef HAVE_PROGRAM_INVOCATION_NAME
+char *program_invocation_name;
+#endif
+
+void ATTRIBUTE_NORETURN
+die(void)
+{
+	exit(1);
+}
+
+static const char *const paths[] = {
+	"/usr/lib/x86_64-linux-gnu/libc.so.6",
+	"/usr/lib/x86_64-linux-gnu/libstdc++.so.6.0.28",
+	"/usr/lib/jvm/java-11-openjdk-amd64/lib/server/libjvm.so",
+	"/memfd:jit-code-cache (deleted)",
+	"[heap]",
+	"",
+	"",
+	"",
+};
+
+static FILE *
+generate(unsigned long lines)
+{
+	FILE *fp = tmpfile();
+	if (!fp)
+		perror_msg_and_die("tmpfile");
+
+	unsigned long addr = 0x7f0000000000UL;
+
+	for (unsigned long i = 0; i < lines; ++i) {
+		const unsigned long len = 0x1000UL << (i % 5);
+		const char *path = paths[i % ARRAY_SIZE(paths)];
+
+		fprintf(fp, "%08lx-%08lx %s %08lx %02x:%02x %-10lu %s%s\n",
+			addr, addr + len, i & 1 ? "r-xp" : "rw-p",
+			(i % 7) * 0x1000UL, *path ? 0xfd : 0, *path ? 1 : 0,
+			*path ? 1000000 + i % 100 : 0,
+			*path ? "                 " : "", path);
+		addr += len;
+	}
+
+	if (fflush(fp))
+		perror_msg_and_die("fflush");
+
+	return fp;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long
+parse_sscanf(FILE *fp)
+{
+	char buffer[PATH_MAX + 80];
+	unsigned long count = 0;
+
+	rewind(fp);
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		unsigned long start_addr, end_addr, mmap_offset;
+		char read_bit, write_bit, exec_bit, shared_bit;
+		unsigned long major, minor;
+		char binary_path[sizeof(buffer)];
+
+		if (sscanf(buffer, "%lx-%lx %c%c%c%c %lx %lx:%lx %*d %[^\n]",
+			   &start_addr, &end_addr,
+			   &read_bit, &write_bit, &exec_bit, &shared_bit,
+			   &mmap_offset, &major, &minor, binary_path) != 10)
+			continue;
+
+		free(xstrdup(binary_path));
+		count++;
+	}
+
+	return count;
+}
+
+static bool
+count_entry(const struct proc_maps_entry *entry, void *data)
+{
+	if (entry->path_len)
+		++*(unsigned long *) data;
+	return true;
+}
+
+static unsigned long
+parse_proc_maps(FILE *fp)
+{
+	unsigned long count = 0;
+
+	if (lseek(fileno(fp), 0, SEEK_SET))
+		perror_msg_and_die("lseek");
+	if (proc_maps_parse(fileno(fp), count_entry, &count))
+		perror_msg_and_die("proc_maps_parse");
+
+	return count;
+}
+
+int
+main(int argc, char **argv)
+{
+	const unsigned long lines = argc > 1 ? strtoul(argv[1], NULL, 0)
+					     : 50000;
+	const unsigned int iterations = argc > 2 ? strtoul(argv[2], NULL, 0)
+						 : 20;
+
+	if (!program_invocation_name || !*program_invocation_name)
+		program_invocation_name = argv[0];
+
+	FILE *fp = generate(lines);
+	unsigned long n_sscanf = 0, n_proc_maps = 0;
+	double t_sscanf = 0, t_proc_maps = 0;
+
+	for (unsigned int i = 0; i < iterations; ++i) {
+		double t0 = now();
+		n_sscanf = parse_sscanf(fp);
+		double t1 = now();
+		n_proc_maps = parse_proc_maps(fp);
+		double t2 = now();
+
+		t_sscanf += t1 - t0;
+		t_proc_maps += t2 - t1;
+	}
+
+	if (n_sscanf != n_proc_maps)
+		error_msg_and_die("entry count mismatch: %lu != %lu",
+				  n_sscanf, n_proc_maps);
+
+	printf("%lu lines, %lu named, %u iterations\n",
+	       lines, n_proc_maps, iterations);
+	printf("fgets+sscanf:    %8.3f ms per file\n",
+	       t_sscanf * 1e3 / iterations);
+	printf("proc_maps_parse: %8.3f ms per file (%.1fx)\n",
+	       t_proc_maps * 1e3 / iterations, t_sscanf / t_proc_maps);
+
+	fclose(fp);
+	return 0;
+}
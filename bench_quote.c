@@ -0,0 +1,224 @@
+/*
+ * A microbenchmark of the loops of string_quote and dumpstr on a 4096 byte
+ * buffer, compared with the byte at a time loops they replaced.
+ *
+ * Usage: bench_quote [ITERATIONS]
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <time.h>
+#include "print_utils.h"
+
+#ifndef HAVE_PROGRAM_INVOCATION_NAME
+char *program_invocation_name;
+#endif
+
+void ATTRIBUTE_NORETURN
+die(void)
+{
+	exit(1);
+}
+
+#define BUF_SIZE 4096
+
+static uint8_t text[BUF_SIZE];
+static uint8_t binary[BUF_SIZE];
+/* A line of hexadecimal dump of 16 bytes takes 79 characters.  */
+static char out_old[BUF_SIZE * 5 + 1];
+static char out_new[BUF_SIZE * 5 + 1];
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Printable characters are copied, the rest is escaped as \xXX here.  */
+static char *
+quote_old(char *s, const uint8_t *str, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; ++i) {
+		const uint8_t c = str[i];
+
+		if (is_print(c) && c != '"' && c != '\\') {
+			*s++ = c;
+		} else {
+			*s++ = '\\';
+			*s++ = 'x';
+			s = sprint_byte_hex(s, c);
+		}
+	}
+
+	return s;
+}
+
+static char *
+quote_new(char *s, const uint8_t *str, unsigned int size)
+{
+	unsigned int plain_len = 0;
+
+	for (unsigned int i = 0; i < size; ++i) {
+		const uint8_t c = str[i];
+
+		if (!is_print(c) || c == '"' || c == '\\') {
+			plain_len = 0;
+			*s++ = '\\';
+			*s++ = 'x';
+			s = sprint_byte_hex(s, c);
+		} else if (++plain_len < PLAIN_RUN_MIN) {
+			*s++ = c;
+		} else {
+			const unsigned int n =
+				copy_plain_prefix(s, str + i, size - i);
+
+			s += n;
+			i += n - 1;
+			plain_len = 0;
+		}
+	}
+
+	return s;
+}
+
+static char *
+text_old(char *s, const uint8_t *str, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; ++i) {
+		const uint8_t c = str[i];
+
+		if (c > 0x7e || (c < ' ' && (unsigned int) (c - 9) >= 5))
+			break;
+	}
+
+	return s + i;
+}
+
+static char *
+text_new(char *s, const uint8_t *str, unsigned int size)
+{
+	return s + text_prefix_len(str, size);
+}
+
+static char *
+hex_old(char *s, const uint8_t *str, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; ++i) {
+		*s++ = '\\';
+		*s++ = 'x';
+		s = sprint_byte_hex(s, str[i]);
+	}
+
+	return s;
+}
+
+static char *
+hex_new(char *s, const uint8_t *str, unsigned int size)
+{
+	return sprint_hex_escaped(s, str, size);
+}
+
+static char *
+dump_old(char *s, const uint8_t *str, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += DUMP_LINE_BYTES) {
+		char line[4 * DUMP_LINE_BYTES + 3] = "";
+		char *dst = line;
+
+		memset(line, ' ', sizeof(line) - 1);
+		for (unsigned int j = 0; j < DUMP_LINE_BYTES; ++j) {
+			dst = sprint_byte_hex(dst, str[i + j]);
+			dst++;
+			if (j == DUMP_LINE_BYTES / 2 - 1)
+				dst++;
+		}
+		dst++;
+		for (unsigned int j = 0; j < DUMP_LINE_BYTES; ++j)
+			*dst++ = is_print(str[i + j]) ? str[i + j] : '.';
+
+		s += sprintf(s, " | %05x  %s |\n", i, line);
+	}
+
+	return s;
+}
+
+static char *
+dump_new(char *s, const uint8_t *str, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; i += DUMP_LINE_BYTES) {
+		s = stpcpy(s, " | ");
+		for (int n = 4; n >= 0; --n)
+			*s++ = hex_chars[(i >> (n * 4)) & 0xf];
+		s = stpcpy(s, "  ");
+		s = sprint_dump_line(s, str + i, DUMP_LINE_BYTES);
+		s = stpcpy(s, " |\n");
+	}
+
+	return s;
+}
+
+typedef char *(*format_fn)(char *, const uint8_t *, unsigned int);
+
+static void
+bench(const char *name, const uint8_t *str, unsigned int size,
+      format_fn fn_old, format_fn fn_new, unsigned int iterations)
+{
+	char *end_old = fn_old(out_old, str, size);
+	char *end_new = fn_new(out_new, str, size);
+
+	if (end_old - out_old != end_new - out_new ||
+	    memcmp(out_old, out_new, end_old - out_old))
+		error_msg_and_die("%s: output mismatch", name);
+
+	double t0 = now();
+	for (unsigned int i = 0; i < iterations; ++i)
+		fn_old(out_old, str, size);
+	double t1 = now();
+	for (unsigned int i = 0; i < iterations; ++i)
+		fn_new(out_new, str, size);
+	double t2 = now();
+
+	printf("%-20s byte at a time %7.2f us, new %7.2f us (%.1fx)\n", name,
+	       (t1 - t0) * 1e6 / iterations, (t2 - t1) * 1e6 / iterations,
+	       (t1 - t0) / (t2 - t1));
+}
+
+int
+main(int argc, char **argv)
+{
+	const unsigned int iterations = argc > 1 ? strtoul(argv[1], NULL, 0)
+						 : 20000;
+	static const char words[] =
+		"GET /index.html HTTP/1.1\r\nHost: example.com\r\n"
+		"User-Agent: \"bench\"\r\nAccept: */*\r\n\r\n";
+
+	if (!program_invocation_name || !*program_invocation_name)
+		program_invocation_name = argv[0];
+
+	srand(0);
+	for (unsigned int i = 0; i < BUF_SIZE; ++i) {
+		text[i] = words[i % (sizeof(words) - 1)];
+		binary[i] = rand();
+	}
+
+	printf("%u bytes, %u iterations\n", BUF_SIZE, iterations);
+	bench("quote text", text, BUF_SIZE, quote_old, quote_new, iterations);
+	bench("quote binary", binary, BUF_SIZE, quote_old, quote_new,
+	      iterations);
+	bench("-x text check", text, BUF_SIZE, text_old, text_new,
+	      iterations);
+	bench("-xx hex", binary, BUF_SIZE, hex_old, hex_new, iterations);
+	bench("dump binary", binary, BUF_SIZE, dump_old, dump_new,
+	      iterations);
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * A microbenchmark of xlookup and sprintflags_ex on some of the tables
+ * that are used most often, with and without the lookup index.
+ *
+ * Usage: bench_xlat [ITERATIONS]
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <time.h>
+#include <linux/mman.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "flock.h"
+#include "ptrace.h"
+
+#include "xlat/fcntlcmds.h"
+#include "xlat/mmap_flags.h"
+#include "xlat/mmap_prot.h"
+#include "xlat/open_mode_flags.h"
+#include "xlat/ptrace_cmds.h"
+#include "xlat/sock_options.h"
+
+#ifndef HAVE_PROGRAM_INVOCATION_NAME
+char *program_invocation_name;
+#endif
+
+enum xlat_style xlat_verbosity = XLAT_STYLE_ABBREV;
+
+void ATTRIBUTE_NORETURN
+die(void)
+{
+	exit(1);
+}
+
+/* The printing functions are not benchmarked.  */
+void
+tprints(const char *str)
+{
+}
+
+void
+tprintf(const char *fmt, ...)
+{
+}
+
+void
+tprints_comment(const char *str)
+{
+}
+
+static const uint64_t open_flags[] = {
+	O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_RDWR | O_CLOEXEC,
+	O_RDONLY | O_NONBLOCK | O_DIRECTORY | O_CLOEXEC,
+	O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, O_RDONLY | O_NOFOLLOW,
+};
+
+static const uint64_t map_flags[] = {
+	MAP_PRIVATE | MAP_ANONYMOUS, MAP_SHARED, MAP_PRIVATE | MAP_FIXED,
+	MAP_PRIVATE | MAP_DENYWRITE, MAP_PRIVATE | MAP_FIXED | MAP_DENYWRITE,
+	MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE,
+};
+
+static const uint64_t prot_flags[] = {
+	PROT_NONE, PROT_READ, PROT_READ | PROT_WRITE, PROT_READ | PROT_EXEC,
+};
+
+static const uint64_t fcntl_cmds[] = {
+	F_GETFD, F_SETFD, F_GETFL, F_SETFL, F_DUPFD_CLOEXEC, F_SETLKW,
+	F_ADD_SEALS, F_OFD_SETLKW, 0xbad,
+};
+
+static const uint64_t sock_opts[] = {
+	SO_REUSEADDR, SO_KEEPALIVE, SO_SNDBUF, SO_RCVBUF, SO_ERROR,
+	SO_PASSCRED, SO_TIMESTAMP, SO_PEERCRED, SO_BUSY_POLL, 0xbad,
+};
+
+static const uint64_t ptrace_reqs[] = {
+	PTRACE_PEEKDATA, PTRACE_GETREGS, PTRACE_CONT, PTRACE_SYSCALL,
+	PTRACE_SEIZE, PTRACE_GETEVENTMSG, PTRACE_GET_SYSCALL_INFO, 0xbad,
+};
+
+struct bench {
+	const char *name;
+	const struct xlat *xlat;
+	const uint64_t *vals;
+	unsigned int nvals;
+	bool flags;
+};
+
+static const struct bench benches[] = {
+	{ "open flags", open_mode_flags, ARRSZ_PAIR(open_flags), true },
+	{ "mmap flags", mmap_flags, ARRSZ_PAIR(map_flags), true },
+	{ "mmap prot", mmap_prot, ARRSZ_PAIR(prot_flags), true },
+	{ "fcntl cmds", fcntlcmds, ARRSZ_PAIR(fcntl_cmds), false },
+	{ "socket options", sock_options, ARRSZ_PAIR(sock_opts), false },
+	{ "ptrace requests", ptrace_cmds, ARRSZ_PAIR(ptrace_reqs), false },
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *
+lookup(const struct bench *b, const struct xlat *xlat, uint64_t val)
+{
+	return b->flags ? sprintflags_ex("", xlat, val, '\0', XLAT_STYLE_ABBREV)
+			: xlookup(xlat, val);
+}
+
+static void
+check(const struct bench *b, const struct xlat *linear)
+{
+	for (unsigned int i = 0; i < b->nvals; ++i) {
+		const char *str = lookup(b, linear, b->vals[i]);
+		char *expected = str ? xstrdup(str) : NULL;
+
+		str = lookup(b, b->xlat, b->vals[i]);
+		if (!str != !expected || (str && strcmp(str, expected)))
+			error_msg_and_die("%s: %#" PRIx64 ": %s != %s",
+					  b->name, b->vals[i],
+					  str ?: "NULL", expected ?: "NULL");
+		free(expected);
+	}
+}
+
+static double
+run(const struct bench *b, const struct xlat *xlat, unsigned int iterations)
+{
+	unsigned long sum = 0;
+	double t0 = now();
+
+	for (unsigned int i = 0; i < iterations; ++i) {
+		for (unsigned int j = 0; j < b->nvals; ++j)
+			sum += (uintptr_t) lookup(b, xlat, b->vals[j]);
+	}
+
+	double t1 = now();
+
+	/* Do not let the compiler throw the lookups away.  */
+	if (!sum)
+		putchar('\0');
+
+	return (t1 - t0) * 1e9 / iterations / b->nvals;
+}
+
+int
+main(int argc, char **argv)
+{
+	const unsigned int iterations = argc > 1 ? strtoul(argv[1], NULL, 0)
+						 : 1000000;
+
+	if (!program_invocation_name || !*program_invocation_name)
+		program_invocation_name = argv[0];
+
+	printf("%u iterations\n", iterations);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(benches); ++i) {
+		const struct bench *const b = &benches[i];
+		struct xlat linear = *b->xlat;
+
+		linear.index = NULL;
+
+		check(b, &linear);
+
+		const double t_linear = run(b, &linear, iterations);
+		const double t_indexed = run(b, b->xlat, iterations);
+
+		printf("%-16s %3u entries: linear %6.1f ns, indexed %6.1f ns"
+		       " (%.1fx)\n", b->name, b->xlat->size,
+		       t_linear, t_indexed, t_linear / t_indexed);
+	}
+
+	return 0;
+}
@@ -832,9 +832,9 @@ BEGIN_BPF_CMD_DECODER(BPF_OBJ_GET_INFO_BY_FD)
 	struct obj_get_info_saved *saved;
 
 	if (entering(tcp)) {
-		saved = xzalloc(sizeof(*saved));
+		saved = tcb_zalloc(tcp, sizeof(*saved));
 		saved->info_len = attr.info_len;
-		set_tcb_priv_data(tcp, saved, free);
+		set_tcb_priv_data(tcp, saved, NULL);
 
 		PRINT_FIELD_FD("{info={", attr, bpf_fd, tcp);
 		PRINT_FIELD_U(", ", attr, info_len);
@@ -0,0 +1,171 @@
+/*
+ * Capture of the data read and written by the tracees to files.
+ *
+ * With --capture-dir=DIR, the data that -e read=SET and -e write=SET
+ * would dump in hexadecimal is appended as is to DIR/TGID.FD, one file
+ * per traced process and file descriptor, and the trace refers to it
+ * by offset and length.  No more than CAPTURE_FILES_MAX files are kept
+ * open at once, the least recently used one is closed to make room.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "xmalloc.h"
+#include "xstring.h"
+
+/* The value of out_fd when the file could not be opened.  */
+#define CAPTURE_FD_FAILED	(-2)
+/* The number of the files kept open at once.  */
+#define CAPTURE_FILES_MAX	64
+
+struct capture_file {
+	int tgid;
+	int fd;			/* The file descriptor of the tracee */
+	int out_fd;		/* CAPTURE_FD_FAILED if could not be opened */
+	uint64_t offset;	/* The size of the file */
+	uint64_t last_use;
+};
+
+static struct capture_file capture_files[CAPTURE_FILES_MAX];
+static unsigned int capture_files_count;
+static uint64_t capture_clock;
+
+const char *capture_dir;
+static int capture_dir_fd = -1;
+
+void
+capture_init(void)
+{
+	capture_dir_fd = open(capture_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (capture_dir_fd < 0 && errno == ENOENT) {
+		if (mkdir(capture_dir, 0777) && errno != EEXIST)
+			perror_msg_and_die("mkdir: %s", capture_dir);
+		capture_dir_fd = open(capture_dir,
+				      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+	if (capture_dir_fd < 0)
+		perror_msg_and_die("Can't open %s", capture_dir);
+}
+
+static struct capture_file *
+get_capture_file(struct tcb *const tcp, const int fd)
+{
+	const int tgid = get_proc_tgid(tcp);
+	struct capture_file *cf = NULL;
+
+	for (unsigned int i = 0; i < capture_files_count; ++i) {
+		struct capture_file *const f = &capture_files[i];
+
+		if (f->tgid == tgid && f->fd == fd) {
+			f->last_use = ++capture_clock;
+			return f->out_fd < 0 ? NULL : f;
+		}
+		if (!cf || f->last_use < cf->last_use)
+			cf = f;
+	}
+
+	if (capture_files_count < CAPTURE_FILES_MAX) {
+		cf = &capture_files[capture_files_count++];
+	} else if (cf->out_fd >= 0) {
+		/* The file is opened with O_APPEND, it can be reopened later.  */
+		close(cf->out_fd);
+	}
+
+	char name[sizeof(int) * 3 * 2 + 2];
+	struct stat st;
+
+	cf->tgid = tgid;
+	cf->fd = fd;
+	cf->last_use = ++capture_clock;
+
+	xsprintf(name, "%d.%d", tgid, fd);
+	cf->out_fd = openat(capture_dir_fd, name,
+			    O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	if (cf->out_fd < 0 || fstat(cf->out_fd, &st)) {
+		perror_msg("Can't open %s/%s", capture_dir, name);
+		if (cf->out_fd >= 0)
+			close(cf->out_fd);
+		cf->out_fd = CAPTURE_FD_FAILED;
+		return NULL;
+	}
+	cf->offset = st.st_size;
+
+	return cf;
+}
+
+void
+capture_data(struct tcb *const tcp, const int fd, const kernel_ulong_t addr,
+	     const kernel_ulong_t len)
+{
+	/** Arbitrarily chosen size of the copies from the tracee.  */
+	enum { CAPTURE_BUF_SIZE = 1 << 16 };
+	static char *buf;
+
+	if (!len)
+		return;
+
+	struct capture_file *const cf = get_capture_file(tcp, fd);
+
+	if (!cf) {
+		tprints(" | <Cannot capture>\n");
+		return;
+	}
+
+	if (!buf)
+		buf = xmalloc(CAPTURE_BUF_SIZE);
+
+	const uint64_t offset = cf->offset;
+	kernel_ulong_t done = 0;
+
+	while (done < len) {
+		const unsigned int size = MIN(len - done, CAPTURE_BUF_SIZE);
+
+		if (umoven(tcp, addr + done, size, buf) < 0)
+			break;
+
+		ssize_t rc = write(cf->out_fd, buf, size);
+
+		if (rc != (ssize_t) size) {
+			if (rc < 0)
+				perror_msg("write: %s/%d.%d",
+					   capture_dir, cf->tgid, fd);
+			if (rc > 0)
+				done += rc;
+			break;
+		}
+		done += size;
+	}
+	cf->offset += done;
+
+	if (done)
+		tprintf(" | %" PRI_klu " byte%s captured to %d.%d"
+			" at offset %" PRIu64 "\n",
+			done, done == 1 ? "" : "s", cf->tgid, fd, offset);
+	if (done < len)
+		tprintf(" | <Cannot capture %" PRI_klu " byte%s from pid %d"
+			" @%#" PRI_klx ">\n",
+			len - done, len - done == 1 ? "" : "s",
+			tcp->pid, addr + done);
+}
+
+void
+capture_drop_files(const int tgid)
+{
+	for (unsigned int i = 0; i < capture_files_count; ) {
+		struct capture_file *const cf = &capture_files[i];
+
+		if (cf->tgid != tgid) {
+			++i;
+			continue;
+		}
+		if (cf->out_fd >= 0)
+			close(cf->out_fd);
+		*cf = capture_files[--capture_files_count];
+	}
+}
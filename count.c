@@ -17,6 +17,7 @@
 #include "defs.h"
 
 #include <stdarg.h>
+#include "delay.h"
 
 /* Per-syscall stats structure */
 struct call_counts {
@@ -133,6 +134,12 @@ count_syscall(struct tcb *tcp, const struct timespec *syscall_exiting_ts)
 	ts_add(&cc->time, &cc->time, wts_nonneg);
 	cc->time_min = *ts_min(&cc->time_min, wts_nonneg);
 	cc->time_max = *ts_max(&cc->time_max, wts_nonneg);
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_folded
+	    && (!stack_trace_suspended || unwind_tcb_captured(tcp)))
+		unwind_tcb_count(tcp, wts_nonneg);
+#endif
 }
 
 static int
@@ -501,10 +508,37 @@ call_summary_pers(FILE *outf)
 #undef FC_
 }
 
+/*
+ * Only the sampled syscalls are counted,
+ * estimate the totals from them.  The extremes are left as is.
+ */
+static void
+scale_counts(const double scale)
+{
+	for (size_t i = 0; i < nsyscalls; ++i) {
+		struct call_counts *const cc = &counts[i];
+
+		if (cc->calls == 0)
+			continue;
+
+		const double t = ts_float(&cc->time) * scale;
+
+		cc->calls = cc->calls * scale + 0.5;
+		cc->errors = cc->errors * scale + 0.5;
+		cc->time.tv_sec = t;
+		cc->time.tv_nsec = (t - cc->time.tv_sec) * 1e9;
+	}
+}
+
 void
 call_summary(FILE *outf)
 {
 	unsigned int i, old_pers = current_personality;
+	const double scale = sample_scale();
+
+	if (scale != 1)
+		fprintf(outf, "System call usage estimated from a sample"
+			" of 1 in %.2f syscalls:\n", scale);
 
 	for (i = 0; i < SUPPORTED_PERSONALITIES; ++i) {
 		if (!countv[i])
@@ -516,9 +550,14 @@ call_summary(FILE *outf)
 			fprintf(outf,
 				"System call usage summary for %s mode:\n",
 				personality_names[i]);
+		if (scale != 1)
+			scale_counts(scale);
 		call_summary_pers(outf);
 	}
 
+	io_uring_summary(outf);
+	delay_summary(outf);
+
 	if (old_pers != current_personality)
 		set_personality(old_pers);
 }
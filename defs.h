@@ -221,6 +221,7 @@ typedef struct ioctlent {
 # define INJECT_F_DELAY_ENTER	0x08
 # define INJECT_F_DELAY_EXIT	0x10
 # define INJECT_F_SYSCALL	0x20
+# define INJECT_F_PROBABILITY	0x40
 
 # define INJECT_ACTION_FLAGS	\
 	(INJECT_F_SIGNAL	\
@@ -231,11 +232,12 @@ typedef struct ioctlent {
 	)
 
 struct inject_data {
-	uint8_t flags;		/* 6 of 8 flags are used so far */
+	uint8_t flags;		/* 7 of 8 flags are used so far */
 	uint8_t signo;		/* NSIG <= 128 */
 	uint16_t rval_idx;	/* index in retval_vec */
 	uint16_t delay_idx;	/* index in delay_data_vec */
 	uint16_t scno;		/* syscall to be injected instead of -1 */
+	uint16_t probability;	/* in 1/65536 units, 0 means always */
 };
 
 struct inject_opts {
@@ -251,35 +253,50 @@ struct inject_opts {
 
 /* Trace Control Block */
 struct tcb {
+	/*
+	 * The fields used on every syscall stop go first,
+	 * the ones used rarely or by particular options go last.
+	 */
 	int flags;		/* See below for TCB_ values */
 	int pid;		/* If 0, this tcb is free */
 	int qual_flg;		/* qual_flags[scno] or DEFAULT_QUAL_FLAGS + RAW */
 # if SUPPORTED_PERSONALITIES > 1
 	unsigned int currpers;	/* Personality at the time of scno update */
 # endif
-	unsigned long u_error;	/* Error code */
 	kernel_ulong_t scno;	/* System call number */
 	kernel_ulong_t true_scno;	/* Same, but without subcall decoding and shuffling */
-	kernel_ulong_t u_arg[MAX_ARGS];	/* System call arguments */
+	const struct_sysent *s_ent; /* sysent[scno] or a stub struct for bad
+				     * scno.  Use tcp_sysent() macro for access.
+				     */
 	kernel_long_t u_rval;	/* Return value */
+	unsigned long u_error;	/* Error code */
+	FILE *outf;		/* Output file for this process */
+	kernel_ulong_t u_arg[MAX_ARGS];	/* System call arguments */
 	int sys_func_rval;	/* Syscall entry parser's return value */
 	int curcol;		/* Output column for this process */
-	FILE *outf;		/* Output file for this process */
+	const char *auxstr;	/* Auxiliary info from syscall (see RVAL_STR) */
 	struct staged_output_data *staged_output_data;
+	struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
+	struct timespec etime;	/* Syscall entry time (CLOCK_MONOTONIC) */
+
+	/*
+	 * Data that is stored during process wait traversal.
+	 * We use indices as the actual data is stored in an array
+	 * that is realloc'ed at runtime.
+	 */
+	size_t wait_data_idx;
+	struct list_item wait_list;
 
-	const char *auxstr;	/* Auxiliary info from syscall (see RVAL_STR) */
 	void *_priv_data;	/* Private data for syscall decoding functions */
 	void (*_free_priv_data)(void *); /* Callback for freeing priv_data */
-	const struct_sysent *s_ent; /* sysent[scno] or a stub struct for bad
-				     * scno.  Use tcp_sysent() macro for access.
-				     */
 	const struct_sysent *s_prev_ent; /* for "resuming interrupted SYSCALL" msg */
-	struct inject_opts *inject_vec[SUPPORTED_PERSONALITIES];
 	struct timespec stime;	/* System time usage as of last process wait */
 	struct timespec ltime;	/* System time usage as of last syscall entry */
 	struct timespec atime;	/* System time right after attach */
-	struct timespec etime;	/* Syscall entry time (CLOCK_MONOTONIC) */
 	struct timespec delay_expiration_time; /* When does the delay end */
+	size_t delay_heap_idx;	/* The index in the heap of the delayed tcbs */
+	/** Wait data storage for a delayed process. */
+	struct tcb_wait_data *delayed_wait_data;
 
 	/*
 	 * The ID of the PID namespace of this process
@@ -288,18 +305,10 @@ struct tcb {
 	 */
 	unsigned int pid_ns;
 
-	struct mmap_cache_t *mmap_cache;
-
-	/*
-	 * Data that is stored during process wait traversal.
-	 * We use indices as the actual data is stored in an array
-	 * that is realloc'ed at runtime.
-	 */
-	size_t wait_data_idx;
-	/** Wait data storage for a delayed process. */
-	struct tcb_wait_data *delayed_wait_data;
-	struct list_item wait_list;
+	int tgid;		/* Cached by get_proc_tgid, 0 if not known yet */
 
+	struct mmap_cache_t *mmap_cache;	/* Shared by the thread group */
+	unsigned int mmap_cache_generation; /* Last seen by this tcb */
 
 # ifdef HAVE_LINUX_KVM_H
 	struct vcpu_info *vcpu_info_list;
@@ -309,8 +318,19 @@ struct tcb {
 	void *unwind_ctx;
 	struct unwind_queue_t *unwind_queue;
 # endif
+
+	/*
+	 * The fields below are not cleared when the tcb is dropped,
+	 * they keep the allocations made for one tracee for reuse
+	 * by the next one.
+	 */
+	struct inject_opts *spare_inject_vec[SUPPORTED_PERSONALITIES];
+	struct tcb_arena *arena;	/* See tcb_alloc */
 };
 
+/* The part of struct tcb that is cleared when it is dropped.  */
+# define TCB_CLEARED_SIZE	offsetof(struct tcb, spare_inject_vec)
+
 /* TCB flags */
 /* We have attached to this process, but did not see it stopping yet */
 # define TCB_STARTUP		0x01
@@ -346,6 +366,8 @@ struct tcb {
 # define TCB_SECCOMP_FILTER	0x8000	/* This process has a seccomp filter
 					 * attached.
 					 */
+# define TCB_SKIP_EXIT	0x10000	/* Current syscall has been printed
+				   on entry, its exit is not decoded */
 
 /* qualifier flags */
 # define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -353,6 +375,7 @@ struct tcb {
 # define QUAL_VERBOSE	0x004	/* decode the structures of this syscall */
 # define QUAL_RAW	0x008	/* print all args in hex for this syscall */
 # define QUAL_INJECT	0x010	/* tamper with this system call on purpose */
+# define QUAL_ENTRY_ONLY	0x020	/* print this system call on entry only */
 
 # define DEFAULT_QUAL_FLAGS (QUAL_TRACE | QUAL_ABBREV | QUAL_VERBOSE)
 
@@ -364,6 +387,7 @@ struct tcb {
 # define abbrev(tcp)	((tcp)->qual_flg & QUAL_ABBREV)
 # define raw(tcp)	((tcp)->qual_flg & QUAL_RAW)
 # define inject(tcp)	((tcp)->qual_flg & QUAL_INJECT)
+# define entry_only(tcp)	((tcp)->qual_flg & QUAL_ENTRY_ONLY)
 # define filtered(tcp)	((tcp)->flags & TCB_FILTERED)
 # define hide_log(tcp)	((tcp)->flags & TCB_HIDE_LOG)
 # define check_exec_syscall(tcp)	((tcp)->flags & TCB_CHECK_EXEC_SYSCALL)
@@ -373,6 +397,7 @@ struct tcb {
 # define syscall_delayed(tcp)	((tcp)->flags & TCB_DELAYED)
 # define syscall_tampered_nofail(tcp) ((tcp)->flags & TCB_TAMPERED_NO_FAIL)
 # define has_seccomp_filter(tcp)	((tcp)->flags & TCB_SECCOMP_FILTER)
+# define exit_skipped(tcp)	((tcp)->flags & TCB_SKIP_EXIT)
 
 extern const struct_sysent stub_sysent;
 # define tcp_sysent(tcp) (tcp->s_ent ?: &stub_sysent)
@@ -509,11 +534,22 @@ enum xflag_opts {
 extern unsigned xflag;
 extern bool followfork;
 extern bool output_separately;
+/* append the data of -e read and -e write to files in this directory */
+extern const char *capture_dir;
 # ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 extern bool stack_trace_enabled;
+/* print each distinct stack trace once, and refer to it by its ID */
+extern bool stack_trace_ids;
+/* aggregate stack traces per syscall into this file in the folded format */
+extern const char *stack_trace_folded;
+/* load and save the symbols of files with a build ID in this file */
+extern const char *stack_trace_symbol_cache;
+/* stack traces are not collected for now, to reduce the tracing overhead */
+extern bool stack_trace_suspended;
 # else
 #  define stack_trace_enabled 0
+#  define stack_trace_folded NULL
 # endif
 extern unsigned ptrace_setoptions;
 extern unsigned max_strlen;
@@ -527,8 +563,37 @@ extern void set_sortby(const char *);
 extern int set_overhead(const char *);
 extern void set_count_summary_columns(const char *columns);
 
+/* true if --sample or --sample-time is in effect */
+extern bool sampling_enabled;
+extern bool sample_set_rate(const char *);
+extern bool sample_set_time(const char *);
+extern void sample_init(void);
+/* Makes the sampling factor times sparser, 1 restores the configured rate.  */
+extern void sample_throttle(unsigned int factor);
+/* Returns true if the syscall being entered is to be traced.  */
+extern bool syscall_sampled(void);
+/* The ratio of all the syscalls to the sampled ones.  */
+extern double sample_scale(void);
+
+/* --overhead-budget in percents, 0 if not set */
+extern unsigned int overhead_budget;
+extern bool governor_set_budget(const char *);
+extern void governor_init(void);
+/* Called around the waiting for the stops of the tracees.  */
+extern void governor_idle_begin(void);
+extern void governor_idle_end(void);
+extern void detach_all(void);
+
+/* Returns the tcb of the tracee with the given PID, NULL if not traced.  */
+extern struct tcb *pid2tcb(int pid);
+
 extern bool get_instruction_pointer(struct tcb *, kernel_ulong_t *);
 extern bool get_stack_pointer(struct tcb *, kernel_ulong_t *);
+# if HAVE_ARCH_FRAME_POINTER
+extern bool get_frame_pointer(struct tcb *, kernel_ulong_t *);
+/* Fails on architectures that save return addresses on the stack.  */
+extern bool get_link_register(struct tcb *, kernel_ulong_t *);
+# endif
 extern void print_instruction_pointer(struct tcb *);
 
 extern void print_syscall_number(struct tcb *);
@@ -546,6 +611,17 @@ extern void syscall_exiting_finish(struct tcb *);
 extern void count_syscall(struct tcb *, const struct timespec *);
 extern void call_summary(FILE *);
 
+extern bool io_uring_has_rings(void);
+extern bool io_uring_is_ring_fd(struct tcb *, int fd);
+extern void io_uring_close_notify(struct tcb *, unsigned int first,
+				  unsigned int last);
+/* Forgets the rings of the thread group TGID.  */
+extern void io_uring_drop_rings(int tgid);
+extern void io_uring_setup_notify(struct tcb *);
+extern void io_uring_mmap_notify(struct tcb *, unsigned long long offset);
+extern void io_uring_enter_notify(struct tcb *);
+extern void io_uring_summary(FILE *);
+
 extern void clear_regs(struct tcb *tcp);
 extern int get_scno(struct tcb *);
 extern kernel_ulong_t get_rt_sigframe_addr(struct tcb *);
@@ -595,6 +671,15 @@ extern int set_tcb_priv_data(struct tcb *, void *priv_data,
 			     void (*free_priv_data)(void *));
 extern void free_tcb_priv_data(struct tcb *);
 
+/*
+ * Allocate memory that is released when the current syscall exits,
+ * or when the tcb is dropped, by tcb_arena_reset.
+ */
+extern void *tcb_alloc(struct tcb *, size_t size);
+extern void *tcb_zalloc(struct tcb *, size_t size);
+extern char *tcb_strdup(struct tcb *, const char *);
+extern void tcb_arena_reset(struct tcb *);
+
 static inline unsigned long get_tcb_priv_ulong(const struct tcb *tcp)
 {
 	return (unsigned long) get_tcb_priv_data(tcp);
@@ -613,6 +698,24 @@ umoven(struct tcb *, kernel_ulong_t addr, unsigned int len, void *laddr);
 # define umove(pid, addr, objp)	\
 	umoven((pid), (addr), sizeof(*(objp)), (void *) (objp))
 
+/**
+ * Like umoven, but stops at the first inaccessible page.
+ *
+ * @return the number of bytes read, -1 if none could be read.
+ */
+extern int
+umoven_partial(struct tcb *, kernel_ulong_t addr, unsigned int len,
+	       void *laddr);
+
+/**
+ * Reads the specified range of the tracee memory at once, umove* calls
+ * within this range are served from the copy until the next tracee stop.
+ * Decoders of large structures use it to avoid reading every field
+ * of every element separately.
+ */
+extern void
+umove_prefetch(struct tcb *, kernel_ulong_t addr, unsigned int len);
+
 /**
  * @return true on success, false on error.
  */
@@ -1017,6 +1120,13 @@ fetch_indirect_syscall_args(struct tcb *, kernel_ulong_t addr, unsigned int n_ar
 
 extern void pidns_init(void);
 
+/**
+ * Notifies the PID NS translation cache that the process with the specified
+ * pid (in the tracer's PID NS) is gone, or has just become a tracee,
+ * so the data cached for the pid is obsolete.
+ */
+extern void pidns_drop_pid(int pid);
+
 /**
  * Returns the pid of the tracee as present in /proc of the tracer (can be
  * different from tcp->pid if /proc and the tracer process are in different PID
@@ -1024,6 +1134,12 @@ extern void pidns_init(void);
  */
 extern int get_proc_pid(struct tcb *);
 
+/**
+ * Returns the thread group ID of the tracee in strace's PID namespace,
+ * the result is cached in the tcb.
+ */
+extern int get_proc_tgid(struct tcb *);
+
 /**
  * Translates a pid from tracee's namespace to our namespace.
  *
@@ -1050,6 +1166,17 @@ dumpiov_upto(struct tcb *, int len, kernel_ulong_t addr, kernel_ulong_t data_siz
 extern void
 dumpstr(struct tcb *, kernel_ulong_t addr, kernel_ulong_t len);
 
+extern void capture_init(void);
+/**
+ * Append len bytes of the tracee memory at addr to the --capture-dir file
+ * of the tracee's file descriptor fd, and print the offset they are written
+ * at in the file.
+ */
+extern void
+capture_data(struct tcb *, int fd, kernel_ulong_t addr, kernel_ulong_t len);
+/* Close the --capture-dir files of the given thread group.  */
+extern void capture_drop_files(int tgid);
+
 extern int
 printstr_ex(struct tcb *, kernel_ulong_t addr, kernel_ulong_t len,
 	    unsigned int user_style);
@@ -1132,6 +1259,9 @@ extern void print_ax25_addr(const void /* ax25_address */ *addr);
 extern void print_x25_addr(const void /* struct x25_address */ *addr);
 extern const char *get_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
 extern bool print_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
+extern void invalidate_sockaddr_by_fd(struct tcb *, int fd);
+/* Returns false if invalidate_sockaddr_by_fd has nothing to invalidate.  */
+extern bool sockaddr_cache_has_entries(void);
 extern void print_dirfd(struct tcb *, int);
 
 extern int
@@ -1198,6 +1328,7 @@ extern void qualify_trace(const char *);
 extern void qualify_abbrev(const char *);
 extern void qualify_verbose(const char *);
 extern void qualify_raw(const char *);
+extern void qualify_entry_only(const char *);
 extern void qualify_signals(const char *);
 extern void qualify_status(const char *);
 extern void qualify_quiet(const char *);
@@ -1339,16 +1470,33 @@ extern const struct timespec *ts_max(const struct timespec *, const struct times
 extern int parse_ts(const char *s, struct timespec *t);
 
 # ifdef ENABLE_STACKTRACE
+extern bool unwind_set_backend(const char *name);
 extern void unwind_init(void);
+extern void unwind_fin(void);
 extern void unwind_tcb_init(struct tcb *);
 extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_tcb_print(struct tcb *);
+/* Releases the stack trace captured and not printed.  */
+extern void unwind_tcb_discard(struct tcb *);
 extern void unwind_tcb_capture(struct tcb *);
+/* Returns true if a stack trace has been captured and not printed yet.  */
+extern bool unwind_tcb_captured(struct tcb *);
+extern bool unwind_set_folded_weight(const char *name);
+extern void unwind_tcb_count(struct tcb *, const struct timespec *);
+extern void unwind_folded_dump(void);
 # endif
 
 # ifdef HAVE_LINUX_KVM_H
 extern void kvm_run_structure_decoder_init(void);
 extern void kvm_vcpu_info_free(struct tcb *);
+/* collect the statistics of KVM_RUN exit reasons */
+extern bool kvm_stats_enabled;
+extern void kvm_stats_init(void);
+extern bool kvm_stats_set_interval(const char *);
+extern void kvm_run_enter_notify(struct tcb *);
+extern void kvm_run_exit_notify(struct tcb *);
+extern bool kvm_stats_report_due(void);
+extern void kvm_stats_summary(FILE *);
 # endif
 
 static inline int
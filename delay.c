@@ -6,10 +6,44 @@
  */
 
 #include "defs.h"
+#include <math.h>
+#include "string_to_uint.h"
+#include "xmalloc.h"
+
+/* The delays longer than that are truncated.  */
+#define DELAY_MAX_NS	1e18
+
+enum delay_dist_type {
+	DELAY_DIST_FIXED,
+	DELAY_DIST_UNIFORM,
+	DELAY_DIST_EXP,
+	DELAY_DIST_LOGNORMAL,
+	DELAY_DIST_HIST,
+};
+
+struct delay_hist_entry {
+	uint64_t ns;		/* The delay */
+	uint64_t cum_weight;	/* The sum of the weights up to this entry */
+};
+
+/* The distribution of the delays injected on entering or exiting.  */
+struct delay_dist {
+	enum delay_dist_type type;
+	struct timespec ts;	/* DELAY_DIST_FIXED */
+	/*
+	 * DELAY_DIST_UNIFORM: the minimum and the maximum, in ns;
+	 * DELAY_DIST_EXP: the mean, in ns;
+	 * DELAY_DIST_LOGNORMAL: the logarithm of the median in ns, and sigma.
+	 */
+	double a;
+	double b;
+	struct delay_hist_entry *hist;	/* DELAY_DIST_HIST */
+	size_t hist_size;
+};
 
 struct inject_delay_data {
-	struct timespec ts_enter;
-	struct timespec ts_exit;
+	struct delay_dist enter;
+	struct delay_dist exit;
 };
 
 static struct inject_delay_data *delay_data_vec;
@@ -19,6 +53,19 @@ static size_t delay_data_vec_size;     /* size of the used arena */
 static timer_t delay_timer = (timer_t) -1;
 static bool delay_timer_is_armed;
 
+/* The binary min-heap of the delayed tcbs by delay_expiration_time.  */
+static struct tcb **delay_heap;
+static size_t delay_heap_capacity;
+static size_t delay_heap_size;
+
+/* The state of the generator of the random delays and probabilities.  */
+static uint64_t rng_state;
+static bool rng_seeded;
+
+/* The totals reported in the summary.  */
+static uint64_t delays_injected;
+static struct timespec delays_injected_ts;
+
 static void
 expand_delay_data_vec(void)
 {
@@ -45,19 +92,261 @@ alloc_delay_data(void)
 	return rval;
 }
 
-void
-fill_delay_data(uint16_t delay_idx, struct timespec *val, bool isenter)
+bool
+inject_set_seed(const char *const str)
+{
+	const long long seed = string_to_ulonglong(str);
+
+	if (seed < 0)
+		return false;
+
+	rng_state = seed;
+	rng_seeded = true;
+	return true;
+}
+
+/* splitmix64.  */
+static uint64_t
+rng_next(void)
+{
+	if (!rng_seeded) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		rng_state = ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec)
+			    ^ ((uint64_t) getpid() << 32);
+		rng_seeded = true;
+		debug_msg("injection seed %" PRIu64, rng_state);
+	}
+
+	uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/* Returns a random number in (0, 1].  */
+static double
+rng_unit(void)
+{
+	return ((rng_next() >> 11) + 1) * 0x1.0p-53;
+}
+
+bool
+inject_chance(const uint16_t probability)
+{
+	return !probability || (rng_next() >> 48) < probability;
+}
+
+static bool
+parse_delay_ns(const char *const str, double *const ns)
+{
+	struct timespec ts;
+
+	if (parse_ts(str, &ts) < 0)
+		return false;
+
+	*ns = ts.tv_sec * 1e9 + ts.tv_nsec;
+	return true;
+}
+
+static bool
+parse_sigma(const char *const str, double *const sigma)
+{
+	char *end;
+
+	errno = 0;
+	*sigma = strtod(str, &end);
+
+	return end != str && !*end && !errno && isfinite(*sigma)
+	       && *sigma >= 0;
+}
+
+/*
+ * Reads the histogram of delays from PATH,
+ * every line of it is "DELAY WEIGHT", empty and "#" lines are skipped.
+ */
+static bool
+parse_delay_hist(const char *const path, struct delay_dist *const d)
+{
+	FILE *const fp = fopen(path, "r");
+
+	if (!fp) {
+		perror_msg("%s", path);
+		return false;
+	}
+
+	static const char delim[] = " \t\n";
+	char *line = NULL;
+	size_t line_size = 0;
+	size_t capacity = 0;
+	unsigned int lineno = 0;
+	uint64_t total = 0;
+	bool rc = true;
+
+	while (getline(&line, &line_size, fp) >= 0) {
+		char *saveptr = NULL;
+		const char *const delay = strtok_r(line, delim, &saveptr);
+
+		++lineno;
+		if (!delay || *delay == '#')
+			continue;
+
+		const char *const weight = strtok_r(NULL, delim, &saveptr);
+		const long long w = weight ? string_to_ulonglong(weight) : -1;
+		struct timespec ts;
+
+		if (w < 0 || strtok_r(NULL, delim, &saveptr)
+		    || parse_ts(delay, &ts) < 0 || total + w < total) {
+			error_msg("%s:%u: invalid delay histogram entry",
+				  path, lineno);
+			rc = false;
+			break;
+		}
+
+		if (!w)
+			continue;
+
+		if (d->hist_size == capacity)
+			d->hist = xgrowarray(d->hist, &capacity,
+					     sizeof(*d->hist));
+
+		total += w;
+		d->hist[d->hist_size].ns =
+			(uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+		d->hist[d->hist_size].cum_weight = total;
+		++d->hist_size;
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (rc && !d->hist_size) {
+		error_msg("%s: empty delay histogram", path);
+		rc = false;
+	}
+
+	if (!rc) {
+		free(d->hist);
+		d->hist = NULL;
+		d->hist_size = 0;
+	}
+
+	return rc;
+}
+
+/*
+ * Parses DELAY, uniform/MIN/MAX, exp/MEAN, lognormal/MEDIAN/SIGMA,
+ * or hist/FILE.
+ */
+static bool
+parse_delay_dist(const char *const str, struct delay_dist *const d)
+{
+	const char *const path = STR_STRIP_PREFIX(str, "hist/");
+
+	if (path != str) {
+		d->type = DELAY_DIST_HIST;
+		return parse_delay_hist(path, d);
+	}
+
+	char *const copy = xstrdup(str);
+	char *p = copy;
+	char *args[3];
+	unsigned int nargs = 0;
+	bool rc = false;
+
+	while (p && nargs < ARRAY_SIZE(args))
+		args[nargs++] = strsep(&p, "/");
+
+	if (p) {
+		/* Too many arguments.  */
+	} else if (nargs == 1) {
+		d->type = DELAY_DIST_FIXED;
+		rc = parse_ts(args[0], &d->ts) >= 0;
+	} else if (nargs == 3 && !strcmp(args[0], "uniform")) {
+		d->type = DELAY_DIST_UNIFORM;
+		rc = parse_delay_ns(args[1], &d->a)
+		     && parse_delay_ns(args[2], &d->b)
+		     && d->a <= d->b;
+	} else if (nargs == 2 && !strcmp(args[0], "exp")) {
+		d->type = DELAY_DIST_EXP;
+		rc = parse_delay_ns(args[1], &d->a) && d->a > 0;
+	} else if (nargs == 3 && !strcmp(args[0], "lognormal")) {
+		d->type = DELAY_DIST_LOGNORMAL;
+		rc = parse_delay_ns(args[1], &d->a) && d->a > 0
+		     && parse_sigma(args[2], &d->b);
+		d->a = log(d->a);
+	}
+
+	free(copy);
+	return rc;
+}
+
+bool
+fill_delay_data(uint16_t delay_idx, const char *str, bool isenter)
 {
 	if (delay_idx >= delay_data_vec_size)
 		error_func_msg_and_die("delay_idx >= delay_data_vec_size");
 
-	struct timespec *ts;
+	struct delay_dist d = { 0 };
+
+	if (!parse_delay_dist(str, &d))
+		return false;
+
 	if (isenter)
-		ts = &(delay_data_vec[delay_idx].ts_enter);
+		delay_data_vec[delay_idx].enter = d;
 	else
-		ts = &(delay_data_vec[delay_idx].ts_exit);
+		delay_data_vec[delay_idx].exit = d;
+
+	return true;
+}
+
+static void
+delay_dist_sample(const struct delay_dist *const d, struct timespec *const ts)
+{
+	double ns = 0;
+
+	switch (d->type) {
+	case DELAY_DIST_FIXED:
+		*ts = d->ts;
+		return;
+	case DELAY_DIST_UNIFORM:
+		ns = d->a + (d->b - d->a) * rng_unit();
+		break;
+	case DELAY_DIST_EXP:
+		ns = -d->a * log(rng_unit());
+		break;
+	case DELAY_DIST_LOGNORMAL: {
+		/* Box-Muller transform.  */
+		const double z = sqrt(-2 * log(rng_unit()))
+				 * cos(2 * M_PI * rng_unit());
+
+		ns = exp(d->a + d->b * z);
+		break;
+	}
+	case DELAY_DIST_HIST: {
+		const uint64_t r =
+			rng_next() % d->hist[d->hist_size - 1].cum_weight;
+		size_t lo = 0, hi = d->hist_size - 1;
+
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
 
-	*ts = *val;
+			if (d->hist[mid].cum_weight > r)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		ns = d->hist[lo].ns;
+		break;
+	}
+	}
+
+	const uint64_t n = ns < DELAY_MAX_NS ? ns : DELAY_MAX_NS;
+
+	ts->tv_sec = n / 1000000000;
+	ts->tv_nsec = n % 1000000000;
 }
 
 static bool
@@ -78,9 +367,103 @@ delay_timer_expired(void)
 	delay_timer_is_armed = false;
 }
 
+static void
+delay_heap_set(const size_t idx, struct tcb *const tcp)
+{
+	delay_heap[idx] = tcp;
+	tcp->delay_heap_idx = idx;
+}
+
+static bool
+delay_heap_less(const size_t a, const size_t b)
+{
+	return ts_cmp(&delay_heap[a]->delay_expiration_time,
+		      &delay_heap[b]->delay_expiration_time) < 0;
+}
+
+static void
+delay_heap_swap(const size_t a, const size_t b)
+{
+	struct tcb *const tcp = delay_heap[a];
+
+	delay_heap_set(a, delay_heap[b]);
+	delay_heap_set(b, tcp);
+}
+
+static void
+delay_heap_sift_up(size_t idx)
+{
+	while (idx > 0) {
+		const size_t parent = (idx - 1) / 2;
+
+		if (!delay_heap_less(idx, parent))
+			break;
+		delay_heap_swap(idx, parent);
+		idx = parent;
+	}
+}
+
+static void
+delay_heap_sift_down(size_t idx)
+{
+	for (;;) {
+		const size_t left = idx * 2 + 1;
+		const size_t right = left + 1;
+		size_t min = idx;
+
+		if (left < delay_heap_size && delay_heap_less(left, min))
+			min = left;
+		if (right < delay_heap_size && delay_heap_less(right, min))
+			min = right;
+		if (min == idx)
+			break;
+		delay_heap_swap(idx, min);
+		idx = min;
+	}
+}
+
+static void
+delay_heap_remove(const size_t idx)
+{
+	if (--delay_heap_size == idx)
+		return;
+
+	delay_heap_set(idx, delay_heap[delay_heap_size]);
+	delay_heap_sift_up(idx);
+	delay_heap_sift_down(idx);
+}
+
+void
+undelay_tcb(struct tcb *const tcp)
+{
+	if (tcp->delay_heap_idx >= delay_heap_size
+	    || delay_heap[tcp->delay_heap_idx] != tcp)
+		error_func_msg_and_die("pid %d is not delayed", tcp->pid);
+
+	delay_heap_remove(tcp->delay_heap_idx);
+}
+
+struct tcb *
+pop_expired_delayed_tcb(const struct timespec *const ts_now)
+{
+	if (!delay_heap_size
+	    || ts_cmp(ts_now, &delay_heap[0]->delay_expiration_time) <= 0)
+		return NULL;
+
+	struct tcb *const tcp = delay_heap[0];
+
+	delay_heap_remove(0);
+
+	return tcp;
+}
+
 void
-arm_delay_timer(const struct tcb *const tcp)
+arm_delay_timer(void)
 {
+	if (!delay_heap_size)
+		return;
+
+	const struct tcb *const tcp = delay_heap[0];
 	const struct itimerspec its = {
 		.it_value = tcp->delay_expiration_time
 	};
@@ -106,28 +489,39 @@ delay_tcb(struct tcb *tcp, uint16_t delay_idx, bool isenter)
 		       tcp->pid, isenter ? "enter" : "exit");
 	tcp->flags |= TCB_DELAYED;
 
-	struct timespec *ts_diff;
-	if (isenter)
-		ts_diff = &(delay_data_vec[delay_idx].ts_enter);
-	else
-		ts_diff = &(delay_data_vec[delay_idx].ts_exit);
+	struct timespec ts_diff;
+	delay_dist_sample(isenter ? &delay_data_vec[delay_idx].enter
+				  : &delay_data_vec[delay_idx].exit, &ts_diff);
+
+	++delays_injected;
+	ts_add(&delays_injected_ts, &delays_injected_ts, &ts_diff);
 
 	struct timespec ts_now;
 	clock_gettime(CLOCK_MONOTONIC, &ts_now);
-	ts_add(&tcp->delay_expiration_time, &ts_now, ts_diff);
+	ts_add(&tcp->delay_expiration_time, &ts_now, &ts_diff);
 
-	if (is_delay_timer_created()) {
-		struct itimerspec its;
-		if (timer_gettime(delay_timer, &its))
-			perror_msg_and_die("timer_gettime");
+	if (delay_heap_size == delay_heap_capacity)
+		delay_heap = xgrowarray(delay_heap, &delay_heap_capacity,
+					sizeof(*delay_heap));
+	delay_heap_set(delay_heap_size++, tcp);
+	delay_heap_sift_up(tcp->delay_heap_idx);
 
-		const struct timespec *const ts_old = &its.it_value;
-		if (ts_nz(ts_old) && ts_cmp(ts_diff, ts_old) > 0)
-			return;
-	} else {
+	if (!is_delay_timer_created()) {
 		if (timer_create(CLOCK_MONOTONIC, NULL, &delay_timer))
 			perror_msg_and_die("timer_create");
 	}
 
-	arm_delay_timer(tcp);
+	/* The timer is armed already if this tcb is not the next one.  */
+	if (delay_heap[0] == tcp)
+		arm_delay_timer();
+}
+
+void
+delay_summary(FILE *const outf)
+{
+	if (!delays_injected)
+		return;
+
+	fprintf(outf, "\nInjected %" PRIu64 " delays, %.6f seconds in total\n",
+		delays_injected, ts_float(&delays_injected_ts));
 }
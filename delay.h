@@ -9,10 +9,15 @@
 # define STRACE_DELAY_H
 
 uint16_t alloc_delay_data(void);
-void fill_delay_data(uint16_t delay_idx, struct timespec *val, bool isenter);
+bool fill_delay_data(uint16_t delay_idx, const char *str, bool isenter);
+bool inject_set_seed(const char *str);
+bool inject_chance(uint16_t probability);
 bool is_delay_timer_armed(void);
 void delay_timer_expired(void);
-void arm_delay_timer(const struct tcb *);
+void arm_delay_timer(void);
 void delay_tcb(struct tcb *, uint16_t delay_idx, bool isenter);
+void undelay_tcb(struct tcb *);
+struct tcb *pop_expired_delayed_tcb(const struct timespec *ts_now);
+void delay_summary(FILE *);
 
 #endif /* !STRACE_DELAY_H */
@@ -456,22 +456,16 @@ dm_known_ioctl(struct tcb *const tcp, const unsigned int code,
 	struct dm_ioctl *entering_ioc = NULL;
 	bool ioc_changed = false;
 
-	if (entering(tcp)) {
-		ioc = malloc(sizeof(*ioc));
-		if (!ioc)
-			return 0;
-	} else {
+	if (entering(tcp))
+		ioc = tcb_alloc(tcp, sizeof(*ioc));
+	else
 		ioc = alloca(sizeof(*ioc));
-	}
 
 	if ((umoven(tcp, arg, offsetof(struct dm_ioctl, data), ioc) < 0) ||
-	    (ioc->data_size < offsetof(struct dm_ioctl, data_size))) {
-		if (entering(tcp))
-			free(ioc);
+	    (ioc->data_size < offsetof(struct dm_ioctl, data_size)))
 		return 0;
-	}
 	if (entering(tcp))
-		set_tcb_priv_data(tcp, ioc, free);
+		set_tcb_priv_data(tcp, ioc, NULL);
 	else {
 		entering_ioc = get_tcb_priv_data(tcp);
 
@@ -26,6 +26,7 @@ bool quiet_set_updated = false;
 bool decode_fd_set_updated = false;
 
 static struct number_set *abbrev_set;
+static struct number_set *entry_only_set;
 static struct number_set *inject_set;
 static struct number_set *raw_set;
 static struct number_set *verbose_set;
@@ -125,20 +126,38 @@ parse_delay_token(const char *input, struct inject_opts *fopts, bool isenter)
 
        if (fopts->data.flags & flag) /* duplicate */
                return false;
-       struct timespec tsval;
-
-       if (parse_ts(input, &tsval) < 0) /* couldn't parse */
-               return false;
 
        if (fopts->data.delay_idx == (uint16_t) -1)
                fopts->data.delay_idx = alloc_delay_data();
-       /* populate .ts_enter or .ts_exit */
-       fill_delay_data(fopts->data.delay_idx, &tsval, isenter);
+       /* populate .enter or .exit */
+       if (!fill_delay_data(fopts->data.delay_idx, input, isenter))
+               return false; /* couldn't parse */
        fopts->data.flags |= flag;
 
        return true;
 }
 
+/* Parses the percentage P into 1/65536 units, 0 stands for 100%.  */
+static bool
+parse_probability_token(const char *const input,
+			struct inject_opts *const fopts)
+{
+	char *end;
+
+	errno = 0;
+	const double p = strtod(input, &end);
+
+	if (end == input || errno || (*end && strcmp(end, "%"))
+	    || !(p > 0 && p <= 100))
+		return false;
+
+	const unsigned int val = p * 65536 / 100 + 0.5;
+
+	fopts->data.probability = val >= 65536 ? 0 : MAX(val, 1);
+
+	return true;
+}
+
 static bool
 parse_inject_token(const char *const token, struct inject_opts *const fopts,
 		   struct inject_personality_data *const pdata,
@@ -211,6 +230,12 @@ parse_inject_token(const char *const token, struct inject_opts *const fopts,
 				fopts->step = 1;
 			}
 		}
+	} else if ((val = STR_STRIP_PREFIX(token, "probability=")) != token) {
+		if (fopts->data.flags & INJECT_F_PROBABILITY)
+			return false;
+		if (!parse_probability_token(val, fopts))
+			return false;
+		fopts->data.flags |= INJECT_F_PROBABILITY;
 	} else if ((val = STR_STRIP_PREFIX(token, "syscall=")) != token) {
 		if (fopts->data.flags & INJECT_F_SYSCALL)
 			return false;
@@ -421,6 +446,14 @@ qualify_raw(const char *const str)
 	qualify_syscall_tokens(str, raw_set);
 }
 
+void
+qualify_entry_only(const char *const str)
+{
+	if (!entry_only_set)
+		entry_only_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(str, entry_only_set);
+}
+
 static void
 qualify_inject_common(const char *const str,
 		      const bool fault_tokens_only,
@@ -516,6 +549,17 @@ qualify_kvm(const char *const str)
 #else
 		error_msg("-e kvm=vcpu option is not implemented"
 			  " for this architecture");
+#endif
+	} else if (strcmp(str, "stats") == 0) {
+#ifdef HAVE_LINUX_KVM_H
+		if (os_release >= KERNEL_VERSION(4, 16, 0))
+			kvm_stats_init();
+		else
+			error_msg("-e kvm=stats option needs"
+				  " Linux 4.16.0 or higher");
+#else
+		error_msg("-e kvm=stats option is not implemented"
+			  " for this architecture");
 #endif
 	} else {
 		error_msg_and_die("invalid -e kvm= argument: '%s'", str);
@@ -534,6 +578,7 @@ static const struct qual_options {
 	{ "v",		qualify_verbose	},
 	{ "raw",	qualify_raw	},
 	{ "x",		qualify_raw	},
+	{ "entry-only",	qualify_entry_only },
 	{ "signal",	qualify_signals	},
 	{ "signals",	qualify_signals	},
 	{ "status",	qualify_status	},
@@ -587,5 +632,7 @@ qual_flags(const unsigned int scno)
 		| (is_number_in_set_array(scno, raw_set, current_personality)
 		   ? QUAL_RAW : 0)
 		| (is_number_in_set_array(scno, inject_set, current_personality)
-		   ? QUAL_INJECT : 0);
+		   ? QUAL_INJECT : 0)
+		| (is_number_in_set_array(scno, entry_only_set, current_personality)
+		   ? QUAL_ENTRY_ONLY : 0);
 }
@@ -0,0 +1,218 @@
+/*
+ * The tracing overhead governor.
+ *
+ * With --overhead-budget=PERCENT the share of the wall-clock time strace
+ * is busy handling the stops of its tracees, rather than waiting for them,
+ * is measured every second.  This is strace's own busy time: the time
+ * the tracees spend stopped, including the context switches to and from
+ * strace, is not accounted for.  While it exceeds the budget the tracing
+ * is degraded one step at a time: stack traces are suspended, then the
+ * decoding of file descriptors, then only one in GOVERNOR_SAMPLE_FACTOR
+ * syscalls is sampled, and finally all the tracees are detached.
+ * Sampling is skipped without --seccomp-bpf, as the tracees are stopped
+ * on both the entering and the exiting of every unsampled syscall anyway.
+ * When the overhead falls well below the budget for a while, the steps
+ * are undone in the reverse order, except for the detaching.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "filter_seccomp.h"
+#include "number_set.h"
+#include "string_to_uint.h"
+
+/* The length of the intervals the overhead is measured over.  */
+#define GOVERNOR_WINDOW_NS	1000000000ULL
+/* The sampling rate of the GOV_SAMPLING step.  */
+#define GOVERNOR_SAMPLE_FACTOR	10
+/* The number of calm intervals before a step up.  */
+#define GOVERNOR_CALM_MIN	3
+#define GOVERNOR_CALM_MAX	64
+
+enum governor_level {
+	GOV_FULL,
+	GOV_NO_STACK_TRACES,
+	GOV_NO_DECODE_FDS,
+	GOV_SAMPLING,
+	GOV_DETACHED,
+};
+
+static const char *const level_descs[] = {
+	[GOV_NO_STACK_TRACES]	= "stack traces",
+	[GOV_NO_DECODE_FDS]	= "decoding of file descriptors",
+	[GOV_SAMPLING]		= "tracing of every syscall",
+};
+
+/* The budget, in percents; 0 if the governor is disabled.  */
+unsigned int overhead_budget;
+
+static enum governor_level level = GOV_FULL;
+static struct number_set *saved_decode_fd_set;
+
+static uint64_t window_start_ns;
+static uint64_t idle_start_ns;
+static uint64_t idle_ns;
+static unsigned int calm_windows;
+static unsigned int calm_windows_needed = GOVERNOR_CALM_MIN;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool
+governor_set_budget(const char *const str)
+{
+	const int budget = string_to_uint_upto(str, 100);
+
+	if (budget <= 0)
+		return false;
+
+	overhead_budget = budget;
+	return true;
+}
+
+void
+governor_init(void)
+{
+	window_start_ns = now_ns();
+}
+
+/* Returns false if the step does not apply to the current options.  */
+static bool
+level_applies(const enum governor_level l)
+{
+	switch (l) {
+	case GOV_NO_STACK_TRACES:
+		return stack_trace_enabled;
+	case GOV_NO_DECODE_FDS:
+		return !number_set_array_is_empty(decode_fd_set, 0)
+		       || saved_decode_fd_set;
+	case GOV_SAMPLING:
+		/*
+		 * Without the seccomp filter the unsampled syscalls still
+		 * cost both ptrace stops, only their decoding is saved.
+		 */
+		if (!seccomp_filtering)
+			debug_msg("overhead governor: not sampling syscalls"
+				  " without --seccomp-bpf");
+		return seccomp_filtering;
+	default:
+		return true;
+	}
+}
+
+static void
+level_set(const enum governor_level l, const bool degraded)
+{
+	switch (l) {
+	case GOV_NO_STACK_TRACES:
+#ifdef ENABLE_STACKTRACE
+		stack_trace_suspended = degraded;
+#endif
+		break;
+	case GOV_NO_DECODE_FDS:
+		if (degraded) {
+			saved_decode_fd_set = decode_fd_set;
+			decode_fd_set = NULL;
+		} else {
+			decode_fd_set = saved_decode_fd_set;
+			saved_decode_fd_set = NULL;
+		}
+		break;
+	case GOV_SAMPLING:
+		sample_throttle(degraded ? GOVERNOR_SAMPLE_FACTOR : 1);
+		break;
+	case GOV_DETACHED:
+		detach_all();
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+step_down(const double overhead)
+{
+	do
+		++level;
+	while (level < GOV_DETACHED && !level_applies(level));
+
+	if (level == GOV_DETACHED)
+		error_msg("Tracing overhead %.1f%% exceeds the budget of %u%%"
+			  ", detaching", overhead, overhead_budget);
+	else if (level == GOV_SAMPLING)
+		error_msg("Tracing overhead %.1f%% exceeds the budget of %u%%"
+			  ", tracing only 1 in %u syscalls",
+			  overhead, overhead_budget, GOVERNOR_SAMPLE_FACTOR);
+	else
+		error_msg("Tracing overhead %.1f%% exceeds the budget of %u%%"
+			  ", disabling %s",
+			  overhead, overhead_budget, level_descs[level]);
+
+	level_set(level, true);
+}
+
+static void
+step_up(const double overhead)
+{
+	const enum governor_level l = level;
+
+	do
+		--level;
+	while (level > GOV_FULL && !level_applies(level));
+
+	error_msg("Tracing overhead %.1f%% is within the budget of %u%%"
+		  ", re-enabling %s", overhead, overhead_budget,
+		  level_descs[l]);
+
+	level_set(l, false);
+
+	/* Wait longer before the next step up if this one is undone.  */
+	calm_windows_needed = MIN(calm_windows_needed * 2, GOVERNOR_CALM_MAX);
+}
+
+void
+governor_idle_begin(void)
+{
+	idle_start_ns = now_ns();
+
+	const uint64_t elapsed = idle_start_ns - window_start_ns;
+
+	if (elapsed < GOVERNOR_WINDOW_NS || level == GOV_DETACHED)
+		return;
+
+	const double overhead =
+		100.0 * (elapsed - MIN(idle_ns, elapsed)) / elapsed;
+
+	window_start_ns = idle_start_ns;
+	idle_ns = 0;
+
+	debug_func_msg("overhead %.1f%%, level %u", overhead, level);
+
+	if (overhead > overhead_budget) {
+		calm_windows = 0;
+		step_down(overhead);
+	} else if (overhead < overhead_budget / 2.0 && level != GOV_FULL) {
+		if (++calm_windows >= calm_windows_needed) {
+			calm_windows = 0;
+			step_up(overhead);
+		}
+	} else {
+		calm_windows = 0;
+	}
+}
+
+void
+governor_idle_end(void)
+{
+	idle_ns += now_ns() - idle_start_ns;
+}
@@ -18,6 +18,18 @@
 #include "xlat/uring_enter_flags.h"
 #include "xlat/uring_register_opcodes.h"
 #include "xlat/uring_cqring_flags.h"
+#include "xlat/uring_sqe_flags.h"
+#include "xlat/uring_cqe_flags.h"
+
+#ifndef IORING_OFF_SQ_RING
+# define IORING_OFF_SQ_RING	0ULL
+#endif
+#ifndef IORING_OFF_CQ_RING
+# define IORING_OFF_CQ_RING	0x8000000ULL
+#endif
+#ifndef IORING_OFF_SQES
+# define IORING_OFF_SQES	0x10000000ULL
+#endif
 
 #ifdef HAVE_STRUCT_IO_URING_PARAMS
 # ifdef HAVE_STRUCT_IO_URING_PARAMS_RESV
@@ -102,6 +114,519 @@ SYS_FUNC(io_uring_setup)
 	return RVAL_DECODED | RVAL_FD;
 }
 
+/*
+ * The rings are tracked by thread group and file descriptor, so that
+ * the submission queue entries consumed and the completion queue entries
+ * posted by the kernel during io_uring_enter could be decoded from
+ * the memory shared with the tracee.
+ *
+ * With IORING_FEAT_SINGLE_MMAP, the SQ ring indices, the CQ ring indices,
+ * and the CQEs are parts of the same mapping at IORING_OFF_SQ_RING, and
+ * all the indices are read with a single read of the ring header.
+ * Otherwise the CQ ring is a separate object mapped at IORING_OFF_CQ_RING,
+ * and the CQEs are not decoded until it is mapped.
+ *
+ * A ring is forgotten when its descriptor is closed, and all the rings
+ * of a thread group are forgotten on execve and on exit of the group.
+ */
+
+/* Limit of the ring header read on every io_uring_enter.  */
+#define URING_HDR_SIZE_MAX	1024
+/* The number of the buckets of the rings table, a power of 2.  */
+#define URING_RINGS_HASH_SIZE	64U
+
+struct uring_inflight {
+	uint64_t user_data;
+	uint8_t opcode;
+	bool valid;
+};
+
+struct uring_ring {
+	struct uring_ring *next;
+	int tgid;
+	int fd;
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t features;
+	struct_io_sqring_offsets sq_off;
+	struct_io_cqring_offsets cq_off;
+	unsigned int sq_hdr_size;
+	unsigned int cq_hdr_size;
+	kernel_ulong_t sq_ring_addr;	/* 0: not mapped yet */
+	kernel_ulong_t cq_ring_addr;	/* 0: not mapped yet */
+	kernel_ulong_t sqes_addr;	/* 0: not mapped yet */
+	uint32_t sq_head;		/* The SQ head seen last time */
+	uint32_t cq_tail;		/* The CQ tail seen last time */
+	/* Opcodes of the requests in flight by user_data, for -c.  */
+	struct uring_inflight *inflight;
+};
+
+struct uring_events {
+	unsigned int nsqes;
+	unsigned int ncqes;
+	struct_io_uring_sqe *sqes;
+	struct_io_uring_cqe *cqes;
+};
+
+struct uring_op_counts {
+	uint64_t calls;
+	uint64_t errors;
+};
+
+static struct uring_ring *rings[URING_RINGS_HASH_SIZE];
+static unsigned int rings_count;
+static struct uring_op_counts *op_counts;
+
+static struct uring_ring **
+ring_bucket(const int tgid, const int fd)
+{
+	return &rings[((unsigned int) tgid * 31 + (unsigned int) fd)
+		      & (URING_RINGS_HASH_SIZE - 1)];
+}
+
+static struct uring_ring *
+find_ring(struct tcb *tcp, const int fd)
+{
+	if (!rings_count)
+		return NULL;
+
+	const int tgid = get_proc_tgid(tcp);
+
+	for (struct uring_ring *ring = *ring_bucket(tgid, fd); ring;
+	     ring = ring->next) {
+		if (ring->tgid == tgid && ring->fd == fd)
+			return ring;
+	}
+
+	return NULL;
+}
+
+static void
+free_ring(struct uring_ring **const link)
+{
+	struct uring_ring *const ring = *link;
+
+	*link = ring->next;
+	free(ring->inflight);
+	free(ring);
+	rings_count--;
+}
+
+static bool
+is_pow2(const uint32_t val)
+{
+	return val && !(val & (val - 1));
+}
+
+bool
+io_uring_has_rings(void)
+{
+	return rings_count;
+}
+
+bool
+io_uring_is_ring_fd(struct tcb *tcp, const int fd)
+{
+	return find_ring(tcp, fd);
+}
+
+void
+io_uring_close_notify(struct tcb *tcp, const unsigned int first,
+		      const unsigned int last)
+{
+	if (!rings_count)
+		return;
+
+	const int tgid = get_proc_tgid(tcp);
+
+	if (first == last) {
+		for (struct uring_ring **link = ring_bucket(tgid, first);
+		     *link; link = &(*link)->next) {
+			if ((*link)->tgid == tgid &&
+			    (unsigned int) (*link)->fd == first) {
+				free_ring(link);
+				return;
+			}
+		}
+		return;
+	}
+
+	for (unsigned int i = 0; i < URING_RINGS_HASH_SIZE; ++i) {
+		for (struct uring_ring **link = &rings[i]; *link; ) {
+			if ((*link)->tgid == tgid &&
+			    (unsigned int) (*link)->fd >= first &&
+			    (unsigned int) (*link)->fd <= last)
+				free_ring(link);
+			else
+				link = &(*link)->next;
+		}
+	}
+}
+
+void
+io_uring_drop_rings(const int tgid)
+{
+	for (unsigned int i = 0; rings_count && i < URING_RINGS_HASH_SIZE;
+	     ++i) {
+		for (struct uring_ring **link = &rings[i]; *link; ) {
+			if ((*link)->tgid == tgid)
+				free_ring(link);
+			else
+				link = &(*link)->next;
+		}
+	}
+}
+
+void
+io_uring_setup_notify(struct tcb *tcp)
+{
+	const int fd = tcp->u_rval;
+	struct_io_uring_params params;
+
+	if (syserror(tcp) || umove(tcp, tcp->u_arg[1], &params))
+		return;
+
+	const uint32_t offsets[] = {
+		params.sq_off.head, params.sq_off.ring_mask,
+		params.cq_off.tail, params.cq_off.ring_mask,
+	};
+	unsigned int hdr_sizes[2] = { 0, 0 };	/* SQ, CQ */
+
+	for (size_t i = 0; i < ARRAY_SIZE(offsets); ++i) {
+		if (offsets[i] % sizeof(uint32_t) ||
+		    offsets[i] >= URING_HDR_SIZE_MAX)
+			return;
+		hdr_sizes[i / 2] = MAX(hdr_sizes[i / 2],
+				       offsets[i] + sizeof(uint32_t));
+	}
+
+	if (!is_pow2(params.sq_entries) || !is_pow2(params.cq_entries) ||
+	    params.sq_off.array % sizeof(uint32_t) ||
+	    params.cq_off.cqes % sizeof(uint64_t))
+		return;
+
+	/* A ring left over by a descriptor closed behind our back.  */
+	io_uring_close_notify(tcp, fd, fd);
+
+	const int tgid = get_proc_tgid(tcp);
+	struct uring_ring **const bucket = ring_bucket(tgid, fd);
+	struct uring_ring *const ring = xmalloc(sizeof(*ring));
+
+	*ring = (struct uring_ring) {
+		.next = *bucket,
+		.tgid = tgid,
+		.fd = fd,
+		.sq_entries = params.sq_entries,
+		.cq_entries = params.cq_entries,
+		.features = params.features,
+		.sq_off = params.sq_off,
+		.cq_off = params.cq_off,
+		.sq_hdr_size = hdr_sizes[0],
+		.cq_hdr_size = hdr_sizes[1],
+	};
+	*bucket = ring;
+	rings_count++;
+
+	if (cflag)
+		ring->inflight = xcalloc(2 * ring->cq_entries,
+					 sizeof(*ring->inflight));
+}
+
+void
+io_uring_mmap_notify(struct tcb *tcp, const unsigned long long offset)
+{
+	if (syserror(tcp))
+		return;
+
+	struct uring_ring *ring = find_ring(tcp, tcp->u_arg[4]);
+
+	if (!ring)
+		return;
+
+	if (offset == IORING_OFF_SQ_RING) {
+		ring->sq_ring_addr = tcp->u_rval;
+		if (ring->features & IORING_FEAT_SINGLE_MMAP)
+			ring->cq_ring_addr = tcp->u_rval;
+	} else if (offset == IORING_OFF_CQ_RING) {
+		ring->cq_ring_addr = tcp->u_rval;
+	} else if (offset == IORING_OFF_SQES)
+		ring->sqes_addr = tcp->u_rval;
+}
+
+/* Reads COUNT ring entries of SIZE bytes starting at the position FIRST.  */
+static bool
+read_ring(struct tcb *tcp, const kernel_ulong_t addr, const uint32_t entries,
+	  const uint32_t first, const uint32_t count, const unsigned int size,
+	  void *buf)
+{
+	const uint32_t start = first & (entries - 1);
+	const uint32_t count1 = MIN(count, entries - start);
+
+	return !umoven(tcp, addr + start * size, count1 * size, buf) &&
+	       (count1 == count ||
+		!umoven(tcp, addr, (count - count1) * size,
+			(char *) buf + count1 * size));
+}
+
+/*
+ * The SQ array usually maps the positions to the same SQE indices,
+ * so all the SQEs are fetched with a single read of the index span.
+ */
+static unsigned int
+read_sqes(struct tcb *tcp, const struct uring_ring *ring,
+	  const uint32_t first, const uint32_t count,
+	  struct_io_uring_sqe *sqes)
+{
+	uint32_t *indices = xcalloc(count, sizeof(*indices));
+	unsigned int n = 0;
+
+	if (!read_ring(tcp, ring->sq_ring_addr + ring->sq_off.array,
+		       ring->sq_entries, first, count, sizeof(*indices),
+		       indices))
+		goto out;
+
+	uint32_t lo = -1U, hi = 0;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		if (indices[i] >= ring->sq_entries)
+			continue;
+		lo = MIN(lo, indices[i]);
+		hi = MAX(hi, indices[i]);
+	}
+	if (lo > hi)
+		goto out;
+
+	struct_io_uring_sqe *span = xcalloc(hi - lo + 1, sizeof(*span));
+
+	if (!umoven(tcp, ring->sqes_addr + lo * sizeof(*span),
+		    (hi - lo + 1) * sizeof(*span), span)) {
+		for (uint32_t i = 0; i < count; ++i) {
+			if (indices[i] < ring->sq_entries)
+				sqes[n++] = span[indices[i] - lo];
+		}
+	}
+	free(span);
+
+out:
+	free(indices);
+	return n;
+}
+
+static void
+count_uring_events(struct uring_ring *ring, const struct uring_events *ev)
+{
+	const uint32_t mask = 2 * ring->cq_entries - 1;
+
+	if (!op_counts)
+		op_counts = xcalloc(256, sizeof(*op_counts));
+
+	for (unsigned int i = 0; i < ev->nsqes; ++i) {
+		const struct_io_uring_sqe *sqe = &ev->sqes[i];
+
+		op_counts[sqe->opcode].calls++;
+		if (ring->inflight) {
+			ring->inflight[sqe->user_data & mask] =
+				(struct uring_inflight) {
+					.user_data = sqe->user_data,
+					.opcode = sqe->opcode,
+					.valid = true,
+				};
+		}
+	}
+
+	for (unsigned int i = 0; i < ev->ncqes && ring->inflight; ++i) {
+		const struct_io_uring_cqe *cqe = &ev->cqes[i];
+		struct uring_inflight *req =
+			&ring->inflight[cqe->user_data & mask];
+
+		if (!req->valid || req->user_data != cqe->user_data)
+			continue;
+		if (cqe->res < 0)
+			op_counts[req->opcode].errors++;
+		req->valid = false;
+	}
+}
+
+void
+io_uring_enter_notify(struct tcb *tcp)
+{
+	struct uring_ring *ring = find_ring(tcp, tcp->u_arg[0]);
+
+	if (!ring || !ring->sq_ring_addr)
+		return;
+
+	uint32_t sq_hdr[URING_HDR_SIZE_MAX / sizeof(uint32_t)];
+	uint32_t cq_hdr_buf[URING_HDR_SIZE_MAX / sizeof(uint32_t)];
+	const uint32_t *cq_hdr = NULL;
+	const bool single_mmap = ring->cq_ring_addr == ring->sq_ring_addr;
+
+	if (umoven(tcp, ring->sq_ring_addr,
+		   single_mmap ? MAX(ring->sq_hdr_size, ring->cq_hdr_size)
+			       : ring->sq_hdr_size, sq_hdr))
+		return;
+
+	if (single_mmap)
+		cq_hdr = sq_hdr;
+	else if (ring->cq_ring_addr &&
+		 !umoven(tcp, ring->cq_ring_addr, ring->cq_hdr_size,
+			 cq_hdr_buf))
+		cq_hdr = cq_hdr_buf;
+
+#define HDR_FIELD(hdr_, off_) (hdr_)[(off_) / sizeof(uint32_t)]
+	/* The mappings may have been replaced by something else.  */
+	if (HDR_FIELD(sq_hdr, ring->sq_off.ring_mask) != ring->sq_entries - 1)
+		return;
+	if (cq_hdr &&
+	    HDR_FIELD(cq_hdr, ring->cq_off.ring_mask) != ring->cq_entries - 1)
+		cq_hdr = NULL;
+
+	const uint32_t sq_head = HDR_FIELD(sq_hdr, ring->sq_off.head);
+	const uint32_t cq_tail =
+		cq_hdr ? HDR_FIELD(cq_hdr, ring->cq_off.tail) : ring->cq_tail;
+#undef HDR_FIELD
+
+	uint32_t nsqes = MIN(sq_head - ring->sq_head, ring->sq_entries);
+	const uint32_t ncqes = MIN(cq_tail - ring->cq_tail, ring->cq_entries);
+
+	ring->sq_head = sq_head;
+	ring->cq_tail = cq_tail;
+
+	if (!ring->sqes_addr)
+		nsqes = 0;
+	if (!nsqes && !ncqes)
+		return;
+
+	struct uring_events *ev = tcb_alloc(tcp, sizeof(*ev) +
+					    nsqes * sizeof(ev->sqes[0]) +
+					    ncqes * sizeof(ev->cqes[0]));
+	ev->sqes = (void *) (ev + 1);
+	ev->cqes = (void *) (ev->sqes + nsqes);
+
+	ev->nsqes = nsqes ? read_sqes(tcp, ring, sq_head - nsqes, nsqes,
+				      ev->sqes) : 0;
+	ev->ncqes = ncqes &&
+		    read_ring(tcp, ring->cq_ring_addr + ring->cq_off.cqes,
+			      ring->cq_entries, cq_tail - ncqes, ncqes,
+			      sizeof(ev->cqes[0]), ev->cqes) ? ncqes : 0;
+
+	if (cflag)
+		count_uring_events(ring, ev);
+
+	if (cflag != CFLAG_ONLY_STATS && (ev->nsqes || ev->ncqes))
+		set_tcb_priv_data(tcp, ev, NULL);
+}
+
+static bool
+print_io_uring_sqe(struct tcb *tcp, void *elem_buf, size_t elem_size,
+		   void *data)
+{
+	const struct_io_uring_sqe *sqe = elem_buf;
+
+	PRINT_FIELD_XVAL_U("{", *sqe, opcode, uring_ops, "IORING_OP_???");
+	PRINT_FIELD_FLAGS(", ", *sqe, flags, uring_sqe_flags, "IOSQE_???");
+	if (sqe->ioprio)
+		PRINT_FIELD_X(", ", *sqe, ioprio);
+	if (sqe->flags & IOSQE_FIXED_FILE)
+		PRINT_FIELD_D(", ", *sqe, fd);
+	else
+		PRINT_FIELD_FD(", ", *sqe, fd, tcp);
+	PRINT_FIELD_U(", ", *sqe, off);
+	PRINT_FIELD_ADDR64(", ", *sqe, addr);
+	PRINT_FIELD_U(", ", *sqe, len);
+	if (sqe->op_flags)
+		PRINT_FIELD_X(", ", *sqe, op_flags);
+	PRINT_FIELD_X(", ", *sqe, user_data);
+	if (sqe->buf_index)
+		PRINT_FIELD_U(", ", *sqe, buf_index);
+	if (sqe->personality)
+		PRINT_FIELD_U(", ", *sqe, personality);
+	tprints("}");
+
+	return true;
+}
+
+static bool
+print_io_uring_cqe(struct tcb *tcp, void *elem_buf, size_t elem_size,
+		   void *data)
+{
+	const struct_io_uring_cqe *cqe = elem_buf;
+
+	PRINT_FIELD_X("{", *cqe, user_data);
+	PRINT_FIELD_ERR_D(", ", *cqe, res);
+	PRINT_FIELD_FLAGS(", ", *cqe, flags, uring_cqe_flags,
+			  "IORING_CQE_F_???");
+	tprints("}");
+
+	return true;
+}
+
+static void
+print_uring_events(struct tcb *tcp, const struct uring_events *ev)
+{
+	tprints(" => {sqes=");
+	print_local_array_ex(tcp, ev->sqes, ev->nsqes, sizeof(ev->sqes[0]),
+			     print_io_uring_sqe, NULL, 0, NULL, NULL);
+	tprints(", cqes=");
+	print_local_array_ex(tcp, ev->cqes, ev->ncqes, sizeof(ev->cqes[0]),
+			     print_io_uring_cqe, NULL, 0, NULL, NULL);
+	tprints("}");
+}
+
+static int
+op_counts_cmp(const void *a, const void *b)
+{
+	const unsigned int op_a = *(const unsigned int *) a;
+	const unsigned int op_b = *(const unsigned int *) b;
+	const uint64_t ca = op_counts[op_a].calls;
+	const uint64_t cb = op_counts[op_b].calls;
+
+	return ca != cb ? (ca < cb) - (ca > cb) : (op_a > op_b) - (op_a < op_b);
+}
+
+void
+io_uring_summary(FILE *outf)
+{
+	if (!op_counts)
+		return;
+
+	static const char dashes[] = "----------------------------------------";
+	unsigned int ops[256];
+	unsigned int nops = 0;
+	uint64_t calls = 0, errors = 0;
+	int width = sizeof("io_uring op") - 1;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(ops); ++i) {
+		if (!op_counts[i].calls)
+			continue;
+
+		const char *name = xlookup(uring_ops, i);
+
+		ops[nops++] = i;
+		calls += op_counts[i].calls;
+		errors += op_counts[i].errors;
+		width = MAX(width, (int) strlen(name ? name : "IORING_OP_???"));
+		width = MIN(width, (int) sizeof(dashes) - 1);
+	}
+	if (!nops)
+		return;
+
+	qsort(ops, nops, sizeof(ops[0]), op_counts_cmp);
+
+	fprintf(outf, "\n%-*s %9s %9s\n", width, "io_uring op", "calls",
+		"errors");
+	fprintf(outf, "%.*s %.9s %.9s\n", width, dashes, dashes, dashes);
+	for (unsigned int i = 0; i < nops; ++i) {
+		const char *name = xlookup(uring_ops, ops[i]);
+
+		fprintf(outf, "%-*s %9" PRIu64 " %9" PRIu64 "\n", width,
+			name ? name : "IORING_OP_???",
+			op_counts[ops[i]].calls, op_counts[ops[i]].errors);
+	}
+	fprintf(outf, "%.*s %.9s %.9s\n", width, dashes, dashes, dashes);
+	fprintf(outf, "%-*s %9" PRIu64 " %9" PRIu64 "\n", width, "total",
+		calls, errors);
+}
+
 SYS_FUNC(io_uring_enter)
 {
 	const int fd = tcp->u_arg[0];
@@ -111,6 +636,14 @@ SYS_FUNC(io_uring_enter)
 	const kernel_ulong_t sigset_addr = tcp->u_arg[4];
 	const kernel_ulong_t sigset_size = tcp->u_arg[5];
 
+	if (exiting(tcp)) {
+		const struct uring_events *ev = get_tcb_priv_data(tcp);
+
+		if (ev)
+			print_uring_events(tcp, ev);
+		return 0;
+	}
+
 	printfd(tcp, fd);
 	tprintf(", %u, %u, ", to_submit, min_complete);
 	printflags(uring_enter_flags, flags, "IORING_ENTER_???");
@@ -118,7 +651,7 @@ SYS_FUNC(io_uring_enter)
 	print_sigset_addr_len(tcp, sigset_addr, sigset_size);
 	tprintf(", %" PRI_klu, sigset_size);
 
-	return RVAL_DECODED;
+	return 0;
 }
 
 static bool
@@ -25,9 +25,52 @@ struct vcpu_info {
 	long mmap_addr;
 	unsigned long mmap_len;
 	bool resolved;
+	struct vcpu_stats *stats;
+};
+
+/*
+ * Latencies are counted in a histogram of nanoseconds with 4 buckets
+ * per power of 2, the values below 4 have buckets of their own.
+ */
+# define LATENCY_SUB_BITS	2
+# define LATENCY_BUCKETS	(64 << LATENCY_SUB_BITS)
+
+struct latency_stats {
+	uint64_t count;
+	uint64_t total_ns;
+	uint32_t hist[LATENCY_BUCKETS];
+};
+
+struct exit_stats {
+	/* KVM_RUN calls ended by the exit */
+	struct latency_stats guest;
+	/* Time from the exit to the next KVM_RUN call on the vcpu */
+	struct latency_stats exit;
+};
+
+/* Exit reasons that are not below this are counted together.  */
+# define EXIT_REASONS_MAX	256
+
+/* The statistics of a vcpu, they outlive the vcpu_info of the thread.  */
+struct vcpu_stats {
+	struct vcpu_stats *next;
+	int tgid;
+	int cpuid;
+	struct exit_stats *exits[EXIT_REASONS_MAX];
+
+	struct timespec run_start;	/* When KVM_RUN was called */
+	struct timespec exit_time;	/* When the last KVM_RUN returned */
+	unsigned int last_exit;		/* The exit reason it returned */
+	bool running;
+	bool exited;
 };
 
 static bool dump_kvm_run_structure;
+bool kvm_stats_enabled;
+static struct vcpu_stats *vcpu_stats_list;
+static unsigned int vcpu_stats_count;
+static struct timespec stats_interval;
+static struct timespec stats_next_report;
 
 static struct vcpu_info *
 vcpu_find(struct tcb *const tcp, int fd)
@@ -414,4 +457,312 @@ kvm_run_structure_decoder_init(void)
 	mmap_cache_enable();
 }
 
+void
+kvm_stats_init(void)
+{
+	kvm_stats_enabled = true;
+	mmap_cache_enable();
+}
+
+bool
+kvm_stats_set_interval(const char *const str)
+{
+	if (parse_ts(str, &stats_interval) || !ts_nz(&stats_interval))
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &stats_next_report);
+	ts_add(&stats_next_report, &stats_next_report, &stats_interval);
+	kvm_stats_init();
+
+	return true;
+}
+
+static unsigned int
+latency_bucket(const uint64_t ns)
+{
+	if (ns < (1U << LATENCY_SUB_BITS))
+		return ns;
+
+	const unsigned int log = ilog2_64(ns);
+
+	return ((log - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) |
+	       ((ns >> (log - LATENCY_SUB_BITS)) &
+		((1U << LATENCY_SUB_BITS) - 1));
+}
+
+/* The largest value counted in the bucket.  */
+static uint64_t
+latency_bucket_max(const unsigned int bucket)
+{
+	if (bucket < (1U << LATENCY_SUB_BITS))
+		return bucket;
+
+	const unsigned int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+	const uint64_t mantissa = (1U << LATENCY_SUB_BITS) |
+		(bucket & ((1U << LATENCY_SUB_BITS) - 1));
+
+	return ((mantissa + 1) << shift) - 1;
+}
+
+static void
+latency_add(struct latency_stats *const ls, const struct timespec *const from,
+	    const struct timespec *const to)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, to, from);
+	if (dt.tv_sec < 0)
+		return;
+
+	const uint64_t ns = dt.tv_sec * 1000000000ULL + dt.tv_nsec;
+
+	ls->count++;
+	ls->total_ns += ns;
+	ls->hist[latency_bucket(ns)]++;
+}
+
+/* The percentile of the latencies in microseconds, rounded up to a bucket. */
+static double
+latency_percentile(const struct latency_stats *const ls,
+		   const unsigned int percent)
+{
+	const uint64_t rank = (ls->count * percent + 99) / 100;
+	uint64_t seen = 0;
+
+	for (unsigned int i = 0; i < LATENCY_BUCKETS; ++i) {
+		seen += ls->hist[i];
+		if (seen && seen >= rank)
+			return latency_bucket_max(i) / 1e3;
+	}
+
+	return 0;
+}
+
+static struct vcpu_stats *
+vcpu_stats_get(struct tcb *const tcp, struct vcpu_info *const info)
+{
+	const int tgid = get_proc_tgid(tcp) ?: tcp->pid;
+
+	if (info->stats && info->stats->tgid == tgid &&
+	    info->stats->cpuid == info->cpuid)
+		return info->stats;
+
+	struct vcpu_stats *stats;
+
+	for (stats = vcpu_stats_list; stats; stats = stats->next) {
+		if (stats->tgid == tgid && stats->cpuid == info->cpuid)
+			break;
+	}
+
+	if (!stats) {
+		stats = xzalloc(sizeof(*stats));
+		stats->tgid = tgid;
+		stats->cpuid = info->cpuid;
+		stats->next = vcpu_stats_list;
+		vcpu_stats_list = stats;
+		vcpu_stats_count++;
+	}
+
+	return info->stats = stats;
+}
+
+static struct exit_stats *
+exit_stats_get(struct vcpu_stats *const stats, const unsigned int reason)
+{
+	const unsigned int i = MIN(reason, EXIT_REASONS_MAX - 1);
+
+	if (!stats->exits[i])
+		stats->exits[i] = xzalloc(sizeof(*stats->exits[i]));
+
+	return stats->exits[i];
+}
+
+void
+kvm_run_enter_notify(struct tcb *const tcp)
+{
+	if ((unsigned int) tcp->u_arg[1] != KVM_RUN)
+		return;
+
+	struct vcpu_info *const info = vcpu_get_info(tcp, tcp->u_arg[0]);
+
+	if (!info)
+		return;
+
+	struct vcpu_stats *const stats = vcpu_stats_get(tcp, info);
+
+	clock_gettime(CLOCK_MONOTONIC, &stats->run_start);
+	stats->running = true;
+
+	if (stats->exited) {
+		latency_add(&exit_stats_get(stats, stats->last_exit)->exit,
+			    &stats->exit_time, &stats->run_start);
+		stats->exited = false;
+	}
+}
+
+void
+kvm_run_exit_notify(struct tcb *const tcp)
+{
+	if ((unsigned int) tcp->u_arg[1] != KVM_RUN)
+		return;
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	struct vcpu_info *const info = vcpu_get_info(tcp, tcp->u_arg[0]);
+
+	if (!info)
+		return;
+
+	struct vcpu_stats *const stats = vcpu_stats_get(tcp, info);
+
+	if (!stats->running)
+		return;
+
+	stats->running = false;
+
+	/* KVM_RUN interrupted by a signal reports KVM_EXIT_INTR.  */
+	if (syserror(tcp) && tcp->u_error != EINTR)
+		return;
+
+	uint32_t reason;
+
+	if (info->mmap_len < offsetofend(struct kvm_run, exit_reason) ||
+	    umove(tcp, info->mmap_addr + offsetof(struct kvm_run, exit_reason),
+		  &reason) < 0)
+		return;
+
+	latency_add(&exit_stats_get(stats, reason)->guest,
+		    &stats->run_start, &now);
+	stats->exit_time = now;
+	stats->last_exit = reason;
+	stats->exited = true;
+}
+
+static int
+vcpu_stats_cmp(const void *a, const void *b)
+{
+	const struct vcpu_stats *const sa = *(const struct vcpu_stats **) a;
+	const struct vcpu_stats *const sb = *(const struct vcpu_stats **) b;
+
+	if (sa->tgid != sb->tgid)
+		return sa->tgid < sb->tgid ? -1 : 1;
+	return (sa->cpuid > sb->cpuid) - (sa->cpuid < sb->cpuid);
+}
+
+static double
+latency_avg(const struct latency_stats *const ls)
+{
+	return ls->count ? ls->total_ns / 1e3 / ls->count : 0;
+}
+
+static void
+print_latency_row(FILE *const outf, const int width, const char *const name,
+		  const struct latency_stats *const guest,
+		  const struct latency_stats *const exit)
+{
+	fprintf(outf, "%-*s %9" PRIu64 " %11.6f %11.1f %9.1f %9.1f"
+		" %11.6f %11.1f %9.1f %9.1f\n", width, name,
+		guest->count, guest->total_ns / 1e9, latency_avg(guest),
+		latency_percentile(guest, 50), latency_percentile(guest, 99),
+		exit->total_ns / 1e9, latency_avg(exit),
+		latency_percentile(exit, 50), latency_percentile(exit, 99));
+}
+
+static void
+print_dashes_row(FILE *const outf, const int width)
+{
+	static const char dashes[] = "----------------------------------------";
+
+	fprintf(outf, "%.*s %.9s %.11s %.11s %.9s %.9s %.11s %.11s %.9s %.9s\n",
+		width, dashes, dashes, dashes, dashes, dashes, dashes,
+		dashes, dashes, dashes, dashes);
+}
+
+static void
+vcpu_stats_summary(FILE *const outf, const struct vcpu_stats *const stats)
+{
+	struct latency_stats total_guest = { 0 }, total_exit = { 0 };
+	int width = sizeof("exit reason") - 1;
+
+	for (unsigned int i = 0; i < EXIT_REASONS_MAX; ++i) {
+		if (!stats->exits[i])
+			continue;
+
+		const char *name = xlookup(kvm_exit_reason, i);
+
+		width = MAX(width, (int) strlen(name ? name : "KVM_EXIT_???"));
+	}
+
+	fprintf(outf, "\nvcpu %d of pid %d:\n", stats->cpuid, stats->tgid);
+	fprintf(outf, "%-*s %9s %11s %11s %9s %9s %11s %11s %9s %9s\n",
+		width, "exit reason", "exits", "guest secs", "usecs/run",
+		"p50 us", "p99 us", "exit secs", "usecs/exit",
+		"p50 us", "p99 us");
+	print_dashes_row(outf, width);
+
+	for (unsigned int i = 0; i < EXIT_REASONS_MAX; ++i) {
+		const struct exit_stats *const es = stats->exits[i];
+
+		if (!es)
+			continue;
+
+		const char *name = xlookup(kvm_exit_reason, i);
+
+		print_latency_row(outf, width, name ? name : "KVM_EXIT_???",
+				  &es->guest, &es->exit);
+
+		total_guest.count += es->guest.count;
+		total_guest.total_ns += es->guest.total_ns;
+		total_exit.count += es->exit.count;
+		total_exit.total_ns += es->exit.total_ns;
+		for (unsigned int j = 0; j < LATENCY_BUCKETS; ++j) {
+			total_guest.hist[j] += es->guest.hist[j];
+			total_exit.hist[j] += es->exit.hist[j];
+		}
+	}
+
+	print_dashes_row(outf, width);
+	print_latency_row(outf, width, "total", &total_guest, &total_exit);
+}
+
+void
+kvm_stats_summary(FILE *const outf)
+{
+	if (!vcpu_stats_count)
+		return;
+
+	struct vcpu_stats **sorted = xcalloc(vcpu_stats_count,
+					     sizeof(*sorted));
+	unsigned int n = 0;
+
+	for (struct vcpu_stats *stats = vcpu_stats_list; stats;
+	     stats = stats->next)
+		sorted[n++] = stats;
+	qsort(sorted, n, sizeof(*sorted), vcpu_stats_cmp);
+
+	for (unsigned int i = 0; i < n; ++i)
+		vcpu_stats_summary(outf, sorted[i]);
+
+	free(sorted);
+}
+
+bool
+kvm_stats_report_due(void)
+{
+	if (!ts_nz(&stats_interval))
+		return false;
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_cmp(&now, &stats_next_report) < 0)
+		return false;
+
+	ts_add(&stats_next_report, &now, &stats_interval);
+
+	return true;
+}
+
 #endif /* HAVE_LINUX_KVM_H */
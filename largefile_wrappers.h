@@ -32,6 +32,7 @@
 #  define fstat_fd fstat64
 #  define strace_stat_t struct stat64
 #  define stat_file stat64
+#  define stat_file_at fstatat64
 #  define struct_dirent struct dirent64
 #  define read_dir readdir64
 #  define struct_rlimit struct rlimit64
@@ -43,6 +44,7 @@
 #  define fstat_fd fstat
 #  define strace_stat_t struct stat
 #  define stat_file stat
+#  define stat_file_at fstatat
 #  define struct_dirent struct dirent
 #  define read_dir readdir
 #  define struct_rlimit struct rlimit
@@ -62,10 +62,10 @@ print_user_desc(struct tcb *const tcp, const kernel_ulong_t addr,
 		 * later.
 		 */
 		if (filter == USER_DESC_ENTERING) {
-			entry_number = xmalloc(sizeof(*entry_number));
+			entry_number = tcb_alloc(tcp, sizeof(*entry_number));
 
 			*entry_number = desc.entry_number;
-			set_tcb_priv_data(tcp, entry_number, free);
+			set_tcb_priv_data(tcp, entry_number, NULL);
 		}
 	}
 
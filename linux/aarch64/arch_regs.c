@@ -44,6 +44,10 @@ static struct iovec aarch64_io = {
 	((aarch64_io.iov_len == sizeof(arm_regs)) ? arm_regs.ARM_pc : aarch64_regs.pc)
 #define ARCH_SP_REG \
 	((aarch64_io.iov_len == sizeof(arm_regs)) ? arm_regs.ARM_sp : aarch64_regs.sp)
+#define ARCH_FP_REG \
+	((aarch64_io.iov_len == sizeof(arm_regs)) ? arm_regs.ARM_fp : aarch64_regs.regs[29])
+#define ARCH_LR_REG \
+	((aarch64_io.iov_len == sizeof(arm_regs)) ? arm_regs.ARM_lr : aarch64_regs.regs[30])
 
 #define ARCH_PERSONALITY_0_IOV_SIZE sizeof(aarch64_regs)
 #define ARCH_PERSONALITY_1_IOV_SIZE sizeof(arm_regs)
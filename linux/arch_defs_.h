@@ -11,6 +11,10 @@
 # define HAVE_ARCH_GETRVAL2 0
 #endif
 
+#ifndef HAVE_ARCH_FRAME_POINTER
+# define HAVE_ARCH_FRAME_POINTER 0
+#endif
+
 #ifndef HAVE_ARCH_OLD_MMAP
 # define HAVE_ARCH_OLD_MMAP 0
 #endif
@@ -6,6 +6,7 @@
  */
 
 #define ARCH_MX32_SIZEOF_STRUCT_MSQID64_DS 120
+#define HAVE_ARCH_FRAME_POINTER 1
 #define HAVE_ARCH_OLD_MMAP 1
 #define HAVE_ARCH_OLD_SELECT 1
 #define HAVE_ARCH_UID16_SYSCALLS 1
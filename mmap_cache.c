@@ -6,183 +6,728 @@
  */
 
 #include "defs.h"
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/mman.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "largefile_wrappers.h"
 #include "mmap_cache.h"
 #include "mmap_notify.h"
+#include "procfs.h"
+#include "proc_maps.h"
+#include "syscall.h"
 #include "xstring.h"
 
-static unsigned int mmap_cache_generation;
+#ifndef MREMAP_DONTUNMAP
+# define MREMAP_DONTUNMAP 4
+#endif
+
+/* All allocated caches, one per thread group.  */
+static struct mmap_cache_t *caches;
+
+/*
+ * Generations are unique among all caches, so a generation identifies
+ * the state of the address space it was taken from.
+ */
+static unsigned int last_generation;
+
+/*
+ * Binary filenames are interned: all caches share a single reference
+ * counted copy of each name, so entries can be copied and compared cheaply.
+ */
+struct interned_name {
+	struct interned_name *next;
+	unsigned int refcount;
+	unsigned int hash;
+	char str[];
+};
+
+static struct interned_name **names;
+static size_t names_size;
+static size_t names_count;
+
+static unsigned int
+hash_name(const char *str)
+{
+	/* FNV-1a */
+	unsigned int hash = 2166136261U;
+
+	for (; *str; ++str)
+		hash = (hash ^ (unsigned char) *str) * 16777619U;
+	return hash;
+}
 
 static void
-mmap_cache_invalidate(struct tcb *tcp, void *unused)
+grow_names(void)
 {
-	mmap_cache_generation++;
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0);
+	const size_t new_size = names_size ? names_size * 2 : 256;
+	struct interned_name **new_names = xcalloc(new_size, sizeof(*names));
+
+	for (size_t i = 0; i < names_size; ++i) {
+		struct interned_name *name, *next;
+
+		for (name = names[i]; name; name = next) {
+			next = name->next;
+			name->next = new_names[name->hash & (new_size - 1)];
+			new_names[name->hash & (new_size - 1)] = name;
+		}
+	}
+
+	free(names);
+	names = new_names;
+	names_size = new_size;
 }
 
-void
-mmap_cache_enable(void)
+static const char *
+intern_name(const char *str)
 {
-	static bool use_mmap_cache;
+	const unsigned int hash = hash_name(str);
+	struct interned_name *name;
+
+	if (names_size) {
+		for (name = names[hash & (names_size - 1)]; name;
+		     name = name->next) {
+			if (name->hash == hash && !strcmp(name->str, str)) {
+				name->refcount++;
+				return name->str;
+			}
+		}
+	}
 
-	if (!use_mmap_cache) {
-		mmap_notify_register_client(mmap_cache_invalidate, NULL);
-		use_mmap_cache = true;
+	if (names_count >= names_size)
+		grow_names();
+
+	const size_t len = strlen(str) + 1;
+	name = xmalloc(sizeof(*name) + len);
+	name->refcount = 1;
+	name->hash = hash;
+	memcpy(name->str, str, len);
+	name->next = names[hash & (names_size - 1)];
+	names[hash & (names_size - 1)] = name;
+	names_count++;
+
+	return name->str;
+}
+
+static struct interned_name *
+get_interned_name(const char *str)
+{
+	return (struct interned_name *)
+		(str - offsetof(struct interned_name, str));
+}
+
+static const char *
+ref_name(const char *str)
+{
+	get_interned_name(str)->refcount++;
+	return str;
+}
+
+static void
+unref_name(const char *str)
+{
+	struct interned_name *name = get_interned_name(str);
+
+	if (--name->refcount)
+		return;
+
+	struct interned_name **p;
+	for (p = &names[name->hash & (names_size - 1)]; *p != name;
+	     p = &(*p)->next)
+		;
+	*p = name->next;
+	names_count--;
+	free(name);
+}
+
+static void
+free_entries(struct mmap_cache_t *cache)
+{
+	while (cache->size) {
+		unsigned int i = --cache->size;
+		unref_name(cache->entry[i].binary_filename);
+		cache->entry[i].binary_filename = NULL;
 	}
 }
 
-/* deleting the cache */
+/* Drops the reference of tcp, the cache is freed with the last one.  */
 static void
 delete_mmap_cache(struct tcb *tcp, const char *caller)
 {
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
+	debug_func_msg("tgen=%u, tcp=%p, cache=%p, caller=%s",
 		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0, caller);
+		       tcp, tcp->mmap_cache ? tcp->mmap_cache->entry : 0,
+		       caller);
 
-	if (!tcp->mmap_cache)
+	struct mmap_cache_t *cache = tcp->mmap_cache;
+
+	if (!cache)
 		return;
 
-	while (tcp->mmap_cache->size) {
-		unsigned int i = --tcp->mmap_cache->size;
-		free(tcp->mmap_cache->entry[i].binary_filename);
-		tcp->mmap_cache->entry[i].binary_filename = NULL;
+	tcp->mmap_cache = NULL;
+	if (--cache->refcount)
+		return;
+
+	free_entries(cache);
+	free(cache->entry);
+	cache->entry = NULL;
+
+	if (cache->prev)
+		cache->prev->next = cache->next;
+	else
+		caches = cache->next;
+	if (cache->next)
+		cache->next->prev = cache->prev;
+
+	free(cache);
+}
+
+/* Attaches tcp to the cache of its thread group, creating it if needed.  */
+static struct mmap_cache_t *
+get_mmap_cache(struct tcb *tcp)
+{
+	if (tcp->mmap_cache)
+		return tcp->mmap_cache;
+
+	const int tgid = get_proc_tgid(tcp);
+	struct mmap_cache_t *cache;
+
+	for (cache = caches; cache; cache = cache->next) {
+		if (cache->tgid == tgid)
+			break;
 	}
 
-	free(tcp->mmap_cache->entry);
-	tcp->mmap_cache->entry = NULL;
+	if (!cache) {
+		cache = xzalloc(sizeof(*cache));
+		cache->free_fn = delete_mmap_cache;
+		cache->tgid = tgid;
+		cache->stale = true;
 
-	free(tcp->mmap_cache);
-	tcp->mmap_cache = NULL;
+		cache->next = caches;
+		if (caches)
+			caches->prev = cache;
+		caches = cache;
+	}
+
+	cache->refcount++;
+	tcp->mmap_cache_generation = 0;
+
+	return tcp->mmap_cache = cache;
 }
 
-/*
- * caching of /proc/ID/maps for each process to speed up stack tracing
- *
- * The cache must be refreshed after syscalls that affect memory mappings,
- * e.g. mmap, mprotect, munmap, execve.
- */
-extern enum mmap_cache_rebuild_result
-mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
+static unsigned long
+page_align(unsigned long len)
 {
-	if (tcp->mmap_cache
-	    && tcp->mmap_cache->generation != mmap_cache_generation)
-		delete_mmap_cache(tcp, caller);
+	const unsigned long mask = get_pagesize() - 1;
 
-	if (tcp->mmap_cache)
-		return MMAP_CACHE_REBUILD_READY;
+	return (len + mask) & ~mask;
+}
+
+static unsigned long
+get_rval_addr(struct tcb *tcp)
+{
+	return truncate_kulong_to_current_wordsize((kernel_ulong_t) tcp->u_rval);
+}
+
+static unsigned char
+prot_to_protections(kernel_ulong_t prot)
+{
+	return 0
+		| ((prot & PROT_READ)  ? MMAP_CACHE_PROT_READABLE   : 0)
+		| ((prot & PROT_WRITE) ? MMAP_CACHE_PROT_WRITABLE   : 0)
+		| ((prot & PROT_EXEC)  ? MMAP_CACHE_PROT_EXECUTABLE : 0);
+}
+
+/* Returns the index of the first entry that ends after addr.  */
+static unsigned int
+find_index(const struct mmap_cache_t *cache, unsigned long addr)
+{
+	unsigned int lower = 0;
+	unsigned int upper = cache->size;
+
+	while (lower < upper) {
+		unsigned int mid = (lower + upper) / 2;
+
+		if (cache->entry[mid].end_addr > addr)
+			upper = mid;
+		else
+			lower = mid + 1;
+	}
+	return lower;
+}
+
+/* Inserts the entry at the given index, takes ownership of its filename.  */
+static void
+insert_entry(struct mmap_cache_t *cache, unsigned int idx,
+	     const struct mmap_cache_entry_t *entry)
+{
+	if (cache->size >= cache->allocated)
+		cache->entry = xgrowarray(cache->entry, &cache->allocated,
+					  sizeof(*cache->entry));
+
+	memmove(cache->entry + idx + 1, cache->entry + idx,
+		(cache->size - idx) * sizeof(*cache->entry));
+	cache->entry[idx] = *entry;
+	cache->size++;
+}
+
+/* Makes sure that no entry crosses addr.  */
+static void
+split_at(struct mmap_cache_t *cache, unsigned long addr)
+{
+	unsigned int idx = find_index(cache, addr);
+
+	if (idx >= cache->size || cache->entry[idx].start_addr >= addr)
+		return;
+
+	struct mmap_cache_entry_t tail = cache->entry[idx];
+	tail.mmap_offset += addr - tail.start_addr;
+	tail.start_addr = addr;
+	ref_name(tail.binary_filename);
+	cache->entry[idx].end_addr = addr;
+	insert_entry(cache, idx + 1, &tail);
+}
+
+static void
+remove_range(struct mmap_cache_t *cache, unsigned long start, unsigned long end)
+{
+	if (start >= end)
+		return;
+
+	split_at(cache, start);
+	split_at(cache, end);
+
+	unsigned int first = find_index(cache, start);
+	unsigned int last = first;
+
+	for (; last < cache->size && cache->entry[last].end_addr <= end; ++last)
+		unref_name(cache->entry[last].binary_filename);
+
+	memmove(cache->entry + first, cache->entry + last,
+		(cache->size - last) * sizeof(*cache->entry));
+	cache->size -= last - first;
+}
+
+static void
+protect_range(struct mmap_cache_t *cache, unsigned long start,
+	      unsigned long end, unsigned char protections)
+{
+	split_at(cache, start);
+	split_at(cache, end);
+
+	for (unsigned int i = find_index(cache, start);
+	     i < cache->size && cache->entry[i].start_addr < end; ++i) {
+		struct mmap_cache_entry_t *entry = &cache->entry[i];
+
+		entry->protections = protections |
+			(entry->protections & MMAP_CACHE_PROT_SHARED);
+	}
+}
+
+static bool
+update_by_mremap(struct mmap_cache_t *cache, struct tcb *tcp)
+{
+	const unsigned long old_addr = tcp->u_arg[0];
+	const unsigned long old_len = page_align(tcp->u_arg[1]);
+	const unsigned long new_len = page_align(tcp->u_arg[2]);
+	const unsigned long new_addr = get_rval_addr(tcp);
+
+	/* Duplication of a shared mapping.  */
+	if (!old_len)
+		return false;
+
+	if (new_addr == old_addr) {
+		if (new_len < old_len) {
+			remove_range(cache, old_addr + new_len,
+				     old_addr + old_len);
+		} else if (new_len > old_len) {
+			const unsigned long old_end = old_addr + old_len;
+			unsigned int idx = find_index(cache, old_end - 1);
+
+			if (idx < cache->size &&
+			    cache->entry[idx].start_addr < old_end &&
+			    cache->entry[idx].end_addr == old_end) {
+				remove_range(cache, old_end,
+					     old_addr + new_len);
+				cache->entry[idx].end_addr = old_addr + new_len;
+			}
+		}
+		return true;
+	}
+
+	/* The mapping has been moved; it is a part of a single vma.  */
+	split_at(cache, old_addr);
 
-	char filename[sizeof("/proc/4294967296/maps")];
-	xsprintf(filename, "/proc/%u/maps", get_proc_pid(tcp));
+	unsigned int idx = find_index(cache, old_addr);
+	bool found = idx < cache->size &&
+		     cache->entry[idx].start_addr == old_addr;
+	struct mmap_cache_entry_t moved;
 
-	FILE *fp = fopen_stream(filename, "r");
-	if (!fp) {
-		perror_msg("fopen: %s", filename);
-		return MMAP_CACHE_REBUILD_NOCACHE;
+	if (found) {
+		moved = cache->entry[idx];
+		moved.start_addr = new_addr;
+		moved.end_addr = new_addr + new_len;
+		ref_name(moved.binary_filename);
 	}
 
-	struct mmap_cache_t cache = {
-		.free_fn = delete_mmap_cache,
-		.generation = mmap_cache_generation
+	if (!(tcp->u_arg[3] & MREMAP_DONTUNMAP))
+		remove_range(cache, old_addr, old_addr + old_len);
+	remove_range(cache, new_addr, new_addr + new_len);
+
+	if (found)
+		insert_entry(cache, find_index(cache, new_addr), &moved);
+
+	return true;
+}
+
+static bool
+update_by_brk(struct mmap_cache_t *cache, struct tcb *tcp)
+{
+	const unsigned long brk_end = page_align(get_rval_addr(tcp));
+
+	/* brk(0) is a query, it tells where the heap starts if there is none.  */
+	if (!tcp->u_arg[0]) {
+		if (!cache->heap_start)
+			cache->heap_start = brk_end;
+		return true;
+	}
+
+	if (!cache->heap_start)
+		return false;
+
+	unsigned int idx = find_index(cache, cache->heap_start);
+	struct mmap_cache_entry_t *entry =
+		idx < cache->size ? &cache->entry[idx] : NULL;
+
+	if (entry && entry->start_addr == cache->heap_start &&
+	    !strcmp(entry->binary_filename, "[heap]")) {
+		if (brk_end <= entry->start_addr) {
+			remove_range(cache, entry->start_addr, entry->end_addr);
+			return true;
+		}
+		if (idx + 1 < cache->size &&
+		    brk_end > cache->entry[idx + 1].start_addr)
+			return false;
+
+		entry->end_addr = brk_end;
+		return true;
+	}
+
+	if (brk_end <= cache->heap_start)
+		return true;
+
+	/* The heap is being created.  */
+	if (entry && brk_end > entry->start_addr)
+		return false;
+
+	const struct mmap_cache_entry_t heap = {
+		.start_addr = cache->heap_start,
+		.end_addr = brk_end,
+		.protections = MMAP_CACHE_PROT_READABLE |
+			       MMAP_CACHE_PROT_WRITABLE,
+		.binary_filename = intern_name("[heap]")
 	};
+	insert_entry(cache, idx, &heap);
 
-	/* start with a small dynamically-allocated array and then expand it */
-	size_t allocated = 0;
-	char buffer[PATH_MAX + 80];
-
-	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-		unsigned long start_addr, end_addr, mmap_offset;
-		char read_bit;
-		char write_bit;
-		char exec_bit;
-		char shared_bit;
-		unsigned long major, minor;
-		char binary_path[sizeof(buffer)];
-
-		if (sscanf(buffer, "%lx-%lx %c%c%c%c %lx %lx:%lx %*d %[^\n]",
-			   &start_addr, &end_addr,
-			   &read_bit, &write_bit, &exec_bit, &shared_bit,
-			   &mmap_offset,
-			   &major, &minor,
-			   binary_path) != 10)
-			continue;
-
-		/* skip mappings that have unknown protection */
-		if (!(read_bit == '-' || read_bit == 'r'))
-			continue;
-		if (!(write_bit == '-' || write_bit == 'w'))
-			continue;
-		if (!(exec_bit == '-' || exec_bit == 'x'))
-			continue;
-		if (!(shared_bit == 'p' || shared_bit == 's'))
-			continue;
-
-		if (end_addr < start_addr) {
-			error_msg("%s: unrecognized file format", filename);
-			break;
+	return true;
+}
+
+/*
+ * Applies a successful memory mapping change made by tcp to the cache.
+ * Returns false if the change cannot be reproduced from the syscall
+ * arguments, the cache has to be re-read then.
+ */
+static bool
+update_mmap_cache(struct mmap_cache_t *cache, struct tcb *tcp,
+		  const struct mmap_cache_entry_t *mapped)
+{
+	const unsigned long addr = tcp->u_arg[0];
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+	case SEN_mmap_pgoff:
+	case SEN_mmap_4koff:
+		remove_range(cache, mapped->start_addr, mapped->end_addr);
+		if (mapped->binary_filename) {
+			struct mmap_cache_entry_t entry = *mapped;
+
+			entry.binary_filename =
+				intern_name(entry.binary_filename);
+			insert_entry(cache,
+				     find_index(cache, entry.start_addr),
+				     &entry);
 		}
+		return true;
+	case SEN_munmap:
+		remove_range(cache, addr, addr + page_align(tcp->u_arg[1]));
+		return true;
+	case SEN_mprotect:
+	case SEN_pkey_mprotect:
+		protect_range(cache, addr, addr + page_align(tcp->u_arg[1]),
+			      prot_to_protections(tcp->u_arg[2]));
+		return true;
+	case SEN_mremap:
+		return update_by_mremap(cache, tcp);
+	case SEN_brk:
+		return update_by_brk(cache, tcp);
+	default:
+		/* execve, shmat, old_mmap, etc.  */
+		return false;
+	}
+}
+
+/*
+ * Fills the entry describing a new mapping created by mmap.
+ * binary_filename is set to NULL for anonymous mappings,
+ * they are not cached.
+ */
+static bool
+get_mmap_entry(struct tcb *tcp, struct mmap_cache_entry_t *entry,
+	       char *path, size_t path_size)
+{
+	unsigned long long offset = tcp->u_arg[5];
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+		break;
+	case SEN_mmap_pgoff:
+		offset *= get_pagesize();
+		break;
+	case SEN_mmap_4koff:
+		offset <<= 12;
+		break;
+	default:
+		return true;
+	}
+
+	const kernel_ulong_t flags = tcp->u_arg[3];
+	const int fd = tcp->u_arg[4];
+
+	entry->start_addr = get_rval_addr(tcp);
+	entry->end_addr = entry->start_addr + page_align(tcp->u_arg[1]);
+	entry->mmap_offset = offset;
+	entry->protections = prot_to_protections(tcp->u_arg[2]) |
+		((flags & MAP_SHARED) ? MMAP_CACHE_PROT_SHARED : 0);
+	entry->binary_filename = NULL;
+
+	if ((flags & MAP_ANONYMOUS) || fd < 0)
+		return true;
+
+	char fdname[sizeof("fd/4294967296")];
+	strace_stat_t st;
+
+	xsprintf(fdname, "fd/%u", fd);
+	if (getfdpath(tcp, fd, path, path_size) < 0 ||
+	    proc_stat(get_proc_pid(tcp), fdname, &st))
+		return false;
+
+	entry->major = major(st.st_dev);
+	entry->minor = minor(st.st_dev);
+	entry->inode = st.st_ino;
+	entry->binary_filename = path;
+
+	return true;
+}
+
+static void
+mmap_cache_update(struct tcb *tcp, bool has_result, void *unused)
+{
+	if (!caches)
+		return;
+
+	struct mmap_cache_t *cache = get_mmap_cache(tcp);
 
-		struct mmap_cache_entry_t *entry;
+	if (cache->stale)
+		return;
+
+	bool explained = has_result;
+	struct mmap_cache_entry_t mapped = { .binary_filename = NULL };
+	char path[PATH_MAX + 1];
+
+	if (explained && syserror(tcp)) {
 		/*
-		 * sanity check to make sure that we're storing
-		 * non-overlapping regions in ascending order
+		 * Failed syscalls change nothing, except for
+		 * MAP_FIXED mmap and mprotect that may fail half way.
 		 */
-		if (cache.size > 0) {
-			entry = &cache.entry[cache.size - 1];
-			if (entry->start_addr == start_addr &&
-			    entry->end_addr == end_addr) {
-				/* duplicate entry, e.g. [vsyscall] */
-				continue;
-			}
-			if (start_addr <= entry->start_addr ||
-			    start_addr < entry->end_addr) {
-				debug_msg("%s: overlapping memory region: "
-					  "\"%s\" [%08lx-%08lx] overlaps with "
-					  "\"%s\" [%08lx-%08lx]",
-					  filename, binary_path, start_addr,
-					  end_addr, entry->binary_filename,
-					  entry->start_addr, entry->end_addr);
-				continue;
-			}
+		switch (tcp_sysent(tcp)->sen) {
+		case SEN_mmap:
+		case SEN_mmap_pgoff:
+		case SEN_mmap_4koff:
+			if (tcp->u_arg[3] & MAP_FIXED)
+				explained = false;
+			break;
+		case SEN_mprotect:
+		case SEN_pkey_mprotect:
+			explained = false;
+			break;
+		}
+		if (explained)
+			return;
+	} else if (explained) {
+		explained = get_mmap_entry(tcp, &mapped, path, sizeof(path));
+	}
+
+	if (explained && update_mmap_cache(cache, tcp, &mapped)) {
+		cache->generation = ++last_generation;
+	} else {
+		free_entries(cache);
+		cache->stale = true;
+	}
+
+	debug_func_msg("tgen=%u, tgid=%d, tcp=%p, cache=%p, stale=%d",
+		       cache->generation, cache->tgid, tcp, cache->entry,
+		       cache->stale);
+}
+
+void
+mmap_cache_enable(void)
+{
+	static bool use_mmap_cache;
+
+	if (!use_mmap_cache) {
+		mmap_notify_register_client(mmap_cache_update, NULL);
+		use_mmap_cache = true;
+	}
+}
+
+struct read_mmap_cache_data {
+	struct mmap_cache_t *cache;
+	const char *filename;
+};
+
+static bool
+add_maps_entry(const struct proc_maps_entry *map, void *data)
+{
+	struct read_mmap_cache_data *const rd = data;
+	struct mmap_cache_t *const cache = rd->cache;
+	const char read_bit = map->perms[0];
+	const char write_bit = map->perms[1];
+	const char exec_bit = map->perms[2];
+	const char shared_bit = map->perms[3];
+
+	/* skip anonymous mappings */
+	if (!map->path_len)
+		return true;
+
+	/* skip mappings that have unknown protection */
+	if (!(read_bit == '-' || read_bit == 'r'))
+		return true;
+	if (!(write_bit == '-' || write_bit == 'w'))
+		return true;
+	if (!(exec_bit == '-' || exec_bit == 'x'))
+		return true;
+	if (!(shared_bit == 'p' || shared_bit == 's'))
+		return true;
+
+	if (map->end_addr < map->start_addr) {
+		error_msg("%s: unrecognized file format", rd->filename);
+		return false;
+	}
+
+	struct mmap_cache_entry_t *entry;
+	/*
+	 * sanity check to make sure that we're storing
+	 * non-overlapping regions in ascending order
+	 */
+	if (cache->size > 0) {
+		entry = &cache->entry[cache->size - 1];
+		if (entry->start_addr == map->start_addr &&
+		    entry->end_addr == map->end_addr) {
+			/* duplicate entry, e.g. [vsyscall] */
+			return true;
+		}
+		if (map->start_addr <= entry->start_addr ||
+		    map->start_addr < entry->end_addr) {
+			debug_msg("%s: overlapping memory region: "
+				  "\"%s\" [%08lx-%08lx] overlaps with "
+				  "\"%s\" [%08lx-%08lx]",
+				  rd->filename, map->path, map->start_addr,
+				  map->end_addr, entry->binary_filename,
+				  entry->start_addr, entry->end_addr);
+			return true;
+		}
+	}
+
+	if (cache->size >= cache->allocated)
+		cache->entry = xgrowarray(cache->entry, &cache->allocated,
+					  sizeof(*cache->entry));
+
+	entry = &cache->entry[cache->size];
+	entry->start_addr = map->start_addr;
+	entry->end_addr = map->end_addr;
+	entry->mmap_offset = map->mmap_offset;
+	entry->protections = (
+		0
+		| ((read_bit   == 'r')? MMAP_CACHE_PROT_READABLE  : 0)
+		| ((write_bit  == 'w')? MMAP_CACHE_PROT_WRITABLE  : 0)
+		| ((exec_bit   == 'x')? MMAP_CACHE_PROT_EXECUTABLE: 0)
+		| ((shared_bit == 's')? MMAP_CACHE_PROT_SHARED    : 0)
+		);
+	entry->major = map->major;
+	entry->minor = map->minor;
+	entry->inode = map->inode;
+	entry->binary_filename = intern_name(map->path);
+	cache->size++;
+
+	if (!strcmp(map->path, "[heap]"))
+		cache->heap_start = map->start_addr;
+
+	return true;
+}
+
+static int
+read_mmap_cache(struct mmap_cache_t *cache, int fd, const char *filename)
+{
+	struct read_mmap_cache_data data = {
+		.cache = cache,
+		.filename = filename
+	};
+
+	cache->heap_start = 0;
+
+	return proc_maps_parse(fd, add_maps_entry, &data);
+}
+
+extern enum mmap_cache_rebuild_result
+mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
+{
+	struct mmap_cache_t *cache = get_mmap_cache(tcp);
+
+	if (cache->stale) {
+		const int proc_pid = get_proc_pid(tcp);
+		char filename[sizeof("/proc/4294967296/maps")];
+		xsprintf(filename, "/proc/%u/maps", proc_pid);
+
+		int fd = proc_open(proc_pid, "maps", O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			perror_msg("open: %s", filename);
+			return MMAP_CACHE_REBUILD_NOCACHE;
 		}
 
-		if (cache.size >= allocated)
-			cache.entry = xgrowarray(cache.entry, &allocated,
-						 sizeof(*cache.entry));
-
-		entry = &cache.entry[cache.size];
-		entry->start_addr = start_addr;
-		entry->end_addr = end_addr;
-		entry->mmap_offset = mmap_offset;
-		entry->protections = (
-			0
-			| ((read_bit   == 'r')? MMAP_CACHE_PROT_READABLE  : 0)
-			| ((write_bit  == 'w')? MMAP_CACHE_PROT_WRITABLE  : 0)
-			| ((exec_bit   == 'x')? MMAP_CACHE_PROT_EXECUTABLE: 0)
-			| ((shared_bit == 's')? MMAP_CACHE_PROT_SHARED    : 0)
-			);
-		entry->major = major;
-		entry->minor = minor;
-		entry->binary_filename = xstrdup(binary_path);
-		cache.size++;
-	}
-	fclose(fp);
-
-	if (!cache.size)
-		return MMAP_CACHE_REBUILD_NOCACHE;
-
-	tcp->mmap_cache = xmalloc(sizeof(*tcp->mmap_cache));
-	memcpy(tcp->mmap_cache, &cache, sizeof(cache));
-
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache->generation, mmap_cache_generation,
-		       tcp, tcp->mmap_cache->entry, caller);
+		if (read_mmap_cache(cache, fd, filename) < 0) {
+			perror_msg("read: %s", filename);
+			free_entries(cache);
+		}
+		close(fd);
+
+		if (!cache->size)
+			return MMAP_CACHE_REBUILD_NOCACHE;
+
+		cache->stale = false;
+		cache->generation = ++last_generation;
+
+		debug_func_msg("tgen=%u, tgid=%d, tcp=%p, cache=%p, caller=%s",
+			       cache->generation, cache->tgid, tcp,
+			       cache->entry, caller);
+	}
+
+	if (tcp->mmap_cache_generation == cache->generation)
+		return MMAP_CACHE_REBUILD_READY;
 
+	tcp->mmap_cache_generation = cache->generation;
 	return MMAP_CACHE_REBUILD_RENEWED;
 }
 
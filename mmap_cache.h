@@ -16,7 +16,19 @@ struct mmap_cache_t {
 	struct mmap_cache_entry_t *entry;
 	void (*free_fn)(struct tcb *, const char *caller);
 	unsigned int size;
+	/* Changed on every change of the entries, unique among caches.  */
 	unsigned int generation;
+	/* The number of tcbs sharing the cache.  */
+	unsigned int refcount;
+	size_t allocated;
+	/* The start of the brk heap, if known.  */
+	unsigned long heap_start;
+	/* The cache is shared by all threads of the process.  */
+	int tgid;
+	/* The entries are out of date, /proc/PID/maps has to be re-read.  */
+	bool stale;
+	struct mmap_cache_t *prev;
+	struct mmap_cache_t *next;
 };
 
 struct mmap_cache_entry_t {
@@ -30,6 +42,7 @@ struct mmap_cache_entry_t {
 	 * protections is MMAP_CACHE_PROT_READABLE|MMAP_CACHE_PROT_EXECUTABLE
 	 * major       is 0xfc
 	 * minor       is 0x00
+	 * inode       is 1180246
 	 * binary_filename is "/lib/libc-2.11.1.so"
 	 */
 	unsigned long start_addr;
@@ -37,7 +50,9 @@ struct mmap_cache_entry_t {
 	unsigned long mmap_offset;
 	unsigned char protections;
 	unsigned long major, minor;
-	char *binary_filename;
+	unsigned long inode;
+	/* Interned, equal names are equal pointers.  */
+	const char *binary_filename;
 };
 
 enum mmap_cache_protection {
@@ -24,11 +24,17 @@ mmap_notify_register_client(mmap_notify_fn fn, void *data)
 	clients = client;
 }
 
+bool
+mmap_notify_has_clients(void)
+{
+	return clients != NULL;
+}
+
 void
-mmap_notify_report(struct tcb *tcp)
+mmap_notify_report(struct tcb *tcp, bool has_result)
 {
 	struct mmap_notify_client *client;
 
 	for (client = clients; client; client = client->next)
-		client->fn(tcp, client->data);
+		client->fn(tcp, has_result, client->data);
 }
@@ -9,12 +9,19 @@
 
 # include "defs.h"
 
-typedef void (*mmap_notify_fn)(struct tcb *, void *);
+/*
+ * The second argument tells whether the syscall result has been fetched,
+ * i.e. whether tcp->u_rval and tcp->u_error can be trusted.
+ */
+typedef void (*mmap_notify_fn)(struct tcb *, bool has_result, void *);
 
 extern void
 mmap_notify_register_client(mmap_notify_fn, void *);
 
+extern bool
+mmap_notify_has_clients(void);
+
 extern void
-mmap_notify_report (struct tcb *);
+mmap_notify_report(struct tcb *, bool has_result);
 
 #endif /* !STRACE_MMAP_NOTIFY_H */
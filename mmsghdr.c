@@ -59,16 +59,6 @@ print_struct_mmsghdr(struct tcb *tcp, void *elem_buf,
 	return true;
 }
 
-static void
-free_mmsgvec_data(void *ptr)
-{
-	char **pstr = ptr;
-	free(*pstr);
-	*pstr = 0;
-
-	free(ptr);
-}
-
 struct mmsgvec_data {
 	char *timeout;
 	unsigned int count;
@@ -84,8 +74,8 @@ save_mmsgvec_namelen(struct tcb *const tcp, kernel_ulong_t addr,
 
 	const size_t data_size = offsetof(struct mmsgvec_data, namelen)
 				 + sizeof(int) * len;
-	struct mmsgvec_data *const data = xmalloc(data_size);
-	data->timeout = xstrdup(timeout);
+	struct mmsgvec_data *const data = tcb_alloc(tcp, data_size);
+	data->timeout = tcb_strdup(tcp, timeout);
 
 	unsigned int i, fetched;
 
@@ -99,7 +89,7 @@ save_mmsgvec_namelen(struct tcb *const tcp, kernel_ulong_t addr,
 	}
 	data->count = i;
 
-	set_tcb_priv_data(tcp, data, free_mmsgvec_data);
+	set_tcb_priv_data(tcp, data, NULL);
 }
 
 static void
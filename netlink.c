@@ -44,6 +44,29 @@
 # include "xlat/crypto_msgs.h"
 #undef XLAT_MACROS_ONLY
 
+/*
+ * Netlink buffers are read at once, and the messages and the attributes
+ * are decoded from the local copy instead of fetching each of them
+ * separately.  Unless -v is given, no more than max_strlen messages are
+ * printed, so the prefetch is limited to that many messages of the size
+ * the kernel usually allocates for them (NLMSG_GOODSIZE), and to
+ * NETLINK_PREFETCH_MAX in any case.
+ */
+#define NETLINK_PREFETCH_MSG_SIZE	8192
+#define NETLINK_PREFETCH_MAX		(1024 * 1024)
+
+static kernel_ulong_t
+netlink_prefetch_len(struct tcb *const tcp, const kernel_ulong_t len)
+{
+	kernel_ulong_t limit = NETLINK_PREFETCH_MAX;
+
+	if (abbrev(tcp))
+		limit = MIN(limit, (kernel_ulong_t) max_strlen *
+				   NETLINK_PREFETCH_MSG_SIZE);
+
+	return MIN(len, limit);
+}
+
 /*
  * Fetch a struct nlmsghdr from the given address.
  */
@@ -631,6 +654,9 @@ decode_netlink(struct tcb *const tcp,
 	bool is_array = false;
 	unsigned int elt;
 
+	if (verbose(tcp) && len > NLMSG_HDRLEN)
+		umove_prefetch(tcp, addr, netlink_prefetch_len(tcp, len));
+
 	for (elt = 0; fetch_nlmsghdr(tcp, &nlmsghdr, addr, len, is_array);
 	     elt++) {
 		if (abbrev(tcp) && elt == max_strlen) {
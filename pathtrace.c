@@ -12,6 +12,7 @@
 #include <poll.h>
 
 #include "number_set.h"
+#include "procfs.h"
 #include "syscall.h"
 #include "xstring.h"
 
@@ -81,7 +82,7 @@ storepath(const char *path, struct path_set *set)
 int
 getfdpath_pid(pid_t pid, int fd, char *buf, unsigned bufsize)
 {
-	char linkpath[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int)*3];
+	char name[sizeof("fd/%u") + sizeof(int) * 3];
 	ssize_t n;
 
 	if (fd < 0)
@@ -92,8 +93,8 @@ getfdpath_pid(pid_t pid, int fd, char *buf, unsigned bufsize)
 	if (!proc_pid)
 		return -1;
 
-	xsprintf(linkpath, "/proc/%u/fd/%u", proc_pid, fd);
-	n = readlink(linkpath, buf, bufsize - 1);
+	xsprintf(name, "fd/%u", fd);
+	n = proc_readlink(proc_pid, name, buf, bufsize - 1);
 	/*
 	 * NB: if buf is too small, readlink doesn't fail,
 	 * it returns truncated result (IOW: n == bufsize - 1).
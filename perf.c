@@ -32,15 +32,6 @@ struct pea_desc {
 	uint32_t size;
 };
 
-static void
-free_pea_desc(void *pea_desc_ptr)
-{
-	struct pea_desc *desc = pea_desc_ptr;
-
-	free(desc->attr);
-	free(desc);
-}
-
 int
 fetch_perf_event_attr(struct tcb *const tcp, const kernel_ulong_t addr)
 {
@@ -74,20 +65,17 @@ fetch_perf_event_attr(struct tcb *const tcp, const kernel_ulong_t addr)
 	/* Size should be multiple of 8, but kernel doesn't check for it */
 	/* size &= ~7; */
 
-	attr = xzalloc(sizeof(*attr));
-
-	if (umoven_or_printaddr(tcp, addr, size, attr)) {
-		free(attr);
+	attr = tcb_zalloc(tcp, sizeof(*attr));
 
+	if (umoven_or_printaddr(tcp, addr, size, attr))
 		return 1;
-	}
 
-	desc = xmalloc(sizeof(*desc));
+	desc = tcb_alloc(tcp, sizeof(*desc));
 
 	desc->attr = attr;
 	desc->size = size;
 
-	set_tcb_priv_data(tcp, desc, free_pea_desc);
+	set_tcb_priv_data(tcp, desc, NULL);
 
 	return 0;
 }
@@ -24,6 +24,7 @@
 #include "largefile_wrappers.h"
 #include "trie.h"
 #include "nsfs.h"
+#include "procfs.h"
 #include "xmalloc.h"
 #include "xstring.h"
 
@@ -41,12 +42,19 @@ static struct trie *ns_pid_to_proc_pid[PT_COUNT];
  */
 static struct trie *proc_data_cache;
 
+/**
+ * Key:   PID NS ID
+ * Value: struct ns_hierarchy of the NS, starting from the NS itself
+ */
+static struct trie *ns_hierarchy_cache;
+
 static bool ns_get_parent_enotty = false;
 
 static const char tid_str[]  = "NSpid:\t";
 static const char tgid_str[] = "NStgid:\t";
 static const char pgid_str[] = "NSpgid:\t";
 static const char sid_str[]  = "NSsid:\t";
+static const char ppid_str[] = "PPid:\t";
 
 static const struct {
 	const char *str;
@@ -71,8 +79,14 @@ static const uint8_t ptr_sz_lg = (sizeof(void *) == 8 ? 6 : 5);
 static int pid_max;
 static uint8_t pid_max_size, pid_max_size_lg;
 
+struct ns_hierarchy {
+	size_t count;
+	unsigned int ns[MAX_NS_DEPTH];
+};
+
 struct proc_data {
 	int proc_pid;
+	int ppid;
 	int ns_count;
 	unsigned int ns_hierarchy[MAX_NS_DEPTH];
 	int id_count[PT_COUNT];
@@ -114,6 +128,7 @@ pidns_init(void)
 		ns_pid_to_proc_pid[i] = create_trie_4(ns_id_size, ptr_sz_lg, 0);
 
 	proc_data_cache = create_trie_4(pid_max_size, ptr_sz_lg, 0);
+	ns_hierarchy_cache = create_trie_4(ns_id_size, ptr_sz_lg, 0);
 }
 
 static void
@@ -139,51 +154,16 @@ get_cached_proc_pid(unsigned int ns, int ns_pid, enum pid_type type)
 }
 
 /**
- * Helper function, converts pid to string, or to "self" for pid == 0.
- * Uses static buffer for operation.
+ * Reads the list of PID NS IDs starting from the NS referenced by fd,
+ * following the NS_GET_PARENT chain.  Closes fd.
  */
-static const char *
-pid_to_str(pid_t pid)
-{
-	if (!pid)
-		return "self";
-
-	static char buf[sizeof("-2147483648")];
-	xsprintf(buf, "%d", pid);
-	return buf;
-}
-
-/**
- * Returns a list of PID NS IDs for the specified PID.
- *
- * @param proc_pid PID (as present in /proc) to get information for.
- * @param ns_buf   Pointer to buffer that is able to contain at least
- *                 ns_buf_size items.
- * @return         Amount of NS in list. 0 indicates error.
- */
-static size_t
-get_ns_hierarchy(int proc_pid, unsigned int *ns_buf, size_t ns_buf_size)
+static void
+read_ns_hierarchy(int fd, unsigned int ns_ino, struct ns_hierarchy *nh)
 {
-	char path[PATH_MAX + 1];
-	xsprintf(path, "/proc/%s/ns/pid", pid_to_str(proc_pid));
-
-	int fd = open_file(path, O_RDONLY);
-	if (fd < 0)
-		return 0;
-
-	size_t n = 0;
-	while (n < ns_buf_size) {
-		strace_stat_t st;
-		if (fstat_fd(fd, &st))
-			break;
-
-		ns_buf[n++] = st.st_ino;
-		if (n >= ns_buf_size)
-			break;
-
-		if (ns_get_parent_enotty)
-			break;
+	nh->count = 0;
+	nh->ns[nh->count++] = ns_ino;
 
+	while (nh->count < MAX_NS_DEPTH && !ns_get_parent_enotty) {
 		int parent_fd = ioctl(fd, NS_GET_PARENT);
 		if (parent_fd < 0) {
 			switch (errno) {
@@ -206,49 +186,67 @@ get_ns_hierarchy(int proc_pid, unsigned int *ns_buf, size_t ns_buf_size)
 
 		close(fd);
 		fd = parent_fd;
+
+		strace_stat_t st;
+		if (fstat_fd(fd, &st))
+			break;
+
+		nh->ns[nh->count++] = st.st_ino;
 	}
 
 	close(fd);
-
-	return n;
 }
 
 /**
- * Get list of IDs present in NS* proc status record. IDs are placed as they are
- * stored in /proc (from top to bottom of NS hierarchy).
+ * Returns a list of PID NS IDs for the specified PID.
  *
- * @param proc_pid    PID (as present in /proc) to get information for.
- * @param id_buf      Pointer to buffer that is able to contain at least
- *                    MAX_NS_DEPTH items. Can be NULL.
- * @param type        Type of ID requested.
- * @return            Number of items stored in id_list. 0 indicates error.
+ * As the NS hierarchy does not change during the life time of a NS,
+ * it is cached by the ID of the innermost NS, so the NS_GET_PARENT walk
+ * is performed once per NS rather than once per process.
+ *
+ * @param proc_pid PID (as present in /proc) to get information for.
+ * @param ns_buf   Pointer to buffer that is able to contain at least
+ *                 ns_buf_size items.
+ * @return         Amount of NS in list. 0 indicates error.
  */
 static size_t
-get_id_list(int proc_pid, int *id_buf, enum pid_type type)
+get_ns_hierarchy(int proc_pid, unsigned int *ns_buf, size_t ns_buf_size)
 {
-	const char *ns_str = id_strs[type].str;
-	size_t ns_str_size = id_strs[type].size;
-
-	size_t n = 0;
-
-	char status_path[PATH_MAX + 1];
-	xsprintf(status_path, "/proc/%s/status", pid_to_str(proc_pid));
-	FILE *f = fopen_stream(status_path, "r");
-	if (!f)
+	strace_stat_t st;
+	if (proc_stat(proc_pid, "ns/pid", &st))
 		return 0;
 
-	char *line = NULL;
-	size_t linesize = 0;
-	char *p = NULL;
+	struct ns_hierarchy *nh = (struct ns_hierarchy *) (uintptr_t)
+		trie_get(ns_hierarchy_cache, st.st_ino);
 
-	while (getline(&line, &linesize, f) > 0) {
-		if (strncmp(line, ns_str, ns_str_size) == 0) {
-			p = line + ns_str_size;
-			break;
-		}
+	if (!nh) {
+		int fd = proc_open(proc_pid, "ns/pid", O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return 0;
+
+		nh = xmalloc(sizeof(*nh));
+		read_ns_hierarchy(fd, st.st_ino, nh);
+		trie_set(ns_hierarchy_cache, st.st_ino,
+			 (uint64_t) (uintptr_t) nh);
 	}
 
-	while (p) {
+	size_t n = MIN(nh->count, ns_buf_size);
+	memcpy(ns_buf, nh->ns, n * sizeof(*ns_buf));
+
+	return n;
+}
+
+/**
+ * Parses a list of IDs in a NS* proc status record.
+ *
+ * @return Number of items stored in id_buf.
+ */
+static int
+parse_id_list(char *p, int *id_buf)
+{
+	int n = 0;
+
+	while (p && n < MAX_NS_DEPTH) {
 		errno = 0;
 		long id = strtol(p, NULL, 10);
 
@@ -257,17 +255,60 @@ get_id_list(int proc_pid, int *id_buf, enum pid_type type)
 			break;
 		}
 
-		if (id_buf)
-			id_buf[n] = (int) id;
-
-		n++;
+		id_buf[n++] = (int) id;
 		strsep(&p, "\t");
 	}
 
+	return n;
+}
+
+/**
+ * Reads the lists of IDs present in NS* proc status records and the parent
+ * PID in a single pass over /proc/<pid>/status.  IDs are placed as they are
+ * stored in /proc (from top to bottom of NS hierarchy).
+ *
+ * @param proc_pid PID (as present in /proc) to get information for.
+ * @param pd       The proc_data to store id_count, id_hierarchy, and ppid in.
+ * @return         Whether the status file has been read.
+ */
+static bool
+get_id_lists(int proc_pid, struct proc_data *pd)
+{
+	FILE *f = proc_fopen(proc_pid, "status");
+	if (!f)
+		return false;
+
+	char *line = NULL;
+	size_t linesize = 0;
+	unsigned int found = 0;
+
+	memset(pd->id_count, 0, sizeof(pd->id_count));
+	pd->ppid = 0;
+
+	while (found != (1U << PT_COUNT) - 1 &&
+	       getline(&line, &linesize, f) > 0) {
+		if (strncmp(line, ppid_str, sizeof(ppid_str) - 1) == 0) {
+			pd->ppid = atoi(line + sizeof(ppid_str) - 1);
+			continue;
+		}
+
+		for (int type = 0; type < PT_COUNT; type++) {
+			if (strncmp(line, id_strs[type].str,
+				    id_strs[type].size))
+				continue;
+
+			pd->id_count[type] =
+				parse_id_list(line + id_strs[type].size,
+					      pd->id_hierarchy[type]);
+			found |= 1U << type;
+			break;
+		}
+	}
+
 	free(line);
 	fclose(f);
 
-	return n;
+	return true;
 }
 
 /**
@@ -278,8 +319,12 @@ is_proc_ours(void)
 {
 	static int cached_val = -1;
 
-	if (cached_val < 0)
-		cached_val = get_id_list(0, NULL, PT_TID) <= 1;
+	if (cached_val < 0) {
+		struct proc_data pd;
+
+		cached_val = !get_id_lists(0, &pd) ||
+			     pd.id_count[PT_TID] <= 1;
+	}
 
 	return cached_val;
 }
@@ -340,6 +385,42 @@ get_or_create_proc_data(int proc_pid)
 	return pd;
 }
 
+/**
+ * Frees the proc_data associated with proc_pid, if any.
+ */
+static void
+drop_proc_data(int proc_pid)
+{
+	struct proc_data *pd = (struct proc_data *) (uintptr_t)
+		trie_get(proc_data_cache, proc_pid);
+
+	if (pd) {
+		trie_set(proc_data_cache, proc_pid, (uint64_t) (uintptr_t) NULL);
+		free(pd);
+	}
+}
+
+/**
+ * Stores the (NS, ID) -> proc PID mappings of all the IDs of the process
+ * in all the namespaces it is visible in, so that subsequent lookups
+ * of any of them are resolved without reading /proc.
+ */
+static void
+put_proc_data_ids(struct proc_data *pd)
+{
+	for (int type = 0; type < PT_COUNT; type++) {
+		int id_count = pd->id_count[type];
+
+		if (id_count < pd->ns_count)
+			continue;
+
+		for (int i = 0; i < pd->ns_count; i++)
+			put_proc_pid(pd->ns_hierarchy[i],
+				     pd->id_hierarchy[type][id_count - i - 1],
+				     type, pd->proc_pid);
+	}
+}
+
 /**
  * Updates the proc_data from /proc
  * If the process does not exists, returns false, and frees the proc_data
@@ -352,16 +433,15 @@ update_proc_data(struct proc_data *pd, enum pid_type type)
 	if (!pd->ns_count)
 		goto fail;
 
-	pd->id_count[type] = get_id_list(pd->proc_pid,
-		pd->id_hierarchy[type], type);
-	if (!pd->id_count[type])
+	if (!get_id_lists(pd->proc_pid, pd) || !pd->id_count[type])
 		goto fail;
 
+	put_proc_data_ids(pd);
+
 	return true;
 
 fail:
-	trie_set(proc_data_cache, pd->proc_pid, (uint64_t) (uintptr_t) NULL);
-	free(pd);
+	drop_proc_data(pd->proc_pid);
 	return false;
 }
 
@@ -430,17 +510,131 @@ translate_id_proc_pid(struct translate_id_params *tip, int proc_pid)
 }
 
 /**
- * Translates an id to our namespace by reading all proc entries in a directory.
- * The directory is either /proc or /proc/<pid>/task.
+ * Translates an id to our namespace by reading the proc entries
+ * of all the threads of a process in /proc/<pid>/task.
  *
+ * @param tip      The parameters
+ * @param proc_pid The proc pid of the process.
+ */
+static void
+translate_id_task_dir(struct translate_id_params *tip, int proc_pid)
+{
+	DIR *dir = proc_opendir(proc_pid, "task");
+	if (!dir) {
+		debug_func_perror_msg("opening dir: /proc/%d/task", proc_pid);
+		return;
+	}
+
+	while (!tip->result_id) {
+		errno = 0;
+		struct_dirent *entry = read_dir(dir);
+		if (!entry) {
+			if (errno)
+				perror_func_msg("readdir");
+
+			break;
+		}
+
+		if (entry->d_type != DT_DIR)
+			continue;
+
+		errno = 0;
+		long tid = strtol(entry->d_name, NULL, 10);
+		if (tid < 1 || tid > INT_MAX || errno)
+			continue;
+
+		translate_id_proc_pid(tip, tid);
+	}
+
+	closedir(dir);
+}
+
+/**
+ * Translates an id to our namespace by looking only at the processes
+ * closely related to the tracee: its threads, its children, and its parent.
+ * These are what a tracee refers to most of the time, so this resolves
+ * the majority of cache misses without walking the whole /proc.
+ */
+static void
+translate_id_related(struct translate_id_params *tip, struct tcb *tcp)
+{
+	int proc_pid = get_proc_pid(tcp);
+	if (!proc_pid)
+		return;
+
+	translate_id_task_dir(tip, proc_pid);
+	if (tip->result_id)
+		return;
+
+	char name[sizeof("task/%d/children") + sizeof(int) * 3];
+	xsprintf(name, "task/%d/children", proc_pid);
+
+	FILE *f = proc_fopen(proc_pid, name);
+	if (f) {
+		int child;
+
+		while (!tip->result_id && fscanf(f, "%d", &child) == 1)
+			translate_id_proc_pid(tip, child);
+
+		fclose(f);
+
+		if (tip->result_id)
+			return;
+	}
+
+	struct proc_data *pd = (struct proc_data *) (uintptr_t)
+		trie_get(proc_data_cache, proc_pid);
+	if (pd && pd->ppid > 0)
+		translate_id_proc_pid(tip, pd->ppid);
+}
+
+/**
+ * Translates an id to our namespace using the (NS, ID) -> proc PID cache.
+ * The cached proc_data of a tracee is used as is, as it is dropped when
+ * the tracee is gone, see pidns_drop_pid().  The proc_data of the other
+ * processes is re-read from /proc, as their PIDs may have been reused.
+ */
+static void
+translate_id_cached(struct translate_id_params *tip)
+{
+	int proc_pid = get_cached_proc_pid(tip->from_ns, tip->from_id,
+					   tip->type);
+	if (!proc_pid)
+		return;
+
+	struct proc_data *pd = (struct proc_data *) (uintptr_t)
+		trie_get(proc_data_cache, proc_pid);
+
+	/*
+	 * Unlike thread and thread group IDs, process group and session IDs
+	 * can be changed by the process at any time, so they are always
+	 * re-read.
+	 */
+	if (pd && is_proc_ours() && pid2tcb(proc_pid) &&
+	    tip->type != PT_PGID && tip->type != PT_SID) {
+		tip->pd = pd;
+		translate_id_proc_pid(tip, 0);
+	} else {
+		translate_id_proc_pid(tip, proc_pid);
+	}
+}
+
+static void
+free_trie_ptr_fn(void *fn_data, uint64_t key, uint64_t val)
+{
+	free((void *) (uintptr_t) val);
+}
+
+/**
+ * Reads the proc entries in a directory into the cache.
+ * The directory is either /proc or /proc/<pid>/task.
  *
- * @param tip            The parameters
  * @param path           The path of the directory to be read.
- * @param read_task_dir  Whether recurse to "task" subdirectory.
+ * @param read_task_dir  Whether to read "task" subdirectories instead
+ *                       of the entries themselves.
  */
 static void
-translate_id_dir(struct translate_id_params *tip, const char *path,
-                 bool read_task_dir)
+scan_proc_dir(const char *path, bool read_task_dir)
 {
 	DIR *dir = opendir(path);
 	if (!dir) {
@@ -448,7 +642,7 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 		return;
 	}
 
-	while (!tip->result_id) {
+	for (;;) {
 		errno = 0;
 		struct_dirent *entry = read_dir(dir);
 		if (!entry) {
@@ -469,44 +663,37 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 		if (read_task_dir) {
 			char task_dir_path[PATH_MAX + 1];
 			xsprintf(task_dir_path, "/proc/%ld/task", proc_pid);
-			translate_id_dir(tip, task_dir_path, false);
+			scan_proc_dir(task_dir_path, false);
+			continue;
 		}
 
-		if (tip->result_id)
-			break;
-
-		translate_id_proc_pid(tip, proc_pid);
+		struct proc_data *pd = get_or_create_proc_data(proc_pid);
+		if (pd)
+			update_proc_data(pd, PT_TID);
 	}
 
 	closedir(dir);
 }
 
 /**
- * Iterator function of the proc_data_cache for id translation.
- * If the cache contains the id we are looking for, reads the corresponding
- * directory in /proc, and if cache is valid, saves the result.
+ * Drops all the cached proc_data and NS hierarchies, and reads all entries
+ * in /proc in a single pass, populating the cache with all the IDs
+ * of all the processes.
  */
 static void
-proc_data_cache_iterator_fn(void* fn_data, uint64_t key, uint64_t val)
+rebuild_cache(void)
 {
-	struct translate_id_params *tip = (struct translate_id_params *)fn_data;
-	struct proc_data *pd = (struct proc_data *) (uintptr_t) val;
-
-	if (!pd)
-		return;
-
-	/* Result already found in an earlier iteration */
-	if (tip->result_id)
-		return;
+	trie_iterate_keys(proc_data_cache, 0, pid_max - 1,
+			  free_trie_ptr_fn, NULL);
+	trie_free(proc_data_cache);
+	proc_data_cache = create_trie_4(pid_max_size, ptr_sz_lg, 0);
 
-	/* Translate from cache */
-	tip->pd = pd;
-	translate_id_proc_pid(tip, 0);
-	if (!tip->result_id)
-		return;
+	trie_iterate_keys(ns_hierarchy_cache, 0, UINT_MAX,
+			  free_trie_ptr_fn, NULL);
+	trie_free(ns_hierarchy_cache);
+	ns_hierarchy_cache = create_trie_4(ns_id_size, ptr_sz_lg, 0);
 
-	/* Now translate from actual data in /proc, to check cache validity */
-	translate_id_proc_pid(tip, pd->proc_pid);
+	scan_proc_dir("/proc", true);
 }
 
 int
@@ -540,23 +727,20 @@ translate_pid(struct tcb *tcp, int from_id, enum pid_type type,
 		return 0;
 
 	/* Look for a cached proc_pid for this (from_ns, from_id) pair */
-	int cached_proc_pid = get_cached_proc_pid(tip.from_ns, tip.from_id,
-		tip.type);
-	if (cached_proc_pid) {
-		translate_id_proc_pid(&tip, cached_proc_pid);
+	translate_id_cached(&tip);
+	if (tip.result_id)
+		goto exit;
+
+	/* Look at the processes the tracee is likely to refer to */
+	if (tcp) {
+		translate_id_related(&tip, tcp);
 		if (tip.result_id)
 			goto exit;
 	}
 
-	/* Iterate through the cache, find potential proc_data */
-	trie_iterate_keys(proc_data_cache, 0, pid_max - 1,
-		proc_data_cache_iterator_fn, &tip);
-	/* (proc_data_cache_iterator_fn takes care about updating proc_data) */
-	if (tip.result_id)
-		goto exit;
-
 	/* No cache helped, read all entries in /proc */
-	translate_id_dir(&tip, "/proc", true);
+	rebuild_cache();
+	translate_id_cached(&tip);
 
 exit:
 	if (tip.pd) {
@@ -579,6 +763,31 @@ get_proc_pid(struct tcb *tcp)
 	return proc_pid;
 }
 
+int
+get_proc_tgid(struct tcb *tcp)
+{
+	if (tcp->tgid)
+		return tcp->tgid;
+
+	const int proc_pid = get_proc_pid(tcp);
+	FILE *fp = proc_fopen(proc_pid, "status");
+	if (!fp)
+		return proc_pid;
+
+	int tgid = proc_pid;
+	char buffer[80];
+
+	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+		if (sscanf(buffer, "Tgid: %d", &tgid) == 1)
+			break;
+	}
+	fclose(fp);
+
+	/* The thread group of a thread never changes.  */
+	tcp->tgid = tgid;
+	return tgid;
+}
+
 static void
 printpid_translation(struct tcb *tcp, int pid, enum pid_type type)
 {
@@ -606,3 +815,16 @@ printpid_tgid_pgid(struct tcb *tcp, int pid)
 	else if (pid < -1)
 		printpid_translation(tcp, -pid, PT_PGID);
 }
+
+void
+pidns_drop_pid(int pid)
+{
+	if (!proc_data_cache || pid <= 0)
+		return;
+
+	int proc_pid = is_proc_ours() ? pid :
+		get_cached_proc_pid(get_our_ns(), pid, PT_TID);
+
+	if (proc_pid)
+		drop_proc_data(proc_pid);
+}
@@ -0,0 +1,278 @@
+/*
+ * Character classification and hexadecimal encoding of whole buffers,
+ * used by string_quote and dumpstr.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "print_utils.h"
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/*
+ * SSE2 is always available on x86_64, 16 bytes are classified at once.
+ * Elsewhere the bytes are classified 8 at once in a 64-bit word,
+ * the result is used just to skip the words without special bytes.
+ */
+#ifdef __SSE2__
+
+# define CHUNK_SIZE 16
+
+static inline __m128i
+load_chunk(const uint8_t *p)
+{
+	return _mm_loadu_si128((const __m128i *) p);
+}
+
+/*
+ * Bytes below ' ' or above '~'.  The signed comparison catches
+ * the bytes above 0x7f as well.
+ */
+static inline __m128i
+nonprint_bytes(const __m128i v)
+{
+	return _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(' ')),
+			    _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+}
+
+static inline unsigned int
+first_byte(const __m128i mask)
+{
+	const unsigned int bits = _mm_movemask_epi8(mask);
+
+	return bits ? (unsigned int) __builtin_ctz(bits) : CHUNK_SIZE;
+}
+
+static inline __m128i
+hex_digits(const __m128i nibbles)
+{
+	const __m128i above9 = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+
+	return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')),
+			    _mm_and_si128(above9,
+					  _mm_set1_epi8('a' - '0' - 10)));
+}
+
+/* The hex digits of the first and the last 8 bytes of v, in order.  */
+static inline void
+hex_digit_pairs(const __m128i v, __m128i *const pairs_lo,
+		__m128i *const pairs_hi)
+{
+	const __m128i mask = _mm_set1_epi8(0xf);
+	const __m128i hi = hex_digits(_mm_and_si128(_mm_srli_epi16(v, 4),
+						    mask));
+	const __m128i lo = hex_digits(_mm_and_si128(v, mask));
+
+	*pairs_lo = _mm_unpacklo_epi8(hi, lo);
+	*pairs_hi = _mm_unpackhi_epi8(hi, lo);
+}
+
+#else /* !__SSE2__ */
+
+# define CHUNK_SIZE sizeof(uint64_t)
+
+# define ONES	0x0101010101010101ULL
+# define HIGHS	0x8080808080808080ULL
+
+/* The high bit of the result is set if there is a byte < n in w.  */
+# define HAS_LESS(w, n)		(((w) - ONES * (n)) & ~(w))
+/* The high bit of the result is set if there is a byte == c in w.  */
+# define HAS_BYTE(w, c)		HAS_LESS((w) ^ (ONES * (c)), 1)
+
+static inline uint64_t
+load_chunk(const uint8_t *p)
+{
+	uint64_t w;
+
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static inline bool
+has_nonprint_bytes(const uint64_t w)
+{
+	return (w | HAS_LESS(w, ' ') | HAS_BYTE(w, 0x7f)) & HIGHS;
+}
+
+#endif /* __SSE2__ */
+
+static inline bool
+is_plain(const uint8_t c)
+{
+	return is_print(c) && c != '"' && c != '\\';
+}
+
+static inline bool
+is_text(const uint8_t c)
+{
+	/* In ASCII isspace is only these chars: "\t\n\v\f\r".  */
+	return is_print(c) || (unsigned int) (c - '\t') < 5;
+}
+
+unsigned int
+copy_plain_prefix(char *const dst, const uint8_t *const src,
+		  const unsigned int size)
+{
+	unsigned int i = 0;
+
+	/* Whole chunks are copied, only the prefix is going to be used.  */
+#ifdef __SSE2__
+	for (; i + CHUNK_SIZE <= size; i += CHUNK_SIZE) {
+		const __m128i v = load_chunk(src + i);
+		const __m128i special =
+			_mm_or_si128(nonprint_bytes(v),
+				     _mm_or_si128(_mm_cmpeq_epi8(v,
+							_mm_set1_epi8('"')),
+						  _mm_cmpeq_epi8(v,
+							_mm_set1_epi8('\\'))));
+
+		_mm_storeu_si128((__m128i *) (dst + i), v);
+
+		const unsigned int n = first_byte(special);
+
+		if (n < CHUNK_SIZE)
+			return i + n;
+	}
+#else
+	for (; i + CHUNK_SIZE <= size; i += CHUNK_SIZE) {
+		const uint64_t w = load_chunk(src + i);
+
+		if (has_nonprint_bytes(w) ||
+		    ((HAS_BYTE(w, '"') | HAS_BYTE(w, '\\')) & HIGHS))
+			break;
+		memcpy(dst + i, &w, sizeof(w));
+	}
+#endif
+
+	for (; i < size && is_plain(src[i]); ++i)
+		dst[i] = src[i];
+
+	return i;
+}
+
+unsigned int
+text_prefix_len(const uint8_t *const str, const unsigned int size)
+{
+	unsigned int i = 0;
+
+	while (i < size) {
+#ifdef __SSE2__
+		if (i + CHUNK_SIZE <= size) {
+			const __m128i v = load_chunk(str + i);
+			const __m128i space =
+				_mm_and_si128(_mm_cmpgt_epi8(v,
+							_mm_set1_epi8('\t' - 1)),
+					      _mm_cmplt_epi8(v,
+							_mm_set1_epi8('\r' + 1)));
+			const unsigned int n =
+				first_byte(_mm_andnot_si128(space,
+							    nonprint_bytes(v)));
+
+			i += n;
+			if (n < CHUNK_SIZE)
+				break;
+			continue;
+		}
+#else
+		if (i + CHUNK_SIZE <= size &&
+		    !has_nonprint_bytes(load_chunk(str + i))) {
+			i += CHUNK_SIZE;
+			continue;
+		}
+#endif
+		if (!is_text(str[i]))
+			break;
+		++i;
+	}
+
+	return i;
+}
+
+char *
+sprint_hex_escaped(char *dst, const uint8_t *src, unsigned int size)
+{
+#ifdef __SSE2__
+	/* "\\x" in each 16-bit lane, in memory order.  */
+	const __m128i prefix = _mm_unpacklo_epi8(_mm_set1_epi8('\\'),
+						 _mm_set1_epi8('x'));
+
+	for (; size >= CHUNK_SIZE; size -= CHUNK_SIZE, src += CHUNK_SIZE) {
+		__m128i pairs_lo, pairs_hi;
+		__m128i *const out = (__m128i *) dst;
+
+		hex_digit_pairs(load_chunk(src), &pairs_lo, &pairs_hi);
+
+		_mm_storeu_si128(out, _mm_unpacklo_epi16(prefix, pairs_lo));
+		_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(prefix, pairs_lo));
+		_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(prefix, pairs_hi));
+		_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(prefix, pairs_hi));
+		dst += 4 * CHUNK_SIZE;
+	}
+#endif
+
+	for (; size; --size, ++src) {
+		*dst++ = '\\';
+		*dst++ = 'x';
+		dst = sprint_byte_hex(dst, *src);
+	}
+
+	return dst;
+}
+
+char *
+sprint_dump_line(char *dst, const uint8_t *src, const unsigned int size)
+{
+	char hex[DUMP_LINE_BYTES * 2];
+	unsigned int i = 0;
+
+#ifdef __SSE2__
+	if (size == DUMP_LINE_BYTES) {
+		__m128i pairs_lo, pairs_hi;
+
+		hex_digit_pairs(load_chunk(src), &pairs_lo, &pairs_hi);
+		_mm_storeu_si128((__m128i *) hex, pairs_lo);
+		_mm_storeu_si128((__m128i *) hex + 1, pairs_hi);
+		i = size;
+	}
+#endif
+	for (; i < size; ++i)
+		sprint_byte_hex(hex + 2 * i, src[i]);
+
+	for (i = 0; i < DUMP_LINE_BYTES; ++i) {
+		if (i < size) {
+			*dst++ = hex[2 * i];
+			*dst++ = hex[2 * i + 1];
+		} else {
+			*dst++ = ' ';
+			*dst++ = ' ';
+		}
+		*dst++ = ' ';
+		if (i == DUMP_LINE_BYTES / 2 - 1)
+			*dst++ = ' ';
+	}
+	*dst++ = ' ';
+
+	i = 0;
+#ifdef __SSE2__
+	if (size == DUMP_LINE_BYTES) {
+		const __m128i v = load_chunk(src);
+		const __m128i nonprint = nonprint_bytes(v);
+
+		_mm_storeu_si128((__m128i *) dst,
+				 _mm_or_si128(_mm_andnot_si128(nonprint, v),
+					      _mm_and_si128(nonprint,
+							_mm_set1_epi8('.'))));
+		i = DUMP_LINE_BYTES;
+	}
+#endif
+	for (; i < DUMP_LINE_BYTES; ++i)
+		dst[i] = i >= size ? ' ' : is_print(src[i]) ? src[i] : '.';
+
+	return dst + DUMP_LINE_BYTES;
+}
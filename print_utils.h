@@ -36,4 +36,46 @@ is_print(uint8_t c)
 	return (c >= ' ') && (c < 0x7f);
 }
 
+/* Whole buffer utils */
+
+/** Number of bytes printed in a line of a hexadecimal dump.  */
+# define DUMP_LINE_BYTES 16
+
+/**
+ * Copies the longest prefix of src that consists of printable characters
+ * other than '"' and '\\' to dst, returns its length.  The rest of dst,
+ * up to size bytes, may be clobbered.
+ */
+extern unsigned int copy_plain_prefix(char *dst, const uint8_t *src,
+				      unsigned int size);
+
+/**
+ * The number of the plain characters in a row after which the rest
+ * of the run is copied with copy_plain_prefix.  On binary data, runs are
+ * short, and the bulk copy costs more than it saves.
+ */
+# define PLAIN_RUN_MIN 4
+
+/**
+ * Returns the length of the longest prefix of str that consists
+ * of printable and whitespace characters.
+ */
+extern unsigned int text_prefix_len(const uint8_t *str, unsigned int size);
+
+/**
+ * Prints size bytes of src in the form of "\\xXX" escape sequences,
+ * 4 * size characters, to dst.  Returns the end of the output.
+ */
+extern char *sprint_hex_escaped(char *dst, const uint8_t *src,
+				unsigned int size);
+
+/**
+ * Prints a line of a hexadecimal dump of up to DUMP_LINE_BYTES bytes of src,
+ * padded with spaces: the hexadecimal values in two groups, followed by
+ * the printable characters, 4 * DUMP_LINE_BYTES + 2 characters, to dst.
+ * Returns the end of the output.
+ */
+extern char *sprint_dump_line(char *dst, const uint8_t *src,
+			      unsigned int size);
+
 #endif /* STRACE_PRINT_UTILS_H */
@@ -0,0 +1,145 @@
+/*
+ * A /proc/PID/maps parser.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "proc_maps.h"
+
+/*
+ * Processes with tens of thousands of mappings are not uncommon,
+ * so the file is read in large chunks and parsed in place,
+ * without stdio and sscanf.
+ */
+#define PROC_MAPS_CHUNK_SIZE	(64 * 1024)
+
+/* The value of a hex digit plus one, zero for non-digits.  */
+static const unsigned char hex_digits[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+static const char *
+scan_hex(const char *p, const char *end, unsigned long *val)
+{
+	const char *const start = p;
+	unsigned long v = 0;
+
+	for (; p < end; ++p) {
+		const unsigned int digit = hex_digits[(unsigned char) *p];
+
+		if (!digit)
+			break;
+		v = (v << 4) | (digit - 1);
+	}
+
+	*val = v;
+	return p == start ? NULL : p;
+}
+
+static const char *
+scan_dec(const char *p, const char *end, unsigned long *val)
+{
+	const char *const start = p;
+	unsigned long v = 0;
+
+	for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		v = v * 10 + (*p - '0');
+
+	*val = v;
+	return p == start ? NULL : p;
+}
+
+static const char *
+skip_char(const char *p, const char *end, const char c)
+{
+	return p && p < end && *p == c ? p + 1 : NULL;
+}
+
+/* Parses the line [p, end), *end is writable and becomes the terminator.  */
+static bool
+parse_line(char *p, char *end, struct proc_maps_entry *entry)
+{
+	const char *q = p;
+
+	q = skip_char(scan_hex(q, end, &entry->start_addr), end, '-');
+	q = q ? skip_char(scan_hex(q, end, &entry->end_addr), end, ' ') : NULL;
+	if (!q || end - q < 5 || q[4] != ' ')
+		return false;
+	memcpy(entry->perms, q, sizeof(entry->perms));
+	q += 5;
+	q = skip_char(scan_hex(q, end, &entry->mmap_offset), end, ' ');
+	q = q ? skip_char(scan_hex(q, end, &entry->major), end, ':') : NULL;
+	q = q ? skip_char(scan_hex(q, end, &entry->minor), end, ' ') : NULL;
+	q = q ? scan_dec(q, end, &entry->inode) : NULL;
+	if (!q)
+		return false;
+
+	while (q < end && *q == ' ')
+		++q;
+
+	*end = '\0';
+	entry->path = q;
+	entry->path_len = end - q;
+
+	return true;
+}
+
+int
+proc_maps_parse(int fd, proc_maps_fn fn, void *data)
+{
+	static char *buf;
+	static size_t buf_size;
+
+	if (!buf) {
+		buf_size = PROC_MAPS_CHUNK_SIZE;
+		buf = xmalloc(buf_size);
+	}
+
+	size_t len = 0;
+
+	for (;;) {
+		if (len == buf_size) {
+			/* A line longer than the buffer.  */
+			buf = xgrowarray(buf, &buf_size, 1);
+		}
+
+		ssize_t n = read(fd, buf + len, buf_size - len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (n == 0) {
+			struct proc_maps_entry entry;
+
+			/* An unterminated last line.  */
+			if (len && parse_line(buf, buf + len, &entry))
+				fn(&entry, data);
+			return 0;
+		}
+
+		char *const end = buf + len + n;
+		char *p = buf;
+		char *eol;
+
+		while ((eol = memchr(p, '\n', end - p))) {
+			struct proc_maps_entry entry;
+
+			if (parse_line(p, eol, &entry) && !fn(&entry, data))
+				return 0;
+			p = eol + 1;
+		}
+
+		len = end - p;
+		memmove(buf, p, len);
+	}
+}
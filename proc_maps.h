@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_PROC_MAPS_H
+# define STRACE_PROC_MAPS_H
+
+# include <stdbool.h>
+# include <stddef.h>
+
+/*
+ * A parsed line of /proc/PID/maps, e.g.
+ * 7fabbb09b000-7fabbb09f000 r-xp 00179000 fc:00 1180246 /lib/libc-2.11.1.so
+ */
+struct proc_maps_entry {
+	unsigned long start_addr;
+	unsigned long end_addr;
+	unsigned long mmap_offset;
+	unsigned long major;
+	unsigned long minor;
+	unsigned long inode;
+	/* "r-xp" */
+	char perms[4];
+	/*
+	 * Points into the read buffer and is NUL-terminated,
+	 * valid only until the callback returns.
+	 * Empty for anonymous mappings.
+	 */
+	const char *path;
+	size_t path_len;
+};
+
+/* Returns false to stop the parsing.  */
+typedef bool (*proc_maps_fn)(const struct proc_maps_entry *, void *data);
+
+/*
+ * Reads the maps file from fd in large chunks and calls fn for every line.
+ * Lines that cannot be parsed are skipped.
+ * Returns 0 on success, -1 on read error.
+ */
+extern int
+proc_maps_parse(int fd, proc_maps_fn fn, void *data);
+
+#endif /* !STRACE_PROC_MAPS_H */
@@ -0,0 +1,205 @@
+/*
+ * Lookups in /proc/PID relative to cached directory descriptors.
+ *
+ * Decoding file descriptors, reading memory maps, and translating PIDs
+ * look up a few entries of /proc/PID of the same tracees over and over.
+ * The /proc/PID directories of the tracees are opened with O_PATH once
+ * and kept in a small set-associative cache, so that every such lookup
+ * walks just the entry relative to the directory.  The cached descriptor
+ * is dropped when the tracee exits, is detached, or calls execve.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include "procfs.h"
+#include "xstring.h"
+
+/* The number of the sets of cached descriptors is 2 to this power.  */
+#define PROC_DIR_CACHE_SET_BITS	4
+#define PROC_DIR_CACHE_SETS	(1U << PROC_DIR_CACHE_SET_BITS)
+/* The number of the descriptors in a set.  */
+#define PROC_DIR_CACHE_WAYS	4U
+/* The size of the full path of the entries looked up.  */
+#define PROC_PATH_SIZE		(sizeof("/proc//") + sizeof(int) * 3 + NAME_MAX)
+
+struct proc_dir {
+	int pid;		/* 0 if the slot is free */
+	int fd;
+};
+
+/* The ways of every set are kept in the most recently used first order.  */
+static struct proc_dir proc_dirs[PROC_DIR_CACHE_SETS][PROC_DIR_CACHE_WAYS];
+
+static struct proc_dir *
+proc_dir_set(const int proc_pid)
+{
+	/* Consecutive PIDs are spread over the sets by Fibonacci hashing.  */
+	const uint32_t hash = (uint32_t) proc_pid * 2654435769U;
+
+	return proc_dirs[hash >> (32 - PROC_DIR_CACHE_SET_BITS)];
+}
+
+static int
+proc_dir_insert(struct proc_dir *const set, const int proc_pid)
+{
+	/*
+	 * Only the tracees are looked up repeatedly, the other processes
+	 * are looked up once per scan of /proc by the PID translation.
+	 */
+	if (!pid2tcb(proc_pid))
+		return -1;
+
+	char path[sizeof("/proc/%d") + sizeof(int) * 3];
+	xsprintf(path, "/proc/%d", proc_pid);
+
+	const int fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	/* The least recently used way is replaced.  */
+	struct proc_dir *const last = &set[PROC_DIR_CACHE_WAYS - 1];
+
+	if (last->pid)
+		close(last->fd);
+	memmove(&set[1], &set[0], sizeof(*set) * (PROC_DIR_CACHE_WAYS - 1));
+	set[0].pid = proc_pid;
+	set[0].fd = fd;
+
+	return fd;
+}
+
+static int
+get_proc_dir(const int proc_pid)
+{
+	if (proc_pid <= 0)
+		return -1;
+
+	struct proc_dir *const set = proc_dir_set(proc_pid);
+
+	for (unsigned int i = 0; i < PROC_DIR_CACHE_WAYS && set[i].pid; ++i) {
+		if (set[i].pid != proc_pid)
+			continue;
+
+		const struct proc_dir d = set[i];
+
+		memmove(&set[1], &set[0], sizeof(*set) * i);
+		set[0] = d;
+
+		return d.fd;
+	}
+
+	return proc_dir_insert(set, proc_pid);
+}
+
+/*
+ * Returns the path of /proc/PROC_PID/NAME relative to *dirfd,
+ * either NAME itself or the full path stored in buf.
+ */
+static const char *
+proc_path(const int proc_pid, const char *const name, int *const dirfd,
+	  char *const buf, const size_t bufsize)
+{
+	*dirfd = get_proc_dir(proc_pid);
+	if (*dirfd >= 0)
+		return name;
+
+	*dirfd = AT_FDCWD;
+	if (proc_pid)
+		xsnprintf(buf, bufsize, "/proc/%d/%s", proc_pid, name);
+	else
+		xsnprintf(buf, bufsize, "/proc/self/%s", name);
+
+	return buf;
+}
+
+int
+proc_open(const int proc_pid, const char *const name, const int flags)
+{
+	char buf[PROC_PATH_SIZE];
+	int dirfd;
+	const char *const path = proc_path(proc_pid, name, &dirfd,
+					   buf, sizeof(buf));
+
+	return openat(dirfd, path, flags);
+}
+
+FILE *
+proc_fopen(const int proc_pid, const char *const name)
+{
+	const int fd = proc_open(proc_pid, name, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	FILE *const fp = fdopen(fd, "r");
+
+	if (!fp)
+		close(fd);
+
+	return fp;
+}
+
+DIR *
+proc_opendir(const int proc_pid, const char *const name)
+{
+	const int fd = proc_open(proc_pid, name,
+				 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0)
+		return NULL;
+
+	DIR *const dir = fdopendir(fd);
+
+	if (!dir)
+		close(fd);
+
+	return dir;
+}
+
+ssize_t
+proc_readlink(const int proc_pid, const char *const name,
+	      char *const buf, const size_t bufsize)
+{
+	char path_buf[PROC_PATH_SIZE];
+	int dirfd;
+	const char *const path = proc_path(proc_pid, name, &dirfd,
+					   path_buf, sizeof(path_buf));
+
+	return readlinkat(dirfd, path, buf, bufsize);
+}
+
+int
+proc_stat(const int proc_pid, const char *const name, strace_stat_t *const st)
+{
+	char buf[PROC_PATH_SIZE];
+	int dirfd;
+	const char *const path = proc_path(proc_pid, name, &dirfd,
+					   buf, sizeof(buf));
+
+	return stat_file_at(dirfd, path, st, 0);
+}
+
+void
+proc_dir_drop(const int proc_pid)
+{
+	if (proc_pid <= 0)
+		return;
+
+	struct proc_dir *const set = proc_dir_set(proc_pid);
+
+	for (unsigned int i = 0; i < PROC_DIR_CACHE_WAYS && set[i].pid; ++i) {
+		if (set[i].pid != proc_pid)
+			continue;
+
+		close(set[i].fd);
+		memmove(&set[i], &set[i + 1],
+			sizeof(*set) * (PROC_DIR_CACHE_WAYS - 1 - i));
+		set[PROC_DIR_CACHE_WAYS - 1].pid = 0;
+		break;
+	}
+}
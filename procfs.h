@@ -0,0 +1,31 @@
+/*
+ * Lookups in /proc/PID relative to cached directory descriptors.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_PROCFS_H
+# define STRACE_PROCFS_H
+
+# include <dirent.h>
+# include <sys/stat.h>
+# include "largefile_wrappers.h"
+
+/*
+ * The equivalents of open, fopen, opendir, readlink, and stat
+ * of /proc/PROC_PID/NAME.  PROC_PID 0 stands for /proc/self.
+ */
+extern int proc_open(int proc_pid, const char *name, int flags);
+extern FILE *proc_fopen(int proc_pid, const char *name);
+extern DIR *proc_opendir(int proc_pid, const char *name);
+extern ssize_t proc_readlink(int proc_pid, const char *name,
+			     char *buf, size_t bufsize);
+extern int proc_stat(int proc_pid, const char *name, strace_stat_t *st);
+
+/* Forget the cached descriptor of /proc/PROC_PID, if any.  */
+extern void proc_dir_drop(int proc_pid);
+
+#endif /* !STRACE_PROCFS_H */
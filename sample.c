@@ -0,0 +1,140 @@
+/*
+ * Statistical sampling of the traced syscalls.
+ *
+ * With --sample=1/N only every Nth traced syscall is decoded,
+ * with --sample-time=DURATION/PERIOD only the syscalls entered during
+ * the first DURATION of every PERIOD are.  The rest is let run through:
+ * their exit is not decoded, and with --seccomp-bpf the tracee is not
+ * stopped on it.  The -c summary is scaled by the ratio of the syscalls
+ * seen to the sampled ones, so the rate may change during the trace.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "string_to_uint.h"
+#include "xmalloc.h"
+
+enum { NS_IN_S = 1000000000 };
+
+bool sampling_enabled;
+
+static unsigned int sample_every;
+/* Set by the overhead governor, multiplies sample_every.  */
+static unsigned int sample_throttle_factor = 1;
+static uint64_t sample_duration_ns;
+static uint64_t sample_period_ns;
+static struct timespec sample_start;
+
+/* The number of the traced syscalls seen so far, by all tracees.  */
+static uint64_t sample_count;
+/* The number of the traced syscalls sampled so far.  */
+static uint64_t sample_taken;
+
+static void
+update_sampling_enabled(void)
+{
+	sampling_enabled = sample_every * sample_throttle_factor > 1
+			   || sample_period_ns;
+}
+
+static uint64_t
+ts_to_ns(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * NS_IN_S + ts->tv_nsec;
+}
+
+bool
+sample_set_rate(const char *const str)
+{
+	const char *const val = STR_STRIP_PREFIX(str, "1/");
+
+	if (val == str)
+		return false;
+
+	const int n = string_to_uint(val);
+
+	if (n <= 0)
+		return false;
+
+	sample_every = n;
+	update_sampling_enabled();
+	return true;
+}
+
+bool
+sample_set_time(const char *const str)
+{
+	char *const copy = xstrdup(str);
+	char *const period = strchr(copy, '/');
+	struct timespec duration_ts, period_ts;
+	bool rc = false;
+
+	if (!period)
+		goto out;
+	*period = '\0';
+
+	if (parse_ts(copy, &duration_ts) < 0
+	    || parse_ts(period + 1, &period_ts) < 0
+	    || !ts_nz(&duration_ts) || ts_cmp(&duration_ts, &period_ts) > 0)
+		goto out;
+
+	sample_duration_ns = ts_to_ns(&duration_ts);
+	sample_period_ns = ts_to_ns(&period_ts);
+	update_sampling_enabled();
+	rc = true;
+
+out:
+	free(copy);
+	return rc;
+}
+
+void
+sample_init(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &sample_start);
+}
+
+static uint64_t
+sample_elapsed_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts_sub(&now, &now, &sample_start);
+
+	return ts_to_ns(&now);
+}
+
+void
+sample_throttle(const unsigned int factor)
+{
+	sample_throttle_factor = factor;
+	update_sampling_enabled();
+}
+
+bool
+syscall_sampled(void)
+{
+	const unsigned int every = (sample_every ?: 1) * sample_throttle_factor;
+	const uint64_t n = sample_count++;
+
+	if (every > 1 && n % every)
+		return false;
+
+	if (sample_period_ns
+	    && sample_elapsed_ns() % sample_period_ns >= sample_duration_ns)
+		return false;
+
+	++sample_taken;
+	return true;
+}
+
+double
+sample_scale(void)
+{
+	return sample_taken ? (double) sample_count / sample_taken : 1;
+}
@@ -70,12 +70,10 @@ decode_request(struct tcb *const tcp, const kernel_ulong_t arg)
 	PRINT_FIELD_FLAGS(", ", sg_io, flags, bsg_flags, "BSG_FLAG_???");
 	PRINT_FIELD_X(", ", sg_io, usr_ptr);
 
-	struct sg_io_v4 *entering_sg_io = malloc(sizeof(*entering_sg_io));
-	if (entering_sg_io) {
-		memcpy(entering_sg_io, &sg_io, sizeof(sg_io));
-		entering_sg_io->guard = (unsigned char) 'Q';
-		set_tcb_priv_data(tcp, entering_sg_io, free);
-	}
+	struct sg_io_v4 *entering_sg_io = tcb_alloc(tcp, sizeof(*entering_sg_io));
+	memcpy(entering_sg_io, &sg_io, sizeof(sg_io));
+	entering_sg_io->guard = (unsigned char) 'Q';
+	set_tcb_priv_data(tcp, entering_sg_io, NULL);
 
 	return 0;
 }
@@ -679,8 +679,8 @@ do_rt_sigtimedwait(struct tcb *const tcp, const print_obj_by_addr_fn print_ts,
 			print_ts(tcp, tcp->u_arg[2]);
 			tprintf(", %" PRI_klu, tcp->u_arg[3]);
 		} else {
-			char *sts = xstrdup(sprint_ts(tcp, tcp->u_arg[2]));
-			set_tcb_priv_data(tcp, sts, free);
+			char *sts = tcb_strdup(tcp, sprint_ts(tcp, tcp->u_arg[2]));
+			set_tcb_priv_data(tcp, sts, NULL);
 		}
 	} else {
 		if (tcp->u_arg[1] && verbose(tcp)) {
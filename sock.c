@@ -150,7 +150,8 @@ decode_ifconf(struct tcb *const tcp, const kernel_ulong_t addr)
 {
 	struct_ifconf *entering_ifc = NULL;
 	struct_ifconf *ifc =
-		entering(tcp) ? malloc(sizeof(*ifc)) : alloca(sizeof(*ifc));
+		entering(tcp) ? tcb_alloc(tcp, sizeof(*ifc))
+			      : alloca(sizeof(*ifc));
 
 	if (exiting(tcp)) {
 		entering_ifc = get_tcb_priv_data(tcp);
@@ -161,10 +162,8 @@ decode_ifconf(struct tcb *const tcp, const kernel_ulong_t addr)
 		}
 	}
 
-	if (!ifc || umove(tcp, addr, ifc) < 0) {
+	if (umove(tcp, addr, ifc) < 0) {
 		if (entering(tcp)) {
-			free(ifc);
-
 			tprints(", ");
 			printaddr(addr);
 		} else {
@@ -188,7 +187,7 @@ decode_ifconf(struct tcb *const tcp, const kernel_ulong_t addr)
 		if (ifc->ifc_buf)
 			print_ifc_len(ifc->ifc_len);
 
-		set_tcb_priv_data(tcp, ifc, free);
+		set_tcb_priv_data(tcp, ifc, NULL);
 
 		return 0;
 	}
@@ -9,6 +9,7 @@
 
 #include "defs.h"
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include "netlink.h"
@@ -30,31 +31,113 @@
 #include "xlat/inet_protocols.h"
 #undef XLAT_MACROS_ONLY
 
-typedef struct {
+typedef struct cache_entry {
+	struct cache_entry *next;
 	unsigned long inode;
 	char *details;
 } cache_entry;
 
-#define CACHE_SIZE 1024U
-static cache_entry cache[CACHE_SIZE];
-#define CACHE_MASK (CACHE_SIZE - 1)
+/*
+ * Socket details keyed by inode, in a hash table with chaining.
+ * The table is grown as needed, and flushed altogether when it becomes
+ * unreasonably large.
+ */
+#define CACHE_MIN_SIZE 1024U
+#define CACHE_MAX_COUNT (1U << 18)
+static cache_entry **cache;
+static unsigned int cache_size;
+static unsigned int cache_count;
+
+static cache_entry **
+cache_find_entry(const unsigned long inode)
+{
+	cache_entry **pe = &cache[inode & (cache_size - 1)];
+
+	while (*pe && (*pe)->inode != inode)
+		pe = &(*pe)->next;
+
+	return pe;
+}
+
+static void
+cache_flush(void)
+{
+	for (unsigned int i = 0; i < cache_size; ++i) {
+		for (cache_entry *e = cache[i], *next; e; e = next) {
+			next = e->next;
+			free(e->details);
+			free(e);
+		}
+		cache[i] = NULL;
+	}
+	cache_count = 0;
+}
+
+static void
+cache_grow(void)
+{
+	const unsigned int new_size = cache_size ? cache_size * 2
+						 : CACHE_MIN_SIZE;
+	cache_entry **const new_cache = xcalloc(new_size, sizeof(*new_cache));
+
+	for (unsigned int i = 0; i < cache_size; ++i) {
+		for (cache_entry *e = cache[i], *next; e; e = next) {
+			next = e->next;
+			e->next = new_cache[e->inode & (new_size - 1)];
+			new_cache[e->inode & (new_size - 1)] = e;
+		}
+	}
+
+	free(cache);
+	cache = new_cache;
+	cache_size = new_size;
+}
 
 static int
 cache_inode_details(const unsigned long inode, char *const details)
 {
-	cache_entry *e = &cache[inode & CACHE_MASK];
-	free(e->details);
-	e->inode = inode;
-	e->details = details;
+	if (cache_count >= CACHE_MAX_COUNT)
+		cache_flush();
+	if (cache_count >= cache_size)
+		cache_grow();
+
+	cache_entry **const pe = cache_find_entry(inode);
+	if (*pe) {
+		free((*pe)->details);
+	} else {
+		*pe = xcalloc(1, sizeof(**pe));
+		(*pe)->inode = inode;
+		++cache_count;
+	}
+	(*pe)->details = details;
 
 	return 1;
 }
 
+static void
+cache_drop_inode(const unsigned long inode)
+{
+	if (!cache_count)
+		return;
+
+	cache_entry **const pe = cache_find_entry(inode);
+	cache_entry *const e = *pe;
+	if (e) {
+		*pe = e->next;
+		free(e->details);
+		free(e);
+		--cache_count;
+	}
+}
+
 static const char *
 get_sockaddr_by_inode_cached(const unsigned long inode)
 {
-	const cache_entry *const e = &cache[inode & CACHE_MASK];
-	return (e && inode == e->inode) ? e->details : NULL;
+	if (!cache_count)
+		return NULL;
+
+	const cache_entry *const e = *cache_find_entry(inode);
+	return e ? e->details : NULL;
 }
 
 static bool
@@ -68,9 +151,37 @@ print_sockaddr_by_inode_cached(const unsigned long inode)
 	return false;
 }
 
+/*
+ * The NETLINK_SOCK_DIAG socket is opened on first use and kept open,
+ * it is closed only when a query fails, so that an interrupted dump
+ * does not interfere with subsequent queries.
+ */
+static int diag_fd = -1;
+static uint32_t nl_seq;
+
+static int
+get_diag_fd(void)
+{
+	if (diag_fd < 0)
+		diag_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+				 NETLINK_SOCK_DIAG);
+	return diag_fd;
+}
+
+static void
+close_diag_fd(void)
+{
+	if (diag_fd >= 0) {
+		close(diag_fd);
+		diag_fd = -1;
+	}
+}
+
 static bool
 send_query(struct tcb *tcp, const int fd, void *req, size_t req_size)
 {
+	((struct nlmsghdr *) req)->nlmsg_seq = ++nl_seq;
+
 	struct sockaddr_nl nladdr = {
 		.nl_family = AF_NETLINK
 	};
@@ -100,7 +211,7 @@ inet_send_query(struct tcb *tcp, const int fd, const int family,
 		const int proto)
 {
 	struct {
-		const struct nlmsghdr nlh;
+		struct nlmsghdr nlh;
 		const struct inet_diag_req_v2 idr;
 	} req = {
 		.nlh = {
@@ -117,6 +228,22 @@ inet_send_query(struct tcb *tcp, const int fd, const int family,
 	return send_query(tcp, fd, &req, sizeof(req));
 }
 
+/*
+ * Sockets that are not yet connected may change their addresses later,
+ * so the details of these are cached only when explicitly asked for.
+ */
+static bool
+inet_is_prefetchable(const struct inet_diag_msg *const diag_msg)
+{
+	return diag_msg->idiag_inode &&
+	       diag_msg->idiag_state != TCP_SYN_SENT &&
+	       diag_msg->idiag_state != TCP_CLOSE;
+}
+
+/*
+ * Caches the details of every socket in the dump that is worth caching,
+ * returns 1 when the socket with the specified inode is found.
+ */
 static int
 inet_parse_response(const void *const data, const int data_len,
 		    const unsigned long inode, void *opaque_data)
@@ -128,8 +255,11 @@ inet_parse_response(const void *const data, const int data_len,
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->idiag_inode != inode)
+
+	const bool found = diag_msg->idiag_inode == inode;
+	if (!found && !inet_is_prefetchable(diag_msg))
 		return 0;
+	const int err = found ? -1 : 0;
 
 	switch (diag_msg->idiag_family) {
 		case AF_INET:
@@ -141,7 +271,7 @@ inet_parse_response(const void *const data, const int data_len,
 			text_size = INET6_ADDRSTRLEN;
 			break;
 		default:
-			return -1;
+			return err;
 	}
 
 	char src_buf[text_size];
@@ -153,7 +283,7 @@ inet_parse_response(const void *const data, const int data_len,
 
 	if (!inet_ntop(diag_msg->idiag_family, diag_msg->id.idiag_src,
 		       src_buf, text_size))
-		return -1;
+		return err;
 
 	if (diag_msg->id.idiag_dport ||
 	    memcmp(zero_addr, diag_msg->id.idiag_dst, addr_size)) {
@@ -161,24 +291,31 @@ inet_parse_response(const void *const data, const int data_len,
 
 		if (!inet_ntop(diag_msg->idiag_family, diag_msg->id.idiag_dst,
 			       dst_buf, text_size))
-			return -1;
+			return err;
 
 		if (asprintf(&details, "%s:[%s%s%s:%u->%s%s%s:%u]", proto_name,
 			     ob, src_buf, cb, ntohs(diag_msg->id.idiag_sport),
 			     ob, dst_buf, cb, ntohs(diag_msg->id.idiag_dport))
 		    < 0)
-			return false;
+			return err;
 	} else {
 		if (asprintf(&details, "%s:[%s%s%s:%u]",
 			     proto_name, ob, src_buf, cb,
 			     ntohs(diag_msg->id.idiag_sport)) < 0)
-			return false;
+			return err;
 	}
 
-	return cache_inode_details(inode, details);
+	cache_inode_details(diag_msg->idiag_inode, details);
+
+	return found;
 }
 
-static bool
+/*
+ * Reads the responses to the last query sent to fd until the end of dump,
+ * passing them to the parser.  Returns 1 if the parser reported
+ * that it has found the requested inode, 0 if it has not, and -1 on error.
+ */
+static int
 receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 		  const unsigned long expected_msg_type,
 		  int (*parser)(const void *, int,
@@ -197,7 +334,7 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 		.iov_base = hdr_buf.buf,
 		.iov_len = sizeof(hdr_buf.buf)
 	};
-	int flags = 0;
+	int found = 0;
 
 	for (;;) {
 		struct msghdr msg = {
@@ -207,30 +344,51 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 			.msg_iovlen = 1
 		};
 
-		ssize_t ret = recvmsg(fd, &msg, flags);
+		ssize_t ret = recvmsg(fd, &msg, 0);
 		if (ret < 0) {
 			if (errno == EINTR)
 				continue;
-			return false;
+			return -1;
 		}
 
 		const struct nlmsghdr *h = &hdr_buf.hdr;
 		if (!is_nlmsg_ok(h, ret))
-			return false;
+			return -1;
 		for (; is_nlmsg_ok(h, ret); h = NLMSG_NEXT(h, ret)) {
+			/* A leftover of an earlier query */
+			if (h->nlmsg_seq != nl_seq)
+				continue;
+			if (h->nlmsg_type == NLMSG_DONE ||
+			    h->nlmsg_type == NLMSG_ERROR)
+				return found;
 			if (h->nlmsg_type != expected_msg_type)
-				return false;
+				return -1;
 			const int rc = parser(NLMSG_DATA(h),
 					      h->nlmsg_len, inode, opaque_data);
-			if (rc > 0)
-				return true;
 			if (rc < 0)
-				return false;
+				return -1;
+			if (rc > 0)
+				found = 1;
+			if (!(h->nlmsg_flags & NLM_F_MULTI))
+				return found;
 		}
-		flags = MSG_DONTWAIT;
 	}
 }
 
+static bool
+receive_diag_responses(struct tcb *tcp, const int fd, const unsigned long inode,
+		       int (*parser)(const void *, int,
+				     unsigned long, void *),
+		       void *opaque_data)
+{
+	const int rc = receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
+					 parser, opaque_data);
+	if (rc < 0)
+		close_diag_fd();
+
+	return rc > 0;
+}
+
 static bool
 unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 {
@@ -242,7 +400,7 @@ unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 		os_release < KERNEL_VERSION(4, 4, 4) ? NLM_F_DUMP : 0;
 
 	struct {
-		const struct nlmsghdr nlh;
+		struct nlmsghdr nlh;
 		const struct unix_diag_req udr;
 	} req = {
 		.nlh = {
@@ -305,7 +463,7 @@ unix_parse_response(const void *data, const int data_len,
 	 * "UNIX:[" SELF_INODE [ "->" PEER_INODE ][ "," SOCKET_FILE ] "]"
 	 */
 	if (!peer && !path_len)
-		return -1;
+		return 0;
 
 	char peer_str[3 + sizeof(peer) * 3];
 	if (peer)
@@ -343,7 +501,7 @@ static bool
 netlink_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 {
 	struct {
-		const struct nlmsghdr nlh;
+		struct nlmsghdr nlh;
 		const struct netlink_diag_req ndr;
 	} req = {
 		.nlh = {
@@ -370,11 +528,15 @@ netlink_parse_response(const void *data, const int data_len,
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->ndiag_ino != inode)
+
+	/* Unbound sockets are cached only when explicitly asked for */
+	const bool found = diag_msg->ndiag_ino == inode;
+	if (!found && (!diag_msg->ndiag_ino || !diag_msg->ndiag_portid))
 		return 0;
+	const int err = found ? -1 : 0;
 
 	if (diag_msg->ndiag_family != AF_NETLINK)
-		return -1;
+		return err;
 
 	netlink_proto = xlookup(netlink_protocols,
 				diag_msg->ndiag_protocol);
@@ -383,14 +545,16 @@ netlink_parse_response(const void *data, const int data_len,
 		netlink_proto = STR_STRIP_PREFIX(netlink_proto, "NETLINK_");
 		if (asprintf(&details, "%s:[%s:%u]", proto_name,
 			     netlink_proto, diag_msg->ndiag_portid) < 0)
-			return -1;
+			return err;
 	} else {
 		if (asprintf(&details, "%s:[%u]", proto_name,
 			     (unsigned) diag_msg->ndiag_protocol) < 0)
-			return -1;
+			return err;
 	}
 
-	return cache_inode_details(inode, details);
+	cache_inode_details(diag_msg->ndiag_ino, details);
+
+	return found;
 }
 
 static const char *
@@ -398,8 +562,8 @@ unix_get(struct tcb *tcp, const int fd, const int family, const int proto,
 	 const unsigned long inode, const char *name)
 {
 	return unix_send_query(tcp, fd, inode)
-		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     unix_parse_response, (void *) name)
+		&& receive_diag_responses(tcp, fd, inode,
+					  unix_parse_response, (void *) name)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
@@ -408,8 +572,8 @@ inet_get(struct tcb *tcp, const int fd, const int family, const int protocol,
 	 const unsigned long inode, const char *proto_name)
 {
 	return inet_send_query(tcp, fd, family, protocol)
-		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     inet_parse_response, (void *) proto_name)
+		&& receive_diag_responses(tcp, fd, inode, inet_parse_response,
+					  (void *) proto_name)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
@@ -418,9 +582,9 @@ netlink_get(struct tcb *tcp, const int fd, const int family, const int protocol,
 	    const unsigned long inode, const char *proto_name)
 {
 	return netlink_send_query(tcp, fd, inode)
-		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     netlink_parse_response,
-				     (void *) proto_name)
+		&& receive_diag_responses(tcp, fd, inode,
+					  netlink_parse_response,
+					  (void *) proto_name)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
@@ -502,7 +666,7 @@ get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].get))
 		return NULL;
 
-	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
+	const int fd = get_diag_fd();
 	if (fd < 0)
 		return NULL;
 	const char *details = NULL;
@@ -524,10 +688,11 @@ get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 						   protocols[proto].name);
 			if (details)
 				break;
+			if (diag_fd < 0)
+				break;
 		}
 	}
 
-	close(fd);
 	return details;
 }
 
@@ -571,6 +736,27 @@ print_sockaddr_by_inode(struct tcb *const tcp, const int fd,
 						 getfdproto(tcp, fd));
 }
 
+bool
+sockaddr_cache_has_entries(void)
+{
+	return cache_count;
+}
+
+/*
+ * Drops the cached details of the socket referred to by fd, to be called
+ * after syscalls that may change the addresses of the socket.
+ */
+void
+invalidate_sockaddr_by_fd(struct tcb *const tcp, const int fd)
+{
+	if (!cache_count)
+		return;
+
+	const unsigned long inode = getfdinode(tcp, fd);
+	if (inode)
+		cache_drop_inode(inode);
+}
+
 /*
  * Managing the cache for decoding communications of Netlink GENERIC protocol
  *
@@ -584,7 +770,7 @@ static bool
 genl_send_dump_families(struct tcb *tcp, const int fd)
 {
 	struct {
-		const struct nlmsghdr nlh;
+		struct nlmsghdr nlh;
 		struct genlmsghdr gnlh;
 	} req = {
 		.nlh = {
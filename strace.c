@@ -36,6 +36,7 @@
 #include "ptrace_syscall_info.h"
 #include "scno.h"
 #include "printsiginfo.h"
+#include "procfs.h"
 #include "trace_event.h"
 #include "xstring.h"
 #include "delay.h"
@@ -49,6 +50,10 @@ extern char *optarg;
 #ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 bool stack_trace_enabled;
+bool stack_trace_ids;
+const char *stack_trace_folded;
+const char *stack_trace_symbol_cache;
+bool stack_trace_suspended;
 #endif
 
 #define my_tkill(tid, sig) syscall(__NR_tkill, (tid), (sig))
@@ -171,6 +176,9 @@ struct tcb_wait_data {
 static struct tcb **tcbtab;
 static unsigned int nprocs;
 static size_t tcbtabsize;
+/* The stack of the free tcbs, the most recently dropped one on top.  */
+static struct tcb **free_tcbs;
+static size_t free_tcbs_count;
 
 static struct tcb_wait_data *tcb_wait_tab;
 static size_t tcb_wait_tab_size;
@@ -185,12 +193,22 @@ unsigned os_release; /* generated from uname()'s u.release */
 static void detach(struct tcb *tcp);
 static void cleanup(int sig);
 static void interrupt(int sig);
+#ifdef ENABLE_STACKTRACE
+static void folded_dump_sighandler(int sig);
+#endif
 
 #ifdef HAVE_SIG_ATOMIC_T
 static volatile sig_atomic_t interrupted, restart_failed;
 #else
 static volatile int interrupted, restart_failed;
 #endif
+#ifdef ENABLE_STACKTRACE
+# ifdef HAVE_SIG_ATOMIC_T
+static volatile sig_atomic_t folded_dump_requested;
+# else
+static volatile int folded_dump_requested;
+# endif
+#endif
 
 static sigset_t timer_set;
 static void timer_sighandler(int);
@@ -297,6 +315,9 @@ Tracing:\n\
                  follow forks\n\
   -ff, --follow-forks --output-separately\n\
                  follow forks with output into separate files\n\
+  --overhead-budget=PERCENT\n\
+                 degrade the tracing step by step while strace is busy\n\
+                 handling the stops for more than PERCENT of the time\n\
   -I INTERRUPTIBLE, --interruptible=INTERRUPTIBLE\n\
      1, anywhere:   no signals are blocked\n\
      2, waiting:    fatal signals are blocked while decoding syscall (default)\n\
@@ -323,6 +344,10 @@ Filtering:\n\
                  print only syscalls that returned without an error code\n\
   -Z, --failed-only\n\
                  print only syscalls that returned with an error code\n\
+  --sample=1/N   trace only every Nth syscall\n\
+  --sample-time=DURATION/PERIOD\n\
+                 trace only the syscalls entered during the first DURATION\n\
+                 of every PERIOD\n\
 \n\
 Output format:\n\
   -a COLUMN, --columns=COLUMN\n\
@@ -333,15 +358,26 @@ Output format:\n\
                  dereference structures for the syscall in SET\n\
   -e raw=SET, --raw=SET\n\
                  print undecoded arguments for the syscalls in SET\n\
+  -e entry-only=SET, --entry-only=SET\n\
+                 print the syscalls in SET on entry, without waiting for\n\
+                 their result\n\
   -e read=SET, --read=SET\n\
                  dump the data read from the file descriptors in SET\n\
   -e write=SET, --write=SET\n\
                  dump the data written to the file descriptors in SET\n\
+  --capture-dir=DIR\n\
+                 append the data of -e read and -e write to DIR/PID.FD\n\
+                 instead of dumping it\n\
   -e quiet=SET, --quiet=SET\n\
                  suppress various informational messages\n\
      messages:   attach, exit, path-resolution, personality, thread-execve\n\
   -e kvm=vcpu, --kvm=vcpu\n\
                  print exit reason of kvm vcpu\n\
+  -e kvm=stats, --kvm=stats\n\
+                 summarise kvm vcpu exits and their latencies on exit\n\
+  --kvm-stats-interval=INTERVAL\n\
+                 summarise kvm vcpu exits every INTERVAL as well,\n\
+                 implies -e kvm=stats\n\
   -e decode-fds=SET, --decode-fds=SET\n\
                  what kinds of file descriptor information details to decode\n\
      details:    dev (device major/minor for block/char device files)\n\
@@ -355,6 +391,21 @@ Output format:\n\
 "\
   -k, --stack-traces\n\
                  obtain stack trace between each syscall\n\
+  --stack-trace-backend=BACKEND\n\
+                 unwind with BACKEND: " USE_UNWINDER " (default) or fp\n\
+                 (faster, follows frame pointers)\n\
+  --stack-trace-ids\n\
+                 print each distinct stack trace once, refer to it by ID\n\
+  --stack-trace-folded=FILE\n\
+                 with -c or -C, aggregate syscalls by stack trace and write\n\
+                 them to FILE in the folded format for flame graphs,\n\
+                 on exit and on SIGUSR1\n\
+  --stack-trace-folded-weight=WEIGHT\n\
+                 weight of the folded stacks: calls (default), errors,\n\
+                 or time (in us, the time -c reports, see -w)\n\
+  --stack-trace-symbol-cache=FILE\n\
+                 keep the symbols of binaries with a build ID in FILE\n\
+                 across runs\n\
 "
 #endif
 "\
@@ -426,14 +477,20 @@ Statistics:\n\
 \n\
 Tampering:\n\
   -e inject=SET[:error=ERRNO|:retval=VALUE][:signal=SIG][:syscall=SYSCALL]\n\
-            [:delay_enter=DELAY][:delay_exit=DELAY][:when=WHEN],\n\
+            [:delay_enter=DELAY][:delay_exit=DELAY][:when=WHEN]\n\
+            [:probability=PERCENT],\n\
   --inject=SET[:error=ERRNO|:retval=VALUE][:signal=SIG][:syscall=SYSCALL]\n\
            [:delay_enter=DELAY][:delay_exit=DELAY][:when=WHEN]\n\
+           [:probability=PERCENT]\n\
                  perform syscall tampering for the syscalls in SET\n\
-     delay:      microseconds or NUMBER{s|ms|us|ns}\n\
+     delay:      TIME, uniform/MIN/MAX, exp/MEAN, lognormal/MEDIAN/SIGMA,\n\
+                 or hist/FILE with \"TIME WEIGHT\" lines, where TIME is\n\
+                 microseconds or NUMBER{s|ms|us|ns}\n\
      when:       FIRST[..LAST][+[STEP]]\n\
   -e fault=SET[:error=ERRNO][:when=WHEN], --fault=SET[:error=ERRNO][:when=WHEN]\n\
                  synonym for -e inject with default ERRNO set to ENOSYS.\n\
+  --inject-seed=SEED\n\
+                 seed the random delays and probabilities of injection\n\
 \n\
 Miscellaneous:\n\
   -d, --debug    enable debug output to stderr\n\
@@ -867,37 +924,40 @@ expand_tcbtab(void)
 
 	tcbtab = xgrowarray(tcbtab, &tcbtabsize, sizeof(tcbtab[0]));
 	newtcbs = xcalloc(tcbtabsize - old_tcbtabsize, sizeof(newtcbs[0]));
+	free_tcbs = xreallocarray(free_tcbs, tcbtabsize, sizeof(free_tcbs[0]));
 
 	for (tcb_ptr = tcbtab + old_tcbtabsize;
 	    tcb_ptr < tcbtab + tcbtabsize; tcb_ptr++, newtcbs++)
 		*tcb_ptr = newtcbs;
+
+	/* The new tcbs are to be taken in the order of tcbtab.  */
+	while (tcb_ptr > tcbtab + old_tcbtabsize)
+		free_tcbs[free_tcbs_count++] = *--tcb_ptr;
 }
 
 static struct tcb *
 alloctcb(int pid)
 {
-	unsigned int i;
 	struct tcb *tcp;
 
-	if (nprocs == tcbtabsize)
+	if (!free_tcbs_count)
 		expand_tcbtab();
 
-	for (i = 0; i < tcbtabsize; i++) {
-		tcp = tcbtab[i];
-		if (!tcp->pid) {
-			memset(tcp, 0, sizeof(*tcp));
-			list_init(&tcp->wait_list);
-			tcp->pid = pid;
+	tcp = free_tcbs[--free_tcbs_count];
+	if (tcp->pid)
+		error_msg_and_die("bug in alloctcb");
+
+	memset(tcp, 0, TCB_CLEARED_SIZE);
+	list_init(&tcp->wait_list);
+	tcp->pid = pid;
 #if SUPPORTED_PERSONALITIES > 1
-			tcp->currpers = current_personality;
+	tcp->currpers = current_personality;
 #endif
-			nprocs++;
-			debug_msg("new tcb for pid %d, active tcbs:%d",
-				  tcp->pid, nprocs);
-			return tcp;
-		}
-	}
-	error_msg_and_die("bug in alloctcb");
+	nprocs++;
+	/* The pid may have been used by an untraced process.  */
+	pidns_drop_pid(pid);
+	debug_msg("new tcb for pid %d, active tcbs:%d", tcp->pid, nprocs);
+	return tcp;
 }
 
 void *
@@ -945,11 +1005,14 @@ droptcb(struct tcb *tcp)
 			       "since attach", tcp->pid, ts_float(&dt));
 	}
 
-	int p;
-	for (p = 0; p < SUPPORTED_PERSONALITIES; ++p)
-		free(tcp->inject_vec[p]);
+	/* Keep the tampering state allocations for the next tcb.  */
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		if (tcp->inject_vec[p])
+			tcp->spare_inject_vec[p] = tcp->inject_vec[p];
+	}
 
 	free_tcb_priv_data(tcp);
+	tcb_arena_reset(tcp);
 
 #ifdef ENABLE_STACKTRACE
 	if (stack_trace_enabled)
@@ -963,6 +1026,16 @@ droptcb(struct tcb *tcp)
 	if (tcp->mmap_cache)
 		tcp->mmap_cache->free_fn(tcp, __func__);
 
+	if (syscall_delayed(tcp))
+		undelay_tcb(tcp);
+
+	pidns_drop_pid(tcp->pid);
+	proc_dir_drop(tcp->pid);
+	/* The leader is reaped after all the other threads of the group.  */
+	io_uring_drop_rings(tcp->pid);
+	if (capture_dir)
+		capture_drop_files(tcp->pid);
+
 	nprocs--;
 	debug_msg("dropped tcb for pid %d, %d remain", tcp->pid, nprocs);
 
@@ -991,7 +1064,8 @@ droptcb(struct tcb *tcp)
 
 	list_remove(&tcp->wait_list);
 
-	memset(tcp, 0, sizeof(*tcp));
+	memset(tcp, 0, TCB_CLEARED_SIZE);
+	free_tcbs[free_tcbs_count++] = tcp;
 }
 
 /* Detach traced process.
@@ -1196,14 +1270,11 @@ attach_tcb(struct tcb *const tcp)
 	after_successful_attach(tcp, TCB_GRABBED | post_attach_sigstop);
 	debug_msg("attach to pid %d (main) succeeded", tcp->pid);
 
-	static const char task_path[] = "/proc/%d/task";
-	char procdir[sizeof(task_path) + sizeof(int) * 3];
 	DIR *dir;
 	unsigned int ntid = 0, nerr = 0;
 
 	if (followfork && tcp->pid != strace_child &&
-	    xsprintf(procdir, task_path, get_proc_pid(tcp)) > 0 &&
-	    (dir = opendir(procdir)) != NULL) {
+	    (dir = proc_opendir(get_proc_pid(tcp), "task")) != NULL) {
 		struct_dirent *de;
 
 		while ((de = read_dir(dir)) != NULL) {
@@ -2033,11 +2104,23 @@ init(int argc, char *argv[])
 		GETOPT_OUTPUT_SEPARATELY,
 		GETOPT_TS,
 		GETOPT_PIDNS_TRANSLATION,
+		GETOPT_CAPTURE_DIR,
+		GETOPT_SAMPLE,
+		GETOPT_SAMPLE_TIME,
+		GETOPT_OVERHEAD_BUDGET,
+		GETOPT_INJECT_SEED,
+		GETOPT_KVM_STATS_INTERVAL,
+		GETOPT_STACK_TRACE_BACKEND,
+		GETOPT_STACK_TRACE_IDS,
+		GETOPT_STACK_TRACE_FOLDED,
+		GETOPT_STACK_TRACE_FOLDED_WEIGHT,
+		GETOPT_STACK_TRACE_SYMBOL_CACHE,
 
 		GETOPT_QUAL_TRACE,
 		GETOPT_QUAL_ABBREV,
 		GETOPT_QUAL_VERBOSE,
 		GETOPT_QUAL_RAW,
+		GETOPT_QUAL_ENTRY_ONLY,
 		GETOPT_QUAL_SIGNAL,
 		GETOPT_QUAL_STATUS,
 		GETOPT_QUAL_READ,
@@ -2066,6 +2149,17 @@ init(int argc, char *argv[])
 		{ "instruction-pointer", no_argument,      0, 'i' },
 		{ "interruptible",	required_argument, 0, 'I' },
 		{ "stack-traces",	no_argument,	   0, 'k' },
+		{ "stack-trace",	no_argument,	   0, 'k' },
+		{ "stack-trace-backend", required_argument, 0,
+			GETOPT_STACK_TRACE_BACKEND },
+		{ "stack-trace-ids",	no_argument,	   0,
+			GETOPT_STACK_TRACE_IDS },
+		{ "stack-trace-folded",	required_argument, 0,
+			GETOPT_STACK_TRACE_FOLDED },
+		{ "stack-trace-folded-weight", required_argument, 0,
+			GETOPT_STACK_TRACE_FOLDED_WEIGHT },
+		{ "stack-trace-symbol-cache", required_argument, 0,
+			GETOPT_STACK_TRACE_SYMBOL_CACHE },
 		{ "syscall-number",	no_argument,	   0, 'n' },
 		{ "output",		required_argument, 0, 'o' },
 		{ "summary-syscall-overhead", required_argument, 0, 'O' },
@@ -2085,6 +2179,14 @@ init(int argc, char *argv[])
 		{ "strings-in-hex",	optional_argument, 0, GETOPT_HEX_STR },
 		{ "const-print-style",	required_argument, 0, 'X' },
 		{ "pidns-translation",	no_argument      , 0, GETOPT_PIDNS_TRANSLATION },
+		{ "capture-dir",	required_argument, 0, GETOPT_CAPTURE_DIR },
+		{ "sample",	required_argument, 0, GETOPT_SAMPLE },
+		{ "sample-time",	required_argument, 0, GETOPT_SAMPLE_TIME },
+		{ "overhead-budget",	required_argument, 0,
+			GETOPT_OVERHEAD_BUDGET },
+		{ "inject-seed",	required_argument, 0, GETOPT_INJECT_SEED },
+		{ "kvm-stats-interval",	required_argument, 0,
+			GETOPT_KVM_STATS_INTERVAL },
 		{ "successful-only",	no_argument,	   0, 'z' },
 		{ "failed-only",	no_argument,	   0, 'Z' },
 		{ "failing-only",	no_argument,	   0, 'Z' },
@@ -2094,6 +2196,7 @@ init(int argc, char *argv[])
 		{ "abbrev",	required_argument, 0, GETOPT_QUAL_ABBREV },
 		{ "verbose",	required_argument, 0, GETOPT_QUAL_VERBOSE },
 		{ "raw",	required_argument, 0, GETOPT_QUAL_RAW },
+		{ "entry-only",	required_argument, 0, GETOPT_QUAL_ENTRY_ONLY },
 		{ "signals",	required_argument, 0, GETOPT_QUAL_SIGNAL },
 		{ "status",	required_argument, 0, GETOPT_QUAL_STATUS },
 		{ "read",	required_argument, 0, GETOPT_QUAL_READ },
@@ -2202,6 +2305,54 @@ init(int argc, char *argv[])
 			error_msg_and_die("Stack traces (-k/--stack-traces "
 					  "option) are not supported by this "
 					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_TRACE_BACKEND:
+#ifdef ENABLE_STACKTRACE
+			if (!unwind_set_backend(optarg))
+				error_opt_arg(c, lopt, optarg);
+#else
+			error_msg_and_die("Stack traces (-k/--stack-traces "
+					  "option) are not supported by this "
+					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_TRACE_IDS:
+#ifdef ENABLE_STACKTRACE
+			stack_trace_ids = true;
+#else
+			error_msg_and_die("Stack traces (-k/--stack-traces "
+					  "option) are not supported by this "
+					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_TRACE_FOLDED:
+#ifdef ENABLE_STACKTRACE
+			stack_trace_enabled = true;
+			stack_trace_folded = optarg;
+#else
+			error_msg_and_die("Stack traces (-k/--stack-traces "
+					  "option) are not supported by this "
+					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_TRACE_FOLDED_WEIGHT:
+#ifdef ENABLE_STACKTRACE
+			if (!unwind_set_folded_weight(optarg))
+				error_opt_arg(c, lopt, optarg);
+#else
+			error_msg_and_die("Stack traces (-k/--stack-traces "
+					  "option) are not supported by this "
+					  "build of strace");
+#endif
+			break;
+		case GETOPT_STACK_TRACE_SYMBOL_CACHE:
+#ifdef ENABLE_STACKTRACE
+			stack_trace_symbol_cache = optarg;
+#else
+			error_msg_and_die("Stack traces (-k/--stack-traces "
+					  "option) are not supported by this "
+					  "build of strace");
 #endif
 			break;
 		case 'n':
@@ -2304,6 +2455,34 @@ init(int argc, char *argv[])
 		case GETOPT_PIDNS_TRANSLATION:
 			pidns_translation++;
 			break;
+		case GETOPT_CAPTURE_DIR:
+			capture_dir = optarg;
+			break;
+		case GETOPT_SAMPLE:
+			if (!sample_set_rate(optarg))
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_SAMPLE_TIME:
+			if (!sample_set_time(optarg))
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_OVERHEAD_BUDGET:
+			if (!governor_set_budget(optarg))
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_INJECT_SEED:
+			if (!inject_set_seed(optarg))
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_KVM_STATS_INTERVAL:
+#ifdef HAVE_LINUX_KVM_H
+			if (!kvm_stats_set_interval(optarg))
+				error_opt_arg(c, lopt, optarg);
+#else
+			error_msg("--kvm-stats-interval option is not"
+				  " implemented for this architecture");
+#endif
+			break;
 		case 'z':
 			clear_number_set_array(status_set, 1);
 			add_number_to_set(STATUS_SUCCESSFUL, status_set);
@@ -2329,6 +2508,9 @@ init(int argc, char *argv[])
 		case GETOPT_QUAL_RAW:
 			qualify_raw(optarg);
 			break;
+		case GETOPT_QUAL_ENTRY_ONLY:
+			qualify_entry_only(optarg);
+			break;
 		case GETOPT_QUAL_SIGNAL:
 			qualify_signals(optarg);
 			break;
@@ -2472,6 +2654,11 @@ init(int argc, char *argv[])
 				   " (-c/--summary-only or -C/--summary)");
 	}
 
+	if (stack_trace_folded && !cflag) {
+		error_msg_and_help("--stack-trace-folded must be given with"
+				   " (-c/--summary-only or -C/--summary)");
+	}
+
 	if (sortby_set && !cflag) {
 		error_msg("-S/--summary-sort-by has no effect without"
 			  " (-c/--summary-only or -C/--summary)");
@@ -2481,7 +2668,7 @@ init(int argc, char *argv[])
 		if (iflag)
 			error_msg("-i/--instruction-pointer has no effect "
 				  "with -c/--summary-only");
-		if (stack_trace_enabled)
+		if (stack_trace_enabled && !stack_trace_folded)
 			error_msg("-k/--stack-traces has no effect "
 				  "with -c/--summary-only");
 		if (nflag)
@@ -2499,8 +2686,16 @@ init(int argc, char *argv[])
 		if (!number_set_array_is_empty(decode_fd_set, 0))
 			error_msg("-y/--decode-fds has no effect "
 				  "with -c/--summary-only");
+		if (capture_dir)
+			error_msg("--capture-dir has no effect "
+				  "with -c/--summary-only");
 	}
 
+	if (capture_dir && number_set_array_is_empty(read_set, 0) &&
+	    number_set_array_is_empty(write_set, 0))
+		error_msg("--capture-dir has no effect "
+			  "without -e read or -e write");
+
 	if (!outfname) {
 		if (output_separately && !followfork)
 			error_msg("--output-separately has no effect "
@@ -2536,6 +2731,15 @@ init(int argc, char *argv[])
 		unwind_init();
 #endif
 
+	if (capture_dir)
+		capture_init();
+
+	if (sampling_enabled)
+		sample_init();
+
+	if (overhead_budget)
+		governor_init();
+
 	/* See if they want to run as another user. */
 	if (username != NULL) {
 		struct passwd *pent;
@@ -2684,6 +2888,11 @@ init(int argc, char *argv[])
 	sigprocmask(SIG_BLOCK, &timer_set, NULL);
 	set_sighandler(SIGALRM, timer_sighandler, NULL);
 
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_folded)
+		set_sighandler(SIGUSR1, folded_dump_sighandler, NULL);
+#endif
+
 	if (nprocs != 0 || daemonized_tracer)
 		startup_attach();
 
@@ -2696,7 +2905,7 @@ init(int argc, char *argv[])
 		((followfork && !output_separately) || nprocs > 1);
 }
 
-static struct tcb *
+struct tcb *
 pid2tcb(const int pid)
 {
 	if (pid <= 0)
@@ -2743,12 +2952,49 @@ cleanup(int fatal_sig)
 	}
 }
 
+/* Detach all the tracees without killing any of them.  */
+void
+detach_all(void)
+{
+	for (unsigned int i = 0; i < tcbtabsize; i++) {
+		struct tcb *tcp = tcbtab[i];
+
+		if (tcp->pid)
+			detach(tcp);
+	}
+}
+
 static void
 interrupt(int sig)
 {
 	interrupted = sig;
 }
 
+#ifdef ENABLE_STACKTRACE
+static void
+folded_dump_sighandler(int sig)
+{
+	folded_dump_requested = 1;
+}
+#endif
+
+#ifdef HAVE_LINUX_KVM_H
+static void
+print_kvm_stats(void)
+{
+	/* The summary must not be printed in the middle of a line.  */
+	if (printing_tcp && printing_tcp->curcol != 0 &&
+	    !printing_tcp->staged_output_data && !output_separately) {
+		set_current_tcp(printing_tcp);
+		tprints(" <unfinished ...>\n");
+		printing_tcp->curcol = 0;
+		printing_tcp = NULL;
+	}
+	kvm_stats_summary(shared_log);
+	fflush(shared_log);
+}
+#endif
+
 static void
 print_debug_info(const int pid, int status)
 {
@@ -2792,8 +3038,12 @@ static struct tcb *
 maybe_allocate_tcb(const int pid, int status)
 {
 	if (!WIFSTOPPED(status)) {
-		if (detach_on_execve && pid == strace_child) {
-			/* example: strace -bexecve sh -c 'exec true' */
+		if (pid == strace_child) {
+			/*
+			 * The child has been detached, examples:
+			 * strace -bexecve sh -c 'exec true'
+			 * strace --overhead-budget=1 with a busy child
+			 */
 			strace_child = 0;
 			return NULL;
 		}
@@ -2889,6 +3139,7 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	droptcb(tcp);
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
+	proc_dir_drop(tcp->pid);
 	tcp->pid = pid;
 	if (cflag != CFLAG_ONLY_STATS) {
 		if (!is_number_in_set(QUIET_THREAD_EXECVE, quiet_set)) {
@@ -2970,7 +3221,7 @@ print_stopped(struct tcb *tcp, const siginfo_t *si, const unsigned int sig)
 		line_ended();
 
 #ifdef ENABLE_STACKTRACE
-		if (stack_trace_enabled)
+		if (stack_trace_enabled && !stack_trace_suspended)
 			unwind_tcb_print(tcp);
 #endif
 	}
@@ -3005,7 +3256,7 @@ startup_tcb(struct tcb *tcp)
 static void
 print_event_exit(struct tcb *tcp)
 {
-	if (entering(tcp) || filtered(tcp) || hide_log(tcp)
+	if (entering(tcp) || filtered(tcp) || exit_skipped(tcp) || hide_log(tcp)
 	    || cflag == CFLAG_ONLY_STATS) {
 		return;
 	}
@@ -3088,6 +3339,18 @@ next_event(void)
 	if (interrupted)
 		return NULL;
 
+#ifdef ENABLE_STACKTRACE
+	if (folded_dump_requested) {
+		folded_dump_requested = 0;
+		unwind_folded_dump();
+	}
+#endif
+
+#ifdef HAVE_LINUX_KVM_H
+	if (kvm_stats_report_due())
+		print_kvm_stats();
+#endif
+
 	invalidate_umove_cache();
 
 	struct tcb *tcp = NULL;
@@ -3153,9 +3416,16 @@ next_event(void)
 	 */
 	int status;
 	struct rusage ru;
+
+	if (overhead_budget)
+		governor_idle_begin();
+
 	int pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
 	int wait_errno = errno;
 
+	if (overhead_budget)
+		governor_idle_end();
+
 	/*
 	 * The window of opportunity to handle expirations
 	 * of the delay timer closes here.
@@ -3381,6 +3651,12 @@ trace_syscall(struct tcb *tcp, unsigned int *sig)
 		syscall_entering_finish(tcp, res);
 		return res;
 	} else {
+		/* The syscall has been printed on entry.  */
+		if (exit_skipped(tcp)) {
+			syscall_exiting_finish(tcp);
+			return 0;
+		}
+
 		struct timespec ts = {};
 		int res = syscall_exiting_decode(tcp, &ts);
 		if (res != 0) {
@@ -3488,7 +3764,12 @@ dispatch_event(const struct tcb_wait_data *wd)
 			 * Note that exiting(current_tcp) actually marks
 			 * a syscall-entry-stop because the flag was inverted
 			 * in the above call to trace_syscall.
+			 *
+			 * If the syscall has been printed on entry already,
+			 * its syscall-exit-stop is skipped as well.
 			 */
+			if (exiting(current_tcp) && exit_skipped(current_tcp))
+				syscall_exiting_finish(current_tcp);
 			restart_op = exiting(current_tcp) ? PTRACE_SYSCALL : PTRACE_CONT;
 		}
 		break;
@@ -3534,7 +3815,8 @@ dispatch_event(const struct tcb_wait_data *wd)
 		 * and all the following syscall state tracking is screwed up
 		 * otherwise.
 		 */
-		if (!maybe_switch_current_tcp() && entering(current_tcp)) {
+		if (!maybe_switch_current_tcp() && entering(current_tcp)
+		    && !exit_skipped(current_tcp)) {
 			int ret;
 
 			error_msg("Stray PTRACE_EVENT_EXEC from pid %d"
@@ -3551,6 +3833,9 @@ dispatch_event(const struct tcb_wait_data *wd)
 			}
 		}
 
+		proc_dir_drop(current_tcp->pid);
+		io_uring_drop_rings(current_tcp->pid);
+
 		if (detach_on_execve) {
 			if (current_tcp->flags & TCB_SKIP_DETACH_ON_FIRST_EXEC) {
 				current_tcp->flags &= ~TCB_SKIP_DETACH_ON_FIRST_EXEC;
@@ -3620,31 +3905,17 @@ restart_delayed_tcb(struct tcb *const tcp)
 static bool
 restart_delayed_tcbs(void)
 {
-	struct tcb *tcp_next = NULL;
+	struct tcb *tcp;
 	struct timespec ts_now;
 
 	clock_gettime(CLOCK_MONOTONIC, &ts_now);
 
-	for (size_t i = 0; i < tcbtabsize; i++) {
-		struct tcb *tcp = tcbtab[i];
-
-		if (tcp->pid && syscall_delayed(tcp)) {
-			if (ts_cmp(&ts_now, &tcp->delay_expiration_time) > 0) {
-				if (!restart_delayed_tcb(tcp))
-					return false;
-			} else {
-				/* Check whether this tcb is the next.  */
-				if (!tcp_next ||
-				    ts_cmp(&tcp_next->delay_expiration_time,
-					   &tcp->delay_expiration_time) > 0) {
-					tcp_next = tcp;
-				}
-			}
-		}
+	while ((tcp = pop_expired_delayed_tcb(&ts_now))) {
+		if (!restart_delayed_tcb(tcp))
+			return false;
 	}
 
-	if (tcp_next)
-		arm_delay_timer(tcp_next);
+	arm_delay_timer();
 
 	return true;
 }
@@ -3678,6 +3949,16 @@ terminate(void)
 	cleanup(sig);
 	if (cflag)
 		call_summary(shared_log);
+#ifdef HAVE_LINUX_KVM_H
+	if (kvm_stats_enabled)
+		kvm_stats_summary(shared_log);
+#endif
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_folded)
+		unwind_folded_dump();
+	if (stack_trace_enabled)
+		unwind_fin();
+#endif
 	fflush(NULL);
 	if (shared_log != stderr)
 		fclose(shared_log);
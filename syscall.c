@@ -23,6 +23,12 @@
 #include "delay.h"
 #include "retval.h"
 #include <limits.h>
+#ifdef HAVE_LINUX_CLOSE_RANGE_H
+# include <linux/close_range.h>
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+# define CLOSE_RANGE_CLOEXEC	(1U << 2)
+#endif
 
 /* for struct iovec */
 #include <sys/uio.h>
@@ -489,8 +495,12 @@ static long
 tamper_with_syscall_entering(struct tcb *tcp, unsigned int *signo)
 {
 	if (!tcp->inject_vec[current_personality]) {
+		struct inject_opts **const spare =
+			&tcp->spare_inject_vec[current_personality];
+
 		tcp->inject_vec[current_personality] =
-			xcalloc(nsyscalls, sizeof(**inject_vec));
+			*spare ?: xcalloc(nsyscalls, sizeof(**inject_vec));
+		*spare = NULL;
 		memcpy(tcp->inject_vec[current_personality],
 		       inject_vec[current_personality],
 		       nsyscalls * sizeof(**inject_vec));
@@ -511,6 +521,9 @@ tamper_with_syscall_entering(struct tcb *tcp, unsigned int *signo)
 
 	opts->first = opts->step;
 
+	if (!inject_chance(opts->data.probability))
+		return 0;
+
 	if (!recovering(tcp)) {
 		if (opts->data.flags & INJECT_F_SIGNAL)
 			*signo = opts->data.signo;
@@ -590,6 +603,8 @@ tamper_with_syscall_exiting(struct tcb *tcp)
 int
 syscall_entering_decode(struct tcb *tcp)
 {
+	tcp->flags &= ~TCB_SKIP_EXIT;
+
 	int res = get_scno(tcp);
 	if (res == 0)
 		return res;
@@ -626,6 +641,82 @@ syscall_entering_decode(struct tcb *tcp)
 	return 1;
 }
 
+static void
+print_stack_trace(struct tcb *tcp)
+{
+#ifdef ENABLE_STACKTRACE
+	/* A stack trace captured on entry is printed even if suspended since.  */
+	if (stack_trace_enabled
+	    && (!stack_trace_suspended || unwind_tcb_captured(tcp)))
+		unwind_tcb_print(tcp);
+#endif
+}
+
+/* Called instead of print_stack_trace when the syscall is not printed.  */
+static void
+discard_stack_trace(struct tcb *tcp)
+{
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_enabled)
+		unwind_tcb_discard(tcp);
+#endif
+}
+
+/*
+ * Returns true if the result of the syscall is needed
+ * in syscall_exiting_decode even if the syscall is filtered out.
+ */
+static bool
+exit_notify_needed(struct tcb *tcp)
+{
+	if ((tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
+	    && mmap_notify_has_clients())
+		return true;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_bind:
+	case SEN_connect:
+	case SEN_listen:
+		return sockaddr_cache_has_entries();
+	case SEN_io_uring_setup:
+		return true;
+	case SEN_io_uring_enter:
+	case SEN_mmap:
+	case SEN_mmap_pgoff:
+	case SEN_mmap_4koff:
+	/* The rings of the descriptors being closed are forgotten.  */
+	case SEN_close:
+	case SEN_close_range:
+	case SEN_dup2:
+	case SEN_dup3:
+		return io_uring_has_rings();
+#ifdef HAVE_LINUX_KVM_H
+	case SEN_ioctl:
+		return kvm_stats_enabled;
+#endif
+	}
+
+	return false;
+}
+
+/*
+ * Returns true if the syscall has been printed completely on entry
+ * and nothing is left to be done on its exit but printing the result.
+ */
+static bool
+can_skip_exit(struct tcb *tcp, const int res)
+{
+	if (!entry_only(tcp) || !(res & RVAL_DECODED) || inject(tcp)
+	    || check_exec_syscall(tcp) || cflag || Tflag
+	    || !is_complete_set(status_set, NUMBER_OF_STATUSES)
+	    || exit_notify_needed(tcp))
+		return false;
+
+	/* The data are dumped on exit.  */
+	return !is_number_in_set(tcp->u_arg[0], read_set)
+	       && !is_number_in_set(tcp->u_arg[0], write_set);
+}
+
 int
 syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 {
@@ -657,6 +748,17 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 		return 0;
 	}
 
+	/*
+	 * The syscalls that are not sampled are filtered out,
+	 * and their exit is not waited for if it is not needed.
+	 */
+	if (!syscall_sampled()) {
+		tcp->flags |= TCB_FILTERED;
+		if (!exit_notify_needed(tcp))
+			tcp->flags |= TCB_SKIP_EXIT;
+		return 0;
+	}
+
 	tcp->flags &= ~TCB_FILTERED;
 
 	if (inject(tcp))
@@ -667,7 +769,7 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	}
 
 #ifdef ENABLE_STACKTRACE
-	if (stack_trace_enabled &&
+	if (stack_trace_enabled && !stack_trace_suspended &&
 	    !check_exec_syscall(tcp) &&
 	    tcp_sysent(tcp)->sys_flags & STACKTRACE_CAPTURE_ON_ENTER) {
 		unwind_tcb_capture(tcp);
@@ -680,6 +782,15 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	printleader(tcp);
 	tprintf("%s(", tcp_sysent(tcp)->sys_name);
 	int res = raw(tcp) ? printargs(tcp) : tcp_sysent(tcp)->sys_func(tcp);
+
+	if (can_skip_exit(tcp, res)) {
+		tcp->flags |= TCB_SKIP_EXIT;
+		tprints(") ");
+		tabto();
+		tprints("= ?\n");
+		line_ended();
+		print_stack_trace(tcp);
+	}
 	fflush(tcp->outf);
 	return res;
 }
@@ -710,6 +821,11 @@ syscall_entering_finish(struct tcb *tcp, int res)
 
 		tcp->ltime = tcp->stime;
 	}
+
+#ifdef HAVE_LINUX_KVM_H
+	if (kvm_stats_enabled && tcp_sysent(tcp)->sen == SEN_ioctl)
+		kvm_run_enter_notify(tcp);
+#endif
 }
 
 /* Returns:
@@ -727,8 +843,80 @@ syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 	if ((Tflag || cflag) && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, pts);
 
-	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
-		mmap_notify_report(tcp);
+	/*
+	 * Fetch the result before notifying: mmap_notify clients
+	 * update their state in place from the arguments and the result
+	 * of the syscall, even if the syscall itself is filtered out.
+	 */
+	if ((tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
+	    && mmap_notify_has_clients())
+		mmap_notify_report(tcp, get_syscall_result(tcp) == 1);
+
+	switch (tcp_sysent(tcp)->sen) {
+	/* Socket details cached by inode could become stale.  */
+	case SEN_bind:
+	case SEN_connect:
+	case SEN_listen:
+		invalidate_sockaddr_by_fd(tcp, tcp->u_arg[0]);
+		break;
+	/*
+	 * io_uring rings are learnt even if their setup is filtered out,
+	 * to decode the ring entries of a traced io_uring_enter.
+	 */
+	case SEN_io_uring_setup:
+		if (get_syscall_result(tcp) == 1)
+			io_uring_setup_notify(tcp);
+		break;
+	case SEN_mmap:
+		if (io_uring_is_ring_fd(tcp, tcp->u_arg[4]) &&
+		    get_syscall_result(tcp) == 1)
+			io_uring_mmap_notify(tcp, tcp->u_arg[5]);
+		break;
+	case SEN_mmap_pgoff:
+		if (io_uring_is_ring_fd(tcp, tcp->u_arg[4]) &&
+		    get_syscall_result(tcp) == 1)
+			io_uring_mmap_notify(tcp, (unsigned long long)
+						  tcp->u_arg[5]
+						  * get_pagesize());
+		break;
+	case SEN_mmap_4koff:
+		if (io_uring_is_ring_fd(tcp, tcp->u_arg[4]) &&
+		    get_syscall_result(tcp) == 1)
+			io_uring_mmap_notify(tcp, (unsigned long long)
+						  tcp->u_arg[5] << 12);
+		break;
+	case SEN_io_uring_enter:
+		if (io_uring_has_rings() && !filtered(tcp) &&
+		    get_syscall_result(tcp) == 1)
+			io_uring_enter_notify(tcp);
+		break;
+	/* The descriptor is closed even if close fails.  */
+	case SEN_close:
+		io_uring_close_notify(tcp, tcp->u_arg[0], tcp->u_arg[0]);
+		break;
+	/* CLOSE_RANGE_CLOEXEC leaves the descriptors open.  */
+	case SEN_close_range:
+		if (!(tcp->u_arg[2] & CLOSE_RANGE_CLOEXEC) &&
+		    get_syscall_result(tcp) == 1 && !syserror(tcp))
+			io_uring_close_notify(tcp, tcp->u_arg[0],
+					      tcp->u_arg[1]);
+		break;
+	/* A failed dup2 or dup3 leaves newfd as it is.  */
+	case SEN_dup2:
+	case SEN_dup3:
+		if (tcp->u_arg[0] != tcp->u_arg[1] &&
+		    get_syscall_result(tcp) == 1 && !syserror(tcp))
+			io_uring_close_notify(tcp, tcp->u_arg[1],
+					      tcp->u_arg[1]);
+		break;
+#ifdef HAVE_LINUX_KVM_H
+	/* KVM_RUN exits are counted even if the ioctl is filtered out.  */
+	case SEN_ioctl:
+		if (kvm_stats_enabled && get_syscall_result(tcp) == 1)
+			kvm_run_exit_notify(tcp);
+		break;
+#endif
+	}
 
 	if (filtered(tcp))
 		return 0;
@@ -793,6 +981,7 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 			strace_close_memstream(tcp, publish);
 		}
 		line_ended();
+		discard_stack_trace(tcp);
 		return res;
 	}
 	tcp->s_prev_ent = tcp->s_ent;
@@ -815,6 +1004,7 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 		strace_close_memstream(tcp, publish);
 		if (!publish) {
 			line_ended();
+			discard_stack_trace(tcp);
 			return 0;
 		}
 	}
@@ -981,11 +1171,8 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	tprints("\n");
 	dumpio(tcp);
 	line_ended();
+	print_stack_trace(tcp);
 
-#ifdef ENABLE_STACKTRACE
-	if (stack_trace_enabled)
-		unwind_tcb_print(tcp);
-#endif
 	return 0;
 }
 
@@ -995,6 +1182,7 @@ syscall_exiting_finish(struct tcb *tcp)
 	tcp->flags &= ~(TCB_INSYSCALL | TCB_TAMPERED | TCB_INJECT_DELAY_EXIT);
 	tcp->sys_func_rval = 0;
 	free_tcb_priv_data(tcp);
+	tcb_arena_reset(tcp);
 
 	if (cflag)
 		tcp->ltime = tcp->stime;
@@ -1225,11 +1413,10 @@ struct sysent_buf {
 };
 
 static void
-free_sysent_buf(void *ptr)
+clear_sysent_buf(void *ptr)
 {
 	struct sysent_buf *s = ptr;
 	s->tcp->s_prev_ent = s->tcp->s_ent = NULL;
-	free(ptr);
 }
 
 static bool
@@ -1326,6 +1513,30 @@ get_stack_pointer(struct tcb *tcp, kernel_ulong_t *sp)
 #endif
 }
 
+#if HAVE_ARCH_FRAME_POINTER
+bool
+get_frame_pointer(struct tcb *tcp, kernel_ulong_t *fp)
+{
+	if (get_regs(tcp) < 0)
+		return false;
+	*fp = (kernel_ulong_t) ARCH_FP_REG;
+	return true;
+}
+
+bool
+get_link_register(struct tcb *tcp, kernel_ulong_t *lr)
+{
+# if defined ARCH_LR_REG
+	if (get_regs(tcp) < 0)
+		return false;
+	*lr = (kernel_ulong_t) ARCH_LR_REG;
+	return true;
+# else
+	return false;
+# endif
+}
+#endif /* HAVE_ARCH_FRAME_POINTER */
+
 static int
 get_syscall_regs(struct tcb *tcp)
 {
@@ -1383,7 +1594,7 @@ get_scno(struct tcb *tcp)
 		tcp->s_ent = &sysent[tcp->scno];
 		tcp->qual_flg = qual_flags(tcp->scno);
 	} else {
-		struct sysent_buf *s = xzalloc(sizeof(*s));
+		struct sysent_buf *s = tcb_zalloc(tcp, sizeof(*s));
 
 		s->tcp = tcp;
 		s->ent = stub_sysent;
@@ -1392,7 +1603,7 @@ get_scno(struct tcb *tcp)
 
 		tcp->s_ent = &s->ent;
 
-		set_tcb_priv_data(tcp, s, free_sysent_buf);
+		set_tcb_priv_data(tcp, s, clear_sysent_buf);
 
 		debug_msg("pid %d invalid syscall %#" PRI_klx,
 			  tcp->pid, shuffle_scno(tcp->scno));
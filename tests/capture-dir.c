@@ -0,0 +1,66 @@
+/*
+ * Check --capture-dir.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/* The data is checked by capture-dir.test.  */
+static const char data0[] = "0123456789abcdef";
+static const char data1[] = "\0\1\2\3";
+static const char data2[] = "\377 end\n";
+
+int
+main(void)
+{
+	int fds[2];
+	char buf[64];
+	const int pid = getpid();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		perror_msg_and_skip("socketpair");
+	if (dup2(fds[0], 5) != 5 || dup2(fds[1], 6) != 6)
+		perror_msg_and_fail("dup2");
+
+	if (sendto(6, data0, sizeof(data0) - 1, 0, NULL, 0) !=
+	    sizeof(data0) - 1)
+		perror_msg_and_fail("sendto");
+	printf("sendto(6, \"%s\", %u, 0, NULL, 0) = %u\n"
+	       " | %u bytes captured to %d.6 at offset 0\n",
+	       data0, (unsigned int) sizeof(data0) - 1,
+	       (unsigned int) sizeof(data0) - 1,
+	       (unsigned int) sizeof(data0) - 1, pid);
+
+	const struct iovec iov[] = {
+		{ .iov_base = (void *) data1, .iov_len = sizeof(data1) - 1 },
+		{ .iov_base = (void *) data2, .iov_len = sizeof(data2) - 1 },
+	};
+	if (writev(6, iov, 2) != 10)
+		perror_msg_and_fail("writev");
+	printf("writev(6, [{iov_base=\"\\0\\1\\2\\3\", iov_len=4}"
+	       ", {iov_base=\"\\377 end\\n\", iov_len=6}], 2) = 10\n"
+	       " * 4 bytes in buffer 0\n"
+	       " | 4 bytes captured to %d.6 at offset 16\n"
+	       " * 6 bytes in buffer 1\n"
+	       " | 6 bytes captured to %d.6 at offset 20\n",
+	       pid, pid);
+
+	if (recvfrom(5, buf, sizeof(buf), 0, NULL, NULL) != 26)
+		perror_msg_and_fail("recvfrom");
+	printf("recvfrom(5, \"%s\\0\\1\\2\\3\\377 end\\n\", %u, 0, NULL, NULL)"
+	       " = 26\n"
+	       " | 26 bytes captured to %d.5 at offset 0\n",
+	       data0, (unsigned int) sizeof(buf), pid);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
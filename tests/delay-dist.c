@@ -0,0 +1,24 @@
+/*
+ * Make the given number of getppid syscalls.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+int
+main(int ac, char **av)
+{
+	if (ac != 2)
+		error_msg_and_fail("usage: delay-dist count");
+
+	for (int i = atoi(av[1]); i > 0; --i)
+		getppid();
+
+	return 0;
+}
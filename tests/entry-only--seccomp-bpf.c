@@ -0,0 +1 @@
+#include "entry-only.c"
@@ -0,0 +1,33 @@
+/*
+ * Check -e entry-only=SET syscall printing.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+#include <stdio.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	static const char sample_valid[] = ".";
+	static const char sample_invalid[] = "";
+
+	syscall(__NR_chdir, sample_valid);
+	printf("chdir(\"%s\") = ?\n", sample_valid);
+
+	syscall(__NR_chdir, sample_invalid);
+	printf("chdir(\"%s\") = ?\n", sample_invalid);
+
+	/* The syscalls that are not in the set are printed as usual.  */
+	long rc = syscall(__NR_fchdir, -1);
+	printf("fchdir(-1) = %s\n", sprintrc(rc));
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
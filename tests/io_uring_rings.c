@@ -0,0 +1,128 @@
+/*
+ * Check decoding of io_uring submission and completion queue entries.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <unistd.h>
+#include "scno.h"
+
+#if defined HAVE_LINUX_IO_URING_H && defined __NR_io_uring_setup \
+ && defined __NR_io_uring_enter
+
+# include <fcntl.h>
+# include <stdio.h>
+# include <stdint.h>
+# include <string.h>
+# include <sys/mman.h>
+# include <sys/uio.h>
+# include <linux/io_uring.h>
+
+static const char path[] = "/dev/zero";
+static char buf[16];
+static struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+static struct io_uring_params params;
+static char *sq_ring;
+static struct io_uring_sqe *sqes;
+
+static void
+submit(unsigned int opcode, int fd, unsigned int len, uint64_t user_data)
+{
+	uint32_t *const tail = (uint32_t *) (sq_ring + params.sq_off.tail);
+	uint32_t *const array = (uint32_t *) (sq_ring + params.sq_off.array);
+	const uint32_t idx = *tail & (params.sq_entries - 1);
+
+	memset(&sqes[idx], 0, sizeof(sqes[idx]));
+	sqes[idx].opcode = opcode;
+	sqes[idx].fd = fd;
+	sqes[idx].addr = (uintptr_t) &iov;
+	sqes[idx].len = len;
+	sqes[idx].user_data = user_data;
+	array[idx] = idx;
+	__atomic_store_n(tail, *tail + 1, __ATOMIC_RELEASE);
+}
+
+static void
+enter(int ring_fd, const char *const sqes_str, const char *const cqes_str)
+{
+	long rc = syscall(__NR_io_uring_enter, ring_fd, 2, 2,
+			  IORING_ENTER_GETEVENTS, NULL, 0);
+	if (rc != 2)
+		perror_msg_and_skip("io_uring_enter");
+
+	printf("io_uring_enter(%d<anon_inode:[io_uring]>, 2, 2"
+	       ", IORING_ENTER_GETEVENTS, NULL, 0 => {sqes=%s, cqes=%s}) = 2\n",
+	       ring_fd, sqes_str, cqes_str);
+
+	uint32_t *const cq_head = (uint32_t *) (sq_ring + params.cq_off.head);
+	*cq_head = *(uint32_t *) (sq_ring + params.cq_off.tail);
+}
+
+int
+main(void)
+{
+	skip_if_unavailable("/proc/self/fd/");
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", path);
+
+	int ring_fd = syscall(__NR_io_uring_setup, 4, &params);
+	if (ring_fd < 0)
+		perror_msg_and_skip("io_uring_setup");
+
+	/* The CQ ring shares the pages of the SQ ring.  */
+	sq_ring = mmap(NULL, params.cq_off.cqes +
+			     params.cq_entries * sizeof(struct io_uring_cqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd,
+		       IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+		perror_msg_and_skip("mmap");
+	sqes = mmap(NULL, params.sq_entries * sizeof(*sqes),
+		    PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd,
+		    IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		perror_msg_and_skip("mmap");
+
+	char sqes_str[512];
+	char cqes_str[256];
+
+	submit(IORING_OP_NOP, -1, 0, 0);
+	submit(IORING_OP_READV, fd, 1, 0xfacefeed);
+	snprintf(sqes_str, sizeof(sqes_str),
+		 "[{opcode=IORING_OP_NOP, flags=0, fd=-1, off=0, addr=%p"
+		 ", len=0, user_data=0}, {opcode=IORING_OP_READV, flags=0"
+		 ", fd=%d<%s>, off=0, addr=%p, len=1, user_data=0xfacefeed}]",
+		 &iov, fd, path, &iov);
+	snprintf(cqes_str, sizeof(cqes_str),
+		 "[{user_data=0, res=0, flags=0}"
+		 ", {user_data=0xfacefeed, res=%u, flags=0}]",
+		 (unsigned int) sizeof(buf));
+	enter(ring_fd, sqes_str, cqes_str);
+
+	submit(IORING_OP_NOP, -1, 0, 1);
+	submit(IORING_OP_READV, 1000, 1, 2);
+	snprintf(sqes_str, sizeof(sqes_str),
+		 "[{opcode=IORING_OP_NOP, flags=0, fd=-1, off=0, addr=%p"
+		 ", len=0, user_data=0x1}, {opcode=IORING_OP_READV, flags=0"
+		 ", fd=1000, off=0, addr=%p, len=1, user_data=0x2}]",
+		 &iov, &iov);
+	enter(ring_fd, sqes_str,
+	      "[{user_data=0x1, res=0, flags=0}"
+	      ", {user_data=0x2, res=-EBADF, flags=0}]");
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("HAVE_LINUX_IO_URING_H && __NR_io_uring_setup"
+		    " && __NR_io_uring_enter")
+
+#endif
@@ -0,0 +1,27 @@
+/*
+ * Make syscalls in a loop for the given number of seconds.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+int
+main(int ac, char **av)
+{
+	if (ac != 2)
+		error_msg_and_fail("usage: overhead-budget seconds");
+
+	const time_t end = time(NULL) + atoi(av[1]);
+
+	while (time(NULL) < end)
+		getppid();
+
+	return 0;
+}
@@ -0,0 +1,2 @@
+#define XFLAG 1
+#include "quote-long.c"
@@ -0,0 +1,2 @@
+#define XFLAG 2
+#include "quote-long.c"
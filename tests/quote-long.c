@@ -0,0 +1,71 @@
+/*
+ * Check quoting of strings longer than the chunks string_quote
+ * processes at once, with each byte value at each position.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifndef XFLAG
+# define XFLAG 0
+#endif
+
+#define TEXT_SIZE 40
+
+static bool
+is_text(const unsigned char c)
+{
+	return (c >= ' ' && c < 0x7f) || (c >= '\t' && c <= '\r');
+}
+
+static void
+print_quoted(const char *const str, const size_t size)
+{
+	bool hex = XFLAG > 1;
+
+	for (size_t i = 0; !hex && XFLAG && i < size; ++i)
+		hex = !is_text(str[i]);
+
+	if (hex)
+		print_quoted_hex(str, size);
+	else
+		print_quoted_memory(str, size);
+}
+
+int
+main(void)
+{
+	static const char text[] = "0123456789\"abcdef\\ghijk\tlmnop q";
+	char *const buf = tail_alloc(TEXT_SIZE + 1);
+	const char *rc_str;
+
+	for (unsigned int c = 0; c < 0x100; ++c) {
+		for (unsigned int pos = 0; pos < TEXT_SIZE; ++pos) {
+			for (unsigned int i = 0; i < TEXT_SIZE; ++i)
+				buf[i] = text[(i + c) % (sizeof(text) - 1)];
+			buf[pos] = c;
+			buf[TEXT_SIZE] = '\0';
+
+			rc_str = sprintrc(pwrite(-1, buf, TEXT_SIZE, 0));
+			printf("pwrite64(-1, ");
+			print_quoted(buf, TEXT_SIZE);
+			printf(", %u, 0) = %s\n", TEXT_SIZE, rc_str);
+
+			rc_str = sprintrc(chdir(buf));
+			printf("chdir(");
+			print_quoted(buf, strlen(buf));
+			printf(") = %s\n", rc_str);
+		}
+	}
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Check --sample=1/N syscall sampling.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+#include <stdio.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	static const char *const paths[] = {
+		"sample-0", "sample-1", "sample-2", "sample-3",
+		"sample-4", "sample-5", "sample-6", "sample-7",
+		"sample-8", "sample-9", "sample-10", "sample-11",
+	};
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(paths); ++i) {
+		long rc = syscall(__NR_chdir, paths[i]);
+
+		/* Every 4th chdir starting with the first one is traced.  */
+		if (i % 4 == 0)
+			printf("chdir(\"%s\") = %s\n", paths[i], sprintrc(rc));
+	}
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
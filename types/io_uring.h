@@ -49,6 +49,28 @@ typedef struct {
 	struct_io_cqring_offsets cq_off;
 } struct_io_uring_params;
 
+typedef struct {
+	uint8_t  opcode;
+	uint8_t  flags;		/* IOSQE_* flags */
+	uint16_t ioprio;
+	int32_t  fd;
+	uint64_t off;
+	uint64_t addr;
+	uint32_t len;
+	uint32_t op_flags;	/* rw_flags, fsync_flags, etc. */
+	uint64_t user_data;
+	uint16_t buf_index;
+	uint16_t personality;
+	int32_t  splice_fd_in;
+	uint64_t __pad2[2];
+} struct_io_uring_sqe;
+
+typedef struct {
+	uint64_t user_data;
+	int32_t  res;
+	uint32_t flags;		/* IORING_CQE_F_* flags */
+} struct_io_uring_cqe;
+
 typedef struct {
 	uint32_t offset;
 	uint32_t resv;
@@ -63,10 +63,20 @@ process_read_mem(const pid_t pid, void *const laddr,
 static int cached_idx = -1;
 static unsigned long cached_raddr[4];
 
+/* A range of the tracee memory read in advance by umove_prefetch.  */
+static struct {
+	pid_t pid;
+	kernel_ulong_t addr;
+	unsigned int len;
+	unsigned int size;
+	char *buf;
+} prefetched;
+
 void
 invalidate_umove_cache(void)
 {
 	cached_idx = -1;
+	prefetched.len = 0;
 }
 
 static int
@@ -106,6 +116,23 @@ vm_read_mem(const pid_t pid, void *laddr,
 	if (!len)
 		return len;
 
+	if (prefetched.len && pid == prefetched.pid &&
+	    kraddr >= prefetched.addr &&
+	    kraddr - prefetched.addr < prefetched.len) {
+		const unsigned int offset = kraddr - prefetched.addr;
+		const size_t copy_len = MIN(len, prefetched.len - offset);
+
+		memcpy(laddr, prefetched.buf + offset, copy_len);
+		if (copy_len == len)
+			return len;
+
+		/* The rest is read the usual way.  */
+		const ssize_t rc = vm_read_mem(pid, laddr + copy_len,
+					       kraddr + copy_len,
+					       len - copy_len);
+		return rc < 0 ? (ssize_t) copy_len : (ssize_t) copy_len + rc;
+	}
+
 	unsigned long taddr = kraddr;
 
 #if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
@@ -277,6 +304,133 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 	}
 }
 
+/*
+ * Read the accessible part of the given range with a single
+ * process_vm_readv call, the range is split at page boundaries
+ * as partial transfers happen at the granularity of iovec elements.
+ */
+static ssize_t
+vm_readv_partial(const int pid, const kernel_ulong_t addr,
+		 const unsigned int len, void *const our_addr)
+{
+	const unsigned long page_size = get_pagesize();
+	struct iovec remote[64];
+	unsigned long raddr = addr;
+	unsigned int n = 0;
+
+#if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
+	if (addr != (kernel_ulong_t) raddr) {
+		errno = EFAULT;
+		return -1;
+	}
+#endif
+	for (unsigned int left = len; left && n < ARRAY_SIZE(remote); ++n) {
+		const unsigned long chunk =
+			MIN(page_size - (raddr & (page_size - 1)), left);
+
+		remote[n].iov_base = (void *) raddr;
+		remote[n].iov_len = chunk;
+		raddr += chunk;
+		left -= chunk;
+	}
+
+	const struct iovec local = {
+		.iov_base = our_addr,
+		.iov_len = raddr - (unsigned long) addr
+	};
+
+	const ssize_t rc = process_vm_readv(pid, &local, 1, remote, n, 0);
+	if (rc < 0 && errno == ENOSYS)
+		process_vm_readv_not_supported = true;
+
+	return rc;
+}
+
+/*
+ * Like umoven, but a read that runs into an inaccessible page
+ * is not an error: the accessible part is copied with a single
+ * process_vm_readv call, and its length is returned.
+ */
+int
+umoven_partial(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	       void *const our_addr)
+{
+	if (tracee_addr_is_invalid(addr))
+		return -1;
+
+	const int pid = tcp->pid;
+	const unsigned long page_size = get_pagesize();
+
+	if (!process_vm_readv_not_supported) {
+		const ssize_t rc = vm_readv_partial(pid, addr, len, our_addr);
+		if (rc > 0)
+			return rc;
+		if (rc == 0)
+			return -1;
+
+		switch (errno) {
+			case ENOSYS:
+			case EPERM:
+				/* try PTRACE_PEEKDATA */
+				break;
+			default:
+				return -1;
+		}
+	}
+
+	/* PTRACE_PEEKDATA is slow, read no further than the first page.  */
+	len = MIN(len, page_size - (addr & (page_size - 1)));
+
+	return umoven_peekdata(pid, addr, len, our_addr) ? -1 : (int) len;
+}
+
+void
+umove_prefetch(struct tcb *const tcp, const kernel_ulong_t addr,
+	       const unsigned int len)
+{
+	/*
+	 * Without process_vm_readv the prefetch would cost as many
+	 * PTRACE_PEEKDATA requests as the range has words, which is
+	 * more than the decoders are going to ask for.
+	 */
+	if (process_vm_readv_not_supported || tracee_addr_is_invalid(addr))
+		return;
+
+	/* Nested decoders often ask for a part of what is already there.  */
+	if (prefetched.len && tcp->pid == prefetched.pid &&
+	    addr >= prefetched.addr &&
+	    addr - prefetched.addr <= prefetched.len &&
+	    len <= prefetched.len - (addr - prefetched.addr))
+		return;
+
+	prefetched.len = 0;
+
+	if (len > prefetched.size) {
+		free(prefetched.buf);
+		prefetched.buf = xmalloc(len);
+		prefetched.size = len;
+	}
+
+	unsigned int nread = 0;
+
+	/*
+	 * Stop at the first failure: if process_vm_readv is not permitted,
+	 * the decoders fall back to PTRACE_PEEKDATA for what they need.
+	 */
+	while (nread < len) {
+		const ssize_t rc = vm_readv_partial(tcp->pid, addr + nread,
+						    len - nread,
+						    prefetched.buf + nread);
+		if (rc <= 0)
+			break;
+		nread += rc;
+	}
+
+	prefetched.pid = tcp->pid;
+	prefetched.addr = addr;
+	prefetched.len = nread;
+}
+
 /*
  * Like umoven_peekdata but make the additional effort of looking
  * for a terminating zero byte.
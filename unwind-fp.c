@@ -0,0 +1,217 @@
+/*
+ * Frame pointer based stack walker.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "unwind.h"
+#include "mmap_cache.h"
+
+/*
+ * Walking the chain of frame records is much cheaper than CFI based
+ * unwinding, but it works only for code built with frame pointers,
+ * e.g. with -fno-omit-frame-pointer.  The frame record pointed to by
+ * the frame pointer holds the caller's frame pointer followed by the
+ * return address on all supported architectures.
+ */
+
+#define FP_STACK_WINDOW_SIZE	(64 * 1024)
+
+struct stack_window {
+	kernel_ulong_t addr;
+	unsigned int len;
+	char buf[FP_STACK_WINDOW_SIZE];
+};
+
+static void
+init(void)
+{
+	if (unwinder.init)
+		unwinder.init();
+	else
+		mmap_cache_enable();
+}
+
+static void
+fin(void)
+{
+	if (unwinder.fin)
+		unwinder.fin();
+}
+
+/* The context is that of the backend used for symbolization.  */
+static void *
+tcb_init(struct tcb *tcp)
+{
+	return unwinder.tcb_init(tcp);
+}
+
+static void
+tcb_fin(struct tcb *tcp)
+{
+	unwinder.tcb_fin(tcp);
+}
+
+/*
+ * The stack is read in large windows, usually all the frames
+ * are found with a single process_vm_readv call.
+ */
+static bool
+read_word(struct tcb *tcp, struct stack_window *w, kernel_ulong_t addr,
+	  kernel_ulong_t *word)
+{
+	const unsigned int wordsize = current_wordsize;
+
+	if (addr < w->addr || addr - w->addr > w->len - wordsize ||
+	    w->len < wordsize) {
+		int len = umoven_partial(tcp, addr, sizeof(w->buf), w->buf);
+
+		if (len < (int) wordsize) {
+			w->len = 0;
+			return false;
+		}
+		w->addr = addr;
+		w->len = len;
+	}
+
+	const char *p = w->buf + (addr - w->addr);
+
+	if (wordsize == sizeof(uint32_t)) {
+		uint32_t val;
+		memcpy(&val, p, sizeof(val));
+		*word = val;
+	} else {
+		uint64_t val;
+		memcpy(&val, p, sizeof(val));
+		*word = val;
+	}
+
+	return true;
+}
+
+static bool
+is_code_address(struct tcb *tcp, kernel_ulong_t addr)
+{
+	const struct mmap_cache_entry_t *entry = mmap_cache_search(tcp, addr);
+
+	return entry && (entry->protections & MMAP_CACHE_PROT_EXECUTABLE);
+}
+
+static void
+tcb_symbolize(struct tcb *tcp, const unsigned long *pcs, unsigned int count,
+	      unwind_call_action_fn call_action,
+	      unwind_error_action_fn error_action,
+	      void *data)
+{
+	if (unwinder.tcb_symbolize) {
+		unwinder.tcb_symbolize(tcp, pcs, count,
+				       call_action, error_action, data);
+		return;
+	}
+
+	/* Without the help of the backend only offsets can be reported.  */
+	for (unsigned int i = 0; i < count; ++i) {
+		const struct mmap_cache_entry_t *entry =
+			mmap_cache_search(tcp, pcs[i]);
+
+		if (entry)
+			call_action(data, entry->binary_filename, NULL, 0,
+				    pcs[i] - entry->start_addr +
+				    entry->mmap_offset);
+		else
+			error_action(data, "unexpected_backtracing_error",
+				     pcs[i]);
+	}
+}
+
+static unsigned int
+tcb_walk_pcs(struct tcb *tcp, unsigned long *pcs, unsigned int size,
+	     const char **error)
+{
+	static struct stack_window *window;
+	kernel_ulong_t pc, sp, fp, ra;
+
+	if (!get_instruction_pointer(tcp, &pc) ||
+	    !get_stack_pointer(tcp, &sp) ||
+	    !get_frame_pointer(tcp, &fp)) {
+		*error = "cannot get registers";
+		return 0;
+	}
+
+	if (mmap_cache_rebuild_if_invalid(tcp, __func__)
+	    == MMAP_CACHE_REBUILD_NOCACHE || size < 2)
+		return 0;
+
+	if (!window)
+		window = xmalloc(sizeof(*window));
+	window->len = 0;
+
+	unsigned int count = 0;
+	kernel_ulong_t inner_ra = 0;
+
+	pcs[count++] = pc;
+
+	/*
+	 * System calls are usually made from leaf functions that do not
+	 * set up a frame, so the return address of the innermost frame
+	 * is not in the frame record chain.  It is either in the link
+	 * register, or at the top of the stack.  The latter holds only if
+	 * the frame record pointed to by the frame pointer is above it:
+	 * if the two are equal, the top of the stack is the saved frame
+	 * pointer of a frame record set up by the innermost function.
+	 */
+	if ((get_link_register(tcp, &ra) ||
+	     (fp > sp && read_word(tcp, window, sp, &ra))) &&
+	    is_code_address(tcp, ra))
+		inner_ra = ra;
+
+	const unsigned int wordsize = current_wordsize;
+
+	while (fp >= sp && !(fp & (wordsize - 1))) {
+		kernel_ulong_t next_fp;
+
+		if (!read_word(tcp, window, fp, &next_fp) ||
+		    !read_word(tcp, window, fp + wordsize, &ra) || !ra)
+			break;
+
+		/*
+		 * If the innermost function has set up a frame after all,
+		 * its return address is the first one in the chain.
+		 */
+		if (inner_ra) {
+			if (inner_ra != ra)
+				pcs[count++] = inner_ra - 1;
+			inner_ra = 0;
+		}
+
+		if (count == size) {
+			*error = "too many stack frames";
+			break;
+		}
+		pcs[count++] = ra - 1;
+
+		/* The stack grows down, a loop would be a broken chain.  */
+		if (next_fp <= fp)
+			break;
+		fp = next_fp;
+	}
+
+	if (inner_ra)
+		pcs[count++] = inner_ra - 1;
+
+	return count;
+}
+
+const struct unwind_unwinder_t fp_unwinder = {
+	.name = "fp",
+	.init = init,
+	.fin = fin,
+	.tcb_init = tcb_init,
+	.tcb_fin = tcb_fin,
+	.tcb_walk_pcs = tcb_walk_pcs,
+	.tcb_symbolize = tcb_symbolize,
+};
@@ -8,7 +8,7 @@
  *
  * Copyright (c) 2014-2018 Mark Wielaard <mjw@redhat.com>
  * Copyright (c) 2018 Masatake YAMATO <yamato@redhat.com>
- * Copyright (c) 2018-2020 The strace developers.
+ * Copyright (c) 2018-2021 The strace developers.
  * All rights reserved.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
@@ -16,8 +16,13 @@
 
 #include "defs.h"
 #include "unwind.h"
-#include "mmap_notify.h"
+#include "mmap_cache.h"
 #include "static_assert.h"
+#include "xstring.h"
+#include "largefile_wrappers.h"
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <elfutils/libdwfl.h>
 
 #define STRACE_UW_CACHE_SIZE 2048
@@ -28,7 +33,7 @@ static_assert(STRACE_UW_CACHE_SIZE % STRACE_UW_CACHE_ASSOC == 0,
 struct cache_entry {
 	/* key */
 	Dwarf_Addr pc;
-	unsigned long long generation;
+	unsigned int generation;
 
 	/* value */
 	const char *modname;
@@ -40,29 +45,440 @@ struct cache_entry {
 	unsigned long long last_use;
 };
 
+/*
+ * All threads of a process share a single dwfl session and symbol cache:
+ * they share the address space, and a session per thread would make
+ * the memory use and the warm-up time grow with the number of threads.
+ */
 struct ctx {
 	Dwfl *dwfl;
-	unsigned long long last_proc_updating;
+	/* The generation of the mmap cache last reported to dwfl.  */
+	unsigned int last_proc_updating;
+	/* The number of tcbs sharing the session.  */
+	unsigned int refcount;
+	int tgid;
+	unsigned int personality;
+	struct ctx *prev;
+	struct ctx *next;
 	struct cache_entry cache[STRACE_UW_CACHE_SIZE];
 };
 
-static unsigned long long mapping_generation = 1;
+/* All sessions, one per thread group.  */
+static struct ctx *contexts;
+
 static unsigned long long uwcache_clock;
 
+/*
+ * Symbols of code in files with an ELF build ID are also cached globally,
+ * keyed by the build ID and the file offset: short-lived processes
+ * running the same binaries would otherwise look up the same symbols
+ * again and again, each of them in a dwfl session of its own.
+ * The cache can be saved to a file and loaded by the next run.
+ */
+#define BUILD_ID_MAX_SIZE	64
+
+struct build_id {
+	struct build_id *next;
+	unsigned int hash;
+	unsigned int size;
+	unsigned char bytes[];
+};
+
+/* The build ID of a mapped file.  */
+struct build_id_file {
+	struct build_id_file *next;
+	unsigned long major;
+	unsigned long minor;
+	unsigned long inode;
+	/* NULL if the file has no build ID.  */
+	const struct build_id *build_id;
+};
+
+struct symbol_entry {
+	struct symbol_entry *next;
+	const struct build_id *build_id;
+	unsigned long file_offset;
+	/* NULL if there is no symbol.  */
+	char *symname;
+	GElf_Off off;
+	Dwarf_Addr true_offset;
+};
+
+#define BUILD_IDS_HASH_SIZE	256
+#define SYMBOLS_HASH_SIZE	16384
+/* The cache is not grown further.  */
+#define SYMBOLS_MAX		(16 * SYMBOLS_HASH_SIZE)
+
+static struct build_id *build_ids[BUILD_IDS_HASH_SIZE];
+static struct build_id_file *build_id_files[BUILD_IDS_HASH_SIZE];
+static struct symbol_entry **symbols;
+static unsigned int symbols_count;
+/* There are symbols not saved to the cache file yet.  */
+static bool symbols_dirty;
+static unsigned int symbols_hits;
+static unsigned int symbols_misses;
+
+static unsigned int
+hash_bytes(unsigned int hash, const unsigned char *bytes, size_t size)
+{
+	/* FNV-1a */
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * 16777619U;
+	return hash;
+}
+
+static const struct build_id *
+intern_build_id(const unsigned char *bytes, unsigned int size)
+{
+	const unsigned int hash = hash_bytes(2166136261U, bytes, size);
+	struct build_id **bucket = &build_ids[hash % BUILD_IDS_HASH_SIZE];
+	struct build_id *id;
+
+	for (id = *bucket; id; id = id->next) {
+		if (id->hash == hash && id->size == size &&
+		    !memcmp(id->bytes, bytes, size))
+			return id;
+	}
+
+	id = xmalloc(sizeof(*id) + size);
+	id->hash = hash;
+	id->size = size;
+	memcpy(id->bytes, bytes, size);
+	id->next = *bucket;
+	*bucket = id;
+
+	return id;
+}
+
+static bool
+read_full(int fd, void *buf, size_t size, off_t offset)
+{
+	return pread(fd, buf, size, offset) == (ssize_t) size;
+}
+
+/*
+ * Finds the NT_GNU_BUILD_ID note in the PT_NOTE segments of an ELF file
+ * of the native byte order.  Only the headers and the notes are read.
+ */
+static const struct build_id *
+read_build_id(int fd)
+{
+	union {
+		unsigned char ident[EI_NIDENT];
+		Elf32_Ehdr e32;
+		Elf64_Ehdr e64;
+	} ehdr;
+
+	if (!read_full(fd, &ehdr, sizeof(ehdr.e32), 0) ||
+	    memcmp(ehdr.ident, ELFMAG, SELFMAG) ||
+#ifdef WORDS_BIGENDIAN
+	    ehdr.ident[EI_DATA] != ELFDATA2MSB
+#else
+	    ehdr.ident[EI_DATA] != ELFDATA2LSB
+#endif
+	    )
+		return NULL;
+
+	const bool is64 = ehdr.ident[EI_CLASS] == ELFCLASS64;
+
+	if (is64 && !read_full(fd, &ehdr, sizeof(ehdr.e64), 0))
+		return NULL;
+
+	const unsigned long phoff = is64 ? ehdr.e64.e_phoff : ehdr.e32.e_phoff;
+	const unsigned int phnum = is64 ? ehdr.e64.e_phnum : ehdr.e32.e_phnum;
+	const size_t phentsize = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+
+	for (unsigned int i = 0; i < phnum; ++i) {
+		union {
+			Elf32_Phdr p32;
+			Elf64_Phdr p64;
+		} phdr;
+
+		if (!read_full(fd, &phdr, phentsize, phoff + i * phentsize))
+			return NULL;
+
+		if ((is64 ? phdr.p64.p_type : phdr.p32.p_type) != PT_NOTE)
+			continue;
+
+		const unsigned long offset =
+			is64 ? phdr.p64.p_offset : phdr.p32.p_offset;
+		const unsigned long size =
+			is64 ? phdr.p64.p_filesz : phdr.p32.p_filesz;
+		const unsigned long align =
+			(is64 ? phdr.p64.p_align : phdr.p32.p_align) == 8 ? 8 : 4;
+		unsigned char notes[4096];
+
+		if (size > sizeof(notes) ||
+		    !read_full(fd, notes, size, offset))
+			continue;
+
+		for (unsigned long pos = 0;
+		     pos + sizeof(Elf32_Nhdr) <= size;) {
+			Elf32_Nhdr nhdr;
+
+			memcpy(&nhdr, notes + pos, sizeof(nhdr));
+			pos += sizeof(nhdr);
+
+			const unsigned long name_pos = pos;
+			pos += (nhdr.n_namesz + align - 1) & ~(align - 1);
+
+			const unsigned long desc_pos = pos;
+			pos += (nhdr.n_descsz + align - 1) & ~(align - 1);
+
+			if (pos > size)
+				break;
+
+			if (nhdr.n_type == NT_GNU_BUILD_ID &&
+			    nhdr.n_namesz == sizeof(ELF_NOTE_GNU) &&
+			    !memcmp(notes + name_pos, ELF_NOTE_GNU,
+				    sizeof(ELF_NOTE_GNU)) &&
+			    nhdr.n_descsz &&
+			    nhdr.n_descsz <= BUILD_ID_MAX_SIZE)
+				return intern_build_id(notes + desc_pos,
+						       nhdr.n_descsz);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Returns the build ID of the file mapped by the entry, NULL if it has none
+ * or the file cannot be read, e.g. if it was replaced after it was mapped.
+ */
+static const struct build_id *
+get_build_id(const struct mmap_cache_entry_t *entry)
+{
+	if (!entry->inode || !entry->binary_filename ||
+	    entry->binary_filename[0] != '/')
+		return NULL;
+
+	const unsigned int hash =
+		(entry->inode * 16777619U) ^ (entry->major << 8) ^ entry->minor;
+	struct build_id_file **bucket =
+		&build_id_files[hash % BUILD_IDS_HASH_SIZE];
+	struct build_id_file *file;
+
+	for (file = *bucket; file; file = file->next) {
+		if (file->inode == entry->inode &&
+		    file->major == entry->major &&
+		    file->minor == entry->minor)
+			return file->build_id;
+	}
+
+	file = xzalloc(sizeof(*file));
+	file->major = entry->major;
+	file->minor = entry->minor;
+	file->inode = entry->inode;
+
+	int fd = open_file(entry->binary_filename, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		strace_stat_t st;
+
+		if (!fstat_fd(fd, &st) && st.st_ino == entry->inode)
+			file->build_id = read_build_id(fd);
+		close(fd);
+	}
+
+	debug_func_msg("%s: %s build ID", entry->binary_filename,
+		       file->build_id ? "has" : "no");
+
+	file->next = *bucket;
+	*bucket = file;
+
+	return file->build_id;
+}
+
+static unsigned int
+hash_symbol(const struct build_id *build_id, unsigned long file_offset)
+{
+	return hash_bytes(build_id->hash,
+			  (const unsigned char *) &file_offset,
+			  sizeof(file_offset));
+}
+
+static struct symbol_entry *
+find_symbol(const struct build_id *build_id, unsigned long file_offset)
+{
+	if (!symbols)
+		return NULL;
+
+	const unsigned int hash = hash_symbol(build_id, file_offset);
+	struct symbol_entry *sym;
+
+	for (sym = symbols[hash % SYMBOLS_HASH_SIZE]; sym; sym = sym->next) {
+		if (sym->build_id == build_id &&
+		    sym->file_offset == file_offset)
+			return sym;
+	}
+
+	return NULL;
+}
+
+/* Returns false if the symbol table is full.  */
+static bool
+add_symbol(const struct build_id *build_id, unsigned long file_offset,
+	   const char *symname, GElf_Off off, Dwarf_Addr true_offset)
+{
+	if (symbols_count >= SYMBOLS_MAX)
+		return false;
+
+	if (!symbols)
+		symbols = xcalloc(SYMBOLS_HASH_SIZE, sizeof(*symbols));
+
+	const unsigned int hash = hash_symbol(build_id, file_offset);
+	struct symbol_entry *sym = xmalloc(sizeof(*sym));
+
+	sym->build_id = build_id;
+	sym->file_offset = file_offset;
+	sym->symname = symname ? xstrdup(symname) : NULL;
+	sym->off = off;
+	sym->true_offset = true_offset;
+	sym->next = symbols[hash % SYMBOLS_HASH_SIZE];
+	symbols[hash % SYMBOLS_HASH_SIZE] = sym;
+	symbols_count++;
+
+	return true;
+}
+
+/*
+ * The cache file has a header line followed by a line per symbol:
+ * build ID, file offset, true offset, function offset, symbol name
+ * or "-", the numbers are hexadecimal.
+ */
+static const char symbols_file_header[] = "strace symbol cache 1\n";
+
+static bool
+parse_build_id(const char *str, unsigned char *bytes, unsigned int *size)
+{
+	unsigned int n = 0;
+
+	for (; str[0] && str[1]; str += 2) {
+		unsigned int byte;
+
+		if (n >= BUILD_ID_MAX_SIZE || sscanf(str, "%2x", &byte) != 1)
+			return false;
+		bytes[n++] = byte;
+	}
+
+	*size = n;
+	return n && !*str;
+}
+
 static void
-update_mapping_generation(struct tcb *tcp, void *unused)
+load_symbols(void)
 {
-	mapping_generation++;
+	FILE *fp = fopen(stack_trace_symbol_cache, "r");
+
+	if (!fp) {
+		if (errno != ENOENT)
+			perror_msg("Can't fopen '%s'",
+				   stack_trace_symbol_cache);
+		return;
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+
+	if (getline(&line, &line_size, fp) < 0 ||
+	    strcmp(line, symbols_file_header)) {
+		error_msg("%s: not a symbol cache file, ignored",
+			  stack_trace_symbol_cache);
+		goto out;
+	}
+
+	while (getline(&line, &line_size, fp) >= 0) {
+		char id_str[2 * BUILD_ID_MAX_SIZE + 1];
+		char *symname = NULL;
+		unsigned char bytes[BUILD_ID_MAX_SIZE];
+		unsigned int size;
+		unsigned long file_offset;
+		unsigned long long off, true_offset;
+
+		if (sscanf(line, "%128s %lx %llx %llx %ms",
+			   id_str, &file_offset, &true_offset, &off,
+			   &symname) != 5 ||
+		    !parse_build_id(id_str, bytes, &size)) {
+			free(symname);
+			continue;
+		}
+
+		const struct build_id *build_id = intern_build_id(bytes, size);
+
+		if (!find_symbol(build_id, file_offset))
+			add_symbol(build_id, file_offset,
+				   strcmp(symname, "-") ? symname : NULL,
+				   off, true_offset);
+		free(symname);
+	}
+
+	debug_func_msg("%u symbols loaded from %s",
+		       symbols_count, stack_trace_symbol_cache);
+
+out:
+	free(line);
+	fclose(fp);
+}
+
+/* The file is replaced atomically, a concurrent reader sees either version.  */
+static void
+save_symbols(void)
+{
+	char *tmpname = xmalloc(strlen(stack_trace_symbol_cache)
+				+ sizeof(".4294967296"));
+	sprintf(tmpname, "%s.%d", stack_trace_symbol_cache, getpid());
+	FILE *fp = fopen(tmpname, "w");
+
+	if (!fp) {
+		perror_msg("Can't fopen '%s'", tmpname);
+		free(tmpname);
+		return;
+	}
+
+	fputs(symbols_file_header, fp);
+
+	for (unsigned int i = 0; i < SYMBOLS_HASH_SIZE; ++i) {
+		for (const struct symbol_entry *sym = symbols[i]; sym;
+		     sym = sym->next) {
+			for (unsigned int j = 0; j < sym->build_id->size; ++j)
+				fprintf(fp, "%02x", sym->build_id->bytes[j]);
+			fprintf(fp, " %lx %llx %llx %s\n",
+				sym->file_offset,
+				(unsigned long long) sym->true_offset,
+				(unsigned long long) sym->off,
+				sym->symname ? sym->symname : "-");
+		}
+	}
+
+	if (fclose(fp) || rename(tmpname, stack_trace_symbol_cache)) {
+		perror_msg("Can't write '%s'", stack_trace_symbol_cache);
+		unlink(tmpname);
+	}
+
+	free(tmpname);
 }
 
 static void
 init(void)
 {
-	mmap_notify_register_client(update_mapping_generation, NULL);
+	mmap_cache_enable();
+
+	if (stack_trace_symbol_cache)
+		load_symbols();
 }
 
-static void *
-tcb_init(struct tcb *tcp)
+static void
+fin(void)
+{
+	debug_func_msg("symbol cache: %u symbols, %u hits, %u misses",
+		       symbols_count, symbols_hits, symbols_misses);
+
+	if (stack_trace_symbol_cache && symbols_dirty)
+		save_symbols();
+}
+
+static Dwfl *
+attach_dwfl(int tgid)
 {
 	static const Dwfl_Callbacks proc_callbacks = {
 		.find_elf = dwfl_linux_proc_find_elf,
@@ -75,7 +491,11 @@ tcb_init(struct tcb *tcp)
 		return NULL;
 	}
 
-	int r = dwfl_linux_proc_attach(dwfl, tcp->pid, true);
+	/*
+	 * Threads are stopped by strace, so any of them can be unwound
+	 * through the session of the thread group leader.
+	 */
+	int r = dwfl_linux_proc_attach(dwfl, tgid, true);
 	if (r) {
 		const char *msg = NULL;
 
@@ -85,59 +505,154 @@ tcb_init(struct tcb *tcp)
 			msg = strerror(r);
 
 		error_msg("dwfl_linux_proc_attach returned an error"
-			  " for process %d: %s", tcp->pid, msg);
+			  " for process %d: %s", tgid, msg);
 		dwfl_end(dwfl);
 		return NULL;
 	}
 
-	struct ctx *ctx = xmalloc(sizeof(*ctx));
-	ctx->dwfl = dwfl;
-	ctx->last_proc_updating = mapping_generation - 1;
-	memset(ctx->cache, 0, sizeof(ctx->cache));
-	return ctx;
+	return dwfl;
+}
+
+/*
+ * The session is looked up on the first stack walk, when the mmap cache
+ * of the thread group is known.
+ */
+static void *
+tcb_init(struct tcb *tcp)
+{
+	return NULL;
+}
+
+static struct ctx *
+get_ctx(struct tcb *tcp)
+{
+	if (tcp->unwind_ctx)
+		return tcp->unwind_ctx;
+
+	if (!tcp->mmap_cache)
+		return NULL;
+
+	const int tgid = tcp->mmap_cache->tgid;
+	struct ctx *ctx;
+
+	for (ctx = contexts; ctx; ctx = ctx->next) {
+		if (ctx->tgid == tgid && ctx->personality == tcp->currpers)
+			break;
+	}
+
+	if (!ctx) {
+		/* A failed attach is not retried for the thread group.  */
+		ctx = xzalloc(sizeof(*ctx));
+		ctx->dwfl = attach_dwfl(tgid);
+		ctx->tgid = tgid;
+		ctx->personality = tcp->currpers;
+
+		ctx->next = contexts;
+		if (contexts)
+			contexts->prev = ctx;
+		contexts = ctx;
+	}
+
+	ctx->refcount++;
+
+	return tcp->unwind_ctx = ctx;
 }
 
 static void
 tcb_fin(struct tcb *tcp)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
-	if (ctx) {
+	if (!ctx || --ctx->refcount)
+		return;
+
+	if (ctx->prev)
+		ctx->prev->next = ctx->next;
+	else
+		contexts = ctx->next;
+	if (ctx->next)
+		ctx->next->prev = ctx->prev;
+
+	if (ctx->dwfl)
 		dwfl_end(ctx->dwfl);
-		free(ctx);
-	}
+	free(ctx);
 }
 
+/*
+ * Reports the file mappings of the shared mmap cache to dwfl,
+ * adjacent mappings of the same file make a single module,
+ * the same way dwfl_linux_proc_report() groups them.
+ */
 static void
-flush_cache_maybe(struct tcb *tcp)
+report_modules(struct tcb *tcp, struct ctx *ctx)
 {
-	struct ctx *ctx = tcp->unwind_ctx;
-	if (!ctx)
-		return;
+	const struct mmap_cache_t *cache = tcp->mmap_cache;
+	Dwfl *dwfl = ctx->dwfl;
 
-	if (ctx->last_proc_updating == mapping_generation)
-		return;
+	dwfl_report_begin(dwfl);
 
-	int r = dwfl_linux_proc_report(ctx->dwfl, tcp->pid);
+	for (unsigned int i = 0; i < cache->size;) {
+		const struct mmap_cache_entry_t *entry = &cache->entry[i];
+		unsigned long end_addr = entry->end_addr;
 
-	if (r < 0)
-		error_msg("dwfl_linux_proc_report returned an error"
-			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
-	else if (r > 0)
-		error_msg("dwfl_linux_proc_report returned an error"
-			  " for pid %d", tcp->pid);
-	else if (dwfl_report_end(ctx->dwfl, NULL, NULL) != 0)
+		for (++i; i < cache->size; ++i) {
+			const struct mmap_cache_entry_t *next =
+				&cache->entry[i];
+
+			if (next->binary_filename != entry->binary_filename ||
+			    next->major != entry->major ||
+			    next->minor != entry->minor)
+				break;
+			end_addr = next->end_addr;
+		}
+
+		char vdso_name[sizeof("[vdso: 4294967296]")];
+		const char *name = entry->binary_filename;
+
+		if (!strcmp(name, "[vdso]")) {
+			xsprintf(vdso_name, "[vdso: %d]", ctx->tgid);
+			name = vdso_name;
+		} else if (name[0] != '/') {
+			continue;
+		}
+
+		if (!dwfl_report_module(dwfl, name, entry->start_addr,
+					end_addr))
+			debug_func_msg("dwfl_report_module returned an error"
+				       " for pid %d, module %s: %s",
+				       tcp->pid, name, dwfl_errmsg(-1));
+	}
+
+	if (dwfl_report_end(dwfl, NULL, NULL) != 0)
 		error_msg("dwfl_report_end returned an error"
 			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
+}
 
-	ctx->last_proc_updating = mapping_generation;
+static struct ctx *
+flush_cache_maybe(struct tcb *tcp)
+{
+	enum mmap_cache_rebuild_result res =
+		mmap_cache_rebuild_if_invalid(tcp, __func__);
+
+	struct ctx *ctx = get_ctx(tcp);
+	if (!ctx || !ctx->dwfl)
+		return NULL;
+
+	if (res == MMAP_CACHE_REBUILD_NOCACHE)
+		return ctx;
+
+	if (ctx->last_proc_updating == tcp->mmap_cache->generation)
+		return ctx;
+
+	report_modules(tcp, ctx);
+	ctx->last_proc_updating = tcp->mmap_cache->generation;
+
+	return ctx;
 }
 
 struct frame_user_data {
-	unwind_call_action_fn call_action;
-	unwind_error_action_fn error_action;
-	void *data;
-	int stack_depth;
-	struct ctx *ctx;
+	unsigned long *pcs;
+	unsigned int count;
+	unsigned int size;
 };
 
 static bool
@@ -148,12 +663,12 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	struct cache_entry *lru = ctx->cache + idx;
 	for (unsigned int i = 0; i < STRACE_UW_CACHE_ASSOC; ++i) {
 		struct cache_entry *ce = ctx->cache + (idx + i);
-		if (ce->generation == mapping_generation && ce->pc == pc) {
+		if (ce->generation == ctx->last_proc_updating && ce->pc == pc) {
 			ce->last_use = uwcache_clock++;
 			*res = ce;
 			return true;
 		}
-		if (ce->generation != mapping_generation) {
+		if (ce->generation != ctx->last_proc_updating) {
 			unused = ce;
 			continue;
 		}
@@ -165,29 +680,17 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	return false;
 }
 
-static int
-frame_callback(Dwfl_Frame *state, void *arg)
+static void
+symbolize_pc(struct ctx *ctx, Dwarf_Addr pc,
+	     const struct build_id *build_id, unsigned long file_offset,
+	     unwind_call_action_fn call_action, void *data)
 {
-	struct frame_user_data *user_data = arg;
-	Dwarf_Addr pc;
-	bool isactivation;
-
-	if (!dwfl_frame_pc(state, &pc, &isactivation)) {
-		/* Propagate the error to the caller.  */
-		return -1;
-	}
-
-	if (!isactivation)
-		pc--;
-
 	struct cache_entry *ce;
-	if (find_bucket(user_data->ctx, pc, &ce)) {
-		user_data->call_action(user_data->data,
-				       ce->modname, ce->symname,
-			               ce->off, ce->true_offset);
+	if (find_bucket(ctx, pc, &ce)) {
+		call_action(data, ce->modname, ce->symname,
+			    ce->off, ce->true_offset);
 	} else {
-		Dwfl *dwfl = dwfl_thread_dwfl(dwfl_frame_thread(state));
-		Dwfl_Module *mod = dwfl_addrmodule(dwfl, pc);
+		Dwfl_Module *mod = dwfl_addrmodule(ctx->dwfl, pc);
 		GElf_Off off = 0;
 
 		if (mod != NULL) {
@@ -201,58 +704,127 @@ frame_callback(Dwfl_Frame *state, void *arg)
 			symname = dwfl_module_addrinfo(mod, pc, &off, &sym,
 						       NULL, NULL, NULL);
 			dwfl_module_relocate_address(mod, &true_offset);
-			user_data->call_action(user_data->data, modname, symname,
-					       off, true_offset);
+			call_action(data, modname, symname, off, true_offset);
 
-			ce->generation = mapping_generation;
+			ce->generation = ctx->last_proc_updating;
 			ce->pc = pc;
 			ce->modname = modname;
 			ce->symname = symname;
 			ce->off = off;
 			ce->true_offset = true_offset;
 			ce->last_use = uwcache_clock++;
+
+			if (build_id && add_symbol(build_id, file_offset,
+						   symname, off, true_offset))
+				symbols_dirty = true;
 		}
 	}
+}
+
+static int
+frame_callback(Dwfl_Frame *state, void *arg)
+{
+	struct frame_user_data *user_data = arg;
+	Dwarf_Addr pc;
+	bool isactivation;
+
+	if (!dwfl_frame_pc(state, &pc, &isactivation)) {
+		/* Propagate the error to the caller.  */
+		return -1;
+	}
 
-	/* Max number of frames to print reached? */
-	if (user_data->stack_depth-- == 0)
+	/* Max number of frames reached? */
+	if (user_data->count == user_data->size)
 		return DWARF_CB_ABORT;
 
+	if (!isactivation)
+		pc--;
+
+	user_data->pcs[user_data->count++] = pc;
+
 	return DWARF_CB_OK;
 }
 
-static void
-tcb_walk(struct tcb *tcp,
-	 unwind_call_action_fn call_action,
-	 unwind_error_action_fn error_action,
-	 void *data)
+static unsigned int
+tcb_walk_pcs(struct tcb *tcp, unsigned long *pcs, unsigned int size,
+	     const char **error)
 {
-	struct ctx *ctx = tcp->unwind_ctx;
+	struct ctx *ctx = flush_cache_maybe(tcp);
 	if (!ctx)
-		return;
+		return 0;
 
 	struct frame_user_data user_data = {
-		.call_action = call_action,
-		.error_action = error_action,
-		.data = data,
-		.stack_depth = 256,
-		.ctx = ctx,
+		.pcs = pcs,
+		.size = size,
 	};
 
-	flush_cache_maybe(tcp);
-
 	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, frame_callback,
 				      &user_data);
 	if (r)
-		error_action(data,
-			     r < 0 ? dwfl_errmsg(-1) : "too many stack frames",
-			     0);
+		*error = r < 0 ? dwfl_errmsg(-1) : "too many stack frames";
+
+	return user_data.count;
+}
+
+static void
+tcb_symbolize(struct tcb *tcp, const unsigned long *pcs, unsigned int count,
+	      unwind_call_action_fn call_action,
+	      unwind_error_action_fn error_action,
+	      void *data)
+{
+	if (mmap_cache_rebuild_if_invalid(tcp, __func__)
+	    == MMAP_CACHE_REBUILD_NOCACHE)
+		return;
+
+	/*
+	 * The dwfl session is not needed at all
+	 * if every frame is found in the global cache.
+	 */
+	struct ctx *ctx = NULL;
+	bool ctx_ready = false;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		const struct mmap_cache_entry_t *entry =
+			mmap_cache_search(tcp, pcs[i]);
+		const struct build_id *build_id =
+			entry ? get_build_id(entry) : NULL;
+		unsigned long file_offset = 0;
+
+		if (build_id) {
+			file_offset = pcs[i] - entry->start_addr
+				      + entry->mmap_offset;
+
+			const struct symbol_entry *sym =
+				find_symbol(build_id, file_offset);
+
+			if (sym) {
+				symbols_hits++;
+				call_action(data, entry->binary_filename,
+					    sym->symname, sym->off,
+					    sym->true_offset);
+				continue;
+			}
+			symbols_misses++;
+		}
+
+		if (!ctx_ready) {
+			ctx = flush_cache_maybe(tcp);
+			ctx_ready = true;
+		}
+		if (!ctx)
+			return;
+
+		symbolize_pc(ctx, pcs[i], build_id, file_offset,
+			     call_action, data);
+	}
 }
 
 const struct unwind_unwinder_t unwinder = {
 	.name = "libdw",
 	.init = init,
+	.fin = fin,
 	.tcb_init = tcb_init,
 	.tcb_fin = tcb_fin,
-	.tcb_walk = tcb_walk,
+	.tcb_walk_pcs = tcb_walk_pcs,
+	.tcb_symbolize = tcb_symbolize,
 };
@@ -1,12 +1,13 @@
 /*
  * Copyright (c) 2013 Luca Clementi <luca.clementi@gmail.com>
- * Copyright (c) 2013-2020 The strace developers.
+ * Copyright (c) 2013-2021 The strace developers.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
 
 #include "defs.h"
 #include "unwind.h"
+#include "mmap_cache.h"
 
 #ifdef USE_DEMANGLE
 # if defined HAVE_DEMANGLE_H
@@ -24,20 +25,163 @@ struct call_t {
 	char *output_line;
 };
 
+/*
+ * Stack traces are interned: most of them repeat, so a stack is
+ * identified by the code addresses of its frames and the generation
+ * of the mmap cache they were found with, and is symbolized only once,
+ * when it is seen for the first time.
+ */
+struct unwind_stack {
+	struct unwind_stack *next;
+	unsigned int refcount;
+	unsigned int id;
+	unsigned int hash;
+	unsigned int generation;
+	/* Where the stack was printed in full for --stack-trace-ids.  */
+	FILE *defined_in;
+	int defined_pid;
+	/* Why the walk stopped early.  */
+	char *error;
+	/* Symbolized frames, ready for printing.  */
+	char **lines;
+	size_t lines_count;
+	size_t lines_size;
+	/*
+	 * Frame names joined with ';', outermost first,
+	 * for --stack-trace-folded.
+	 */
+	char *folded;
+	char **frames;
+	size_t frames_count;
+	size_t frames_size;
+	/* The profile entry the stack was counted in last time.  */
+	struct folded_entry *last_entry;
+	unsigned int count;
+	unsigned long pcs[];
+};
+
+#define UNWIND_STACKS_HASH_SIZE	4096
+/* The table is flushed when it grows larger.  */
+#define UNWIND_STACKS_MAX	(4 * UNWIND_STACKS_HASH_SIZE)
+
+static struct unwind_stack **stacks;
+static unsigned int stacks_count;
+static unsigned int last_stack_id;
+
+/*
+ * The profile written by --stack-trace-folded: calls, errors, and time
+ * aggregated by syscall and symbolized stack.  Unlike the stacks above,
+ * the entries are never flushed.
+ */
+struct folded_entry {
+	struct folded_entry *next;
+	char *folded;
+	const char *sys_name;
+	unsigned int hash;
+	uint64_t calls;
+	uint64_t errors;
+	struct timespec time;
+};
+
+#define FOLDED_HASH_SIZE	4096
+
+static struct folded_entry **folded_entries;
+static unsigned int folded_count;
+
+enum folded_weight {
+	FOLDED_WEIGHT_CALLS,
+	FOLDED_WEIGHT_TIME,
+	FOLDED_WEIGHT_ERRORS,
+};
+
+static enum folded_weight folded_weight;
+
 struct unwind_queue_t {
 	struct call_t *tail;
 	struct call_t *head;
+	/* A stack captured by a backend with tcb_walk_pcs.  */
+	struct unwind_stack *stack;
 };
 
 static void queue_print(struct unwind_queue_t *queue);
+static void stack_print(struct tcb *tcp, struct unwind_stack *stack);
+static void stack_unref(struct unwind_stack *stack);
 
 static const char asprintf_error_str[] = "???";
 
+static const struct unwind_unwinder_t *backend = &unwinder;
+
+bool
+unwind_set_backend(const char *name)
+{
+	static const struct unwind_unwinder_t *const backends[] = {
+		&unwinder,
+#if HAVE_ARCH_FRAME_POINTER
+		&fp_unwinder,
+#endif
+	};
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(backends); ++i) {
+		if (!strcmp(name, backends[i]->name)) {
+			backend = backends[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool
+unwind_set_folded_weight(const char *name)
+{
+	static const struct xlat_data weights[] = {
+		{ FOLDED_WEIGHT_CALLS,	"calls" },
+		{ FOLDED_WEIGHT_TIME,	"time" },
+		{ FOLDED_WEIGHT_ERRORS,	"errors" },
+	};
+	const struct xlat_data *weight = find_xlat_val(weights, name);
+
+	if (!weight)
+		return false;
+
+	folded_weight = weight->val;
+	return true;
+}
+
 void
 unwind_init(void)
 {
-	if (unwinder.init)
-		unwinder.init();
+	if (stack_trace_ids && !backend->tcb_walk_pcs)
+		error_msg_and_die("--stack-trace-ids is not supported"
+				  " by the %s unwinder", backend->name);
+#ifndef USE_LIBDW
+	if (stack_trace_symbol_cache)
+		error_msg_and_die("--stack-trace-symbol-cache is not supported"
+				  " by the %s unwinder", unwinder.name);
+#endif
+	if (stack_trace_folded && !backend->tcb_walk_pcs)
+		error_msg_and_die("--stack-trace-folded is not supported"
+				  " by the %s unwinder", backend->name);
+
+	if (stack_trace_folded) {
+		/* Fail early rather than at exit.  */
+		FILE *fp = fopen(stack_trace_folded, "w");
+
+		if (!fp)
+			perror_msg_and_die("Can't fopen '%s'",
+					   stack_trace_folded);
+		fclose(fp);
+	}
+
+	if (backend->init)
+		backend->init();
+}
+
+void
+unwind_fin(void)
+{
+	if (backend->fin)
+		backend->fin();
 }
 
 void
@@ -49,8 +193,9 @@ unwind_tcb_init(struct tcb *tcp)
 	tcp->unwind_queue = xmalloc(sizeof(*tcp->unwind_queue));
 	tcp->unwind_queue->head = NULL;
 	tcp->unwind_queue->tail = NULL;
+	tcp->unwind_queue->stack = NULL;
 
-	tcp->unwind_ctx = unwinder.tcb_init(tcp);
+	tcp->unwind_ctx = backend->tcb_init(tcp);
 }
 
 void
@@ -60,10 +205,14 @@ unwind_tcb_fin(struct tcb *tcp)
 		return;
 
 	queue_print(tcp->unwind_queue);
+	if (tcp->unwind_queue->stack) {
+		stack_print(tcp, tcp->unwind_queue->stack);
+		stack_unref(tcp->unwind_queue->stack);
+	}
 	free(tcp->unwind_queue);
 	tcp->unwind_queue = NULL;
 
-	unwinder.tcb_fin(tcp);
+	backend->tcb_fin(tcp);
 	tcp->unwind_ctx = NULL;
 }
 
@@ -258,6 +407,231 @@ queue_print(struct unwind_queue_t *queue)
 	}
 }
 
+/*
+ * stack table manipulators
+ */
+static unsigned int
+stack_hash(const unsigned long *pcs, unsigned int count,
+	   unsigned int generation)
+{
+	/* FNV-1a over the words */
+	unsigned int hash = 2166136261U ^ generation;
+
+	for (unsigned int i = 0; i < count; ++i) {
+		hash = (hash ^ (unsigned int) pcs[i]) * 16777619U;
+		if (sizeof(pcs[i]) > sizeof(hash))
+			hash = (hash ^ (unsigned int) (pcs[i] >> 16 >> 16))
+			       * 16777619U;
+	}
+
+	return hash;
+}
+
+static void
+stack_put_line(struct unwind_stack *stack, char *line)
+{
+	if (stack->lines_count >= stack->lines_size)
+		stack->lines = xgrowarray(stack->lines, &stack->lines_size,
+					  sizeof(*stack->lines));
+	stack->lines[stack->lines_count++] = line;
+}
+
+/*
+ * The name of a frame in the folded output: the function name,
+ * or the binary name and the offset, if there is no symbol.
+ */
+static void
+stack_put_frame(struct unwind_stack *stack,
+		const char *binary_filename,
+		const char *symbol_name,
+		unsigned long true_offset)
+{
+	char *name = NULL;
+
+	if (symbol_name && symbol_name[0] != '\0') {
+#ifdef USE_DEMANGLE
+		name = cplus_demangle(symbol_name, DMGL_AUTO);
+#endif
+		if (!name)
+			name = xstrdup(symbol_name);
+	} else if (binary_filename) {
+		const char *base = strrchr(binary_filename, '/');
+
+		if (asprintf(&name, "%s+0x%lx",
+			     base ? base + 1 : binary_filename,
+			     true_offset) < 0)
+			name = NULL;
+	}
+
+	if (!name)
+		name = xstrdup("[unknown]");
+
+	if (stack->frames_count >= stack->frames_size)
+		stack->frames = xgrowarray(stack->frames, &stack->frames_size,
+					   sizeof(*stack->frames));
+	stack->frames[stack->frames_count++] = name;
+}
+
+/* Joins the frame names, the innermost frame goes last.  */
+static void
+stack_fold_frames(struct unwind_stack *stack)
+{
+	size_t len = 1;
+
+	for (size_t i = 0; i < stack->frames_count; ++i)
+		len += strlen(stack->frames[i]) + 1;
+
+	char *p = stack->folded = xmalloc(len);
+
+	*p = '\0';
+	for (size_t i = stack->frames_count; i > 0; --i) {
+		if (p != stack->folded)
+			*p++ = ';';
+		p = stpcpy(p, stack->frames[i - 1]);
+		free(stack->frames[i - 1]);
+	}
+
+	free(stack->frames);
+	stack->frames = NULL;
+	stack->frames_count = stack->frames_size = 0;
+}
+
+static void
+stack_put_call(void *stack,
+	       const char *binary_filename,
+	       const char *symbol_name,
+	       unwind_function_offset_t function_offset,
+	       unsigned long true_offset)
+{
+	stack_put_line(stack, sprint_call_or_error(binary_filename,
+						   symbol_name,
+						   function_offset,
+						   true_offset,
+						   NULL));
+	if (stack_trace_folded)
+		stack_put_frame(stack, binary_filename, symbol_name,
+				true_offset);
+}
+
+static void
+stack_put_error(void *stack,
+		const char *error,
+		unsigned long ip)
+{
+	stack_put_line(stack, sprint_call_or_error(NULL, NULL, 0, ip, error));
+	if (stack_trace_folded && ip)
+		stack_put_frame(stack, NULL, NULL, ip);
+}
+
+static void
+stack_unref(struct unwind_stack *stack)
+{
+	if (--stack->refcount)
+		return;
+
+	for (size_t i = 0; i < stack->lines_count; ++i) {
+		if (stack->lines[i] != asprintf_error_str)
+			free(stack->lines[i]);
+	}
+	free(stack->lines);
+	free(stack->folded);
+	free(stack->error);
+	free(stack);
+}
+
+static void
+stacks_flush(void)
+{
+	for (unsigned int i = 0; i < UNWIND_STACKS_HASH_SIZE; ++i) {
+		while (stacks[i]) {
+			struct unwind_stack *stack = stacks[i];
+
+			stacks[i] = stack->next;
+			stack_unref(stack);
+		}
+	}
+	stacks_count = 0;
+}
+
+/*
+ * Walks the stack of tcp and returns the interned stack,
+ * the reference is owned by the table.
+ */
+static struct unwind_stack *
+stack_get(struct tcb *tcp)
+{
+	unsigned long pcs[UNWIND_MAX_DEPTH];
+	const char *error = NULL;
+	const unsigned int count =
+		backend->tcb_walk_pcs(tcp, pcs, ARRAY_SIZE(pcs), &error);
+	const unsigned int generation =
+		tcp->mmap_cache ? tcp->mmap_cache->generation : 0;
+	const unsigned int hash = stack_hash(pcs, count, generation);
+	struct unwind_stack *stack;
+
+	if (!stacks)
+		stacks = xcalloc(UNWIND_STACKS_HASH_SIZE, sizeof(*stacks));
+
+	for (stack = stacks[hash & (UNWIND_STACKS_HASH_SIZE - 1)]; stack;
+	     stack = stack->next) {
+		if (stack->hash == hash &&
+		    stack->generation == generation &&
+		    stack->count == count &&
+		    !memcmp(stack->pcs, pcs, count * sizeof(pcs[0])) &&
+		    (stack->error && error ? !strcmp(stack->error, error)
+					   : stack->error == error))
+			return stack;
+	}
+
+	if (stacks_count >= UNWIND_STACKS_MAX)
+		stacks_flush();
+
+	stack = xzalloc(sizeof(*stack) + count * sizeof(pcs[0]));
+	stack->refcount = 1;
+	stack->id = ++last_stack_id;
+	stack->hash = hash;
+	stack->generation = generation;
+	stack->error = error ? xstrdup(error) : NULL;
+	stack->count = count;
+	memcpy(stack->pcs, pcs, count * sizeof(pcs[0]));
+
+	backend->tcb_symbolize(tcp, pcs, count,
+			       stack_put_call, stack_put_error, stack);
+	if (error)
+		stack_put_error(stack, error, 0);
+	if (stack_trace_folded)
+		stack_fold_frames(stack);
+
+	stack->next = stacks[hash & (UNWIND_STACKS_HASH_SIZE - 1)];
+	stacks[hash & (UNWIND_STACKS_HASH_SIZE - 1)] = stack;
+	stacks_count++;
+
+	return stack;
+}
+
+static void
+stack_print(struct tcb *tcp, struct unwind_stack *stack)
+{
+	if (stack_trace_ids) {
+		if (stack->defined_in == tcp->outf &&
+		    (!output_separately || stack->defined_pid == tcp->pid)) {
+			tprintf(" > stack #%u\n", stack->id);
+			line_ended();
+			return;
+		}
+
+		tprintf(" > stack #%u:\n", stack->id);
+		line_ended();
+		stack->defined_in = tcp->outf;
+		stack->defined_pid = tcp->pid;
+	}
+
+	for (size_t i = 0; i < stack->lines_count; ++i) {
+		tprints(stack->lines[i]);
+		line_ended();
+	}
+}
+
 /*
  * printing stack
  */
@@ -270,12 +644,46 @@ unwind_tcb_print(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head) {
+	if (tcp->unwind_queue->stack) {
+		debug_func_msg("stack: tcp=%p, stack=%u",
+			       tcp, tcp->unwind_queue->stack->id);
+		stack_print(tcp, tcp->unwind_queue->stack);
+		stack_unref(tcp->unwind_queue->stack);
+		tcp->unwind_queue->stack = NULL;
+	} else if (tcp->unwind_queue->head) {
 		debug_func_msg("head: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
 		queue_print(tcp->unwind_queue);
-	} else
-		unwinder.tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+	} else if (backend->tcb_walk_pcs)
+		stack_print(tcp, stack_get(tcp));
+	else
+		backend->tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+}
+
+/*
+ * discarding stack
+ */
+void
+unwind_tcb_discard(struct tcb *tcp)
+{
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+	struct call_t *call = queue->head;
+
+	queue->head = NULL;
+	queue->tail = NULL;
+	while (call) {
+		struct call_t *tmp = call;
+
+		call = call->next;
+		if (tmp->output_line != asprintf_error_str)
+			free(tmp->output_line);
+		free(tmp);
+	}
+
+	if (queue->stack) {
+		stack_unref(queue->stack);
+		queue->stack = NULL;
+	}
 }
 
 /*
@@ -290,12 +698,174 @@ unwind_tcb_capture(struct tcb *tcp)
 		return;
 	}
 #endif
-	if (tcp->unwind_queue->head)
+	if (tcp->unwind_queue->head || tcp->unwind_queue->stack)
 		error_msg_and_die("bug: unprinted entries in queue");
-	else {
+	else if (backend->tcb_walk_pcs) {
+		struct unwind_stack *stack = stack_get(tcp);
+
+		debug_func_msg("capture: tcp=%p, stack=%u", tcp, stack->id);
+		stack->refcount++;
+		tcp->unwind_queue->stack = stack;
+	} else {
 		debug_func_msg("walk: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
-		unwinder.tcb_walk(tcp, queue_put_call, queue_put_error,
+		backend->tcb_walk(tcp, queue_put_call, queue_put_error,
 				  tcp->unwind_queue);
 	}
 }
+
+bool
+unwind_tcb_captured(struct tcb *tcp)
+{
+	return tcp->unwind_queue->head || tcp->unwind_queue->stack;
+}
+
+/*
+ * aggregating stacks
+ */
+static unsigned int
+folded_hash(const char *folded, const char *sys_name)
+{
+	/* FNV-1a over the string, the name is a pointer to a static string */
+	unsigned int hash = 2166136261U ^ (unsigned int) (uintptr_t) sys_name;
+
+	for (const char *p = folded; *p; ++p)
+		hash = (hash ^ (unsigned char) *p) * 16777619U;
+
+	return hash;
+}
+
+static struct folded_entry *
+folded_entry_get(struct unwind_stack *stack, const char *sys_name)
+{
+	struct folded_entry *entry = stack->last_entry;
+
+	if (entry && entry->sys_name == sys_name)
+		return entry;
+
+	const char *folded = stack->folded ? stack->folded : "";
+	const unsigned int hash = folded_hash(folded, sys_name);
+
+	if (!folded_entries)
+		folded_entries = xcalloc(FOLDED_HASH_SIZE,
+					 sizeof(*folded_entries));
+
+	for (entry = folded_entries[hash & (FOLDED_HASH_SIZE - 1)]; entry;
+	     entry = entry->next) {
+		if (entry->hash == hash && entry->sys_name == sys_name &&
+		    !strcmp(entry->folded, folded))
+			break;
+	}
+
+	if (!entry) {
+		entry = xzalloc(sizeof(*entry));
+		entry->folded = xstrdup(folded);
+		entry->sys_name = sys_name;
+		entry->hash = hash;
+		entry->next = folded_entries[hash & (FOLDED_HASH_SIZE - 1)];
+		folded_entries[hash & (FOLDED_HASH_SIZE - 1)] = entry;
+		folded_count++;
+	}
+
+	stack->last_entry = entry;
+	return entry;
+}
+
+/*
+ * Accounts the syscall just finished to the stack it was made from.
+ * The stack captured on entering is used if there is one, otherwise
+ * the stack is walked now and, if the syscall is going to be printed,
+ * kept for printing.
+ */
+void
+unwind_tcb_count(struct tcb *tcp, const struct timespec *ts)
+{
+	struct unwind_stack *stack = tcp->unwind_queue->stack;
+
+	if (!stack) {
+		stack = stack_get(tcp);
+		if (cflag != CFLAG_ONLY_STATS) {
+			stack->refcount++;
+			tcp->unwind_queue->stack = stack;
+		}
+	}
+
+	struct folded_entry *entry =
+		folded_entry_get(stack, tcp_sysent(tcp)->sys_name);
+
+	entry->calls++;
+	if (syserror(tcp))
+		entry->errors++;
+	ts_add(&entry->time, &entry->time, ts);
+}
+
+static int
+folded_entry_cmp(const void *a, const void *b)
+{
+	const struct folded_entry *const *ea = a;
+	const struct folded_entry *const *eb = b;
+	int rc = strcmp((*ea)->folded, (*eb)->folded);
+
+	return rc ? rc : strcmp((*ea)->sys_name, (*eb)->sys_name);
+}
+
+static uint64_t
+folded_entry_weight(const struct folded_entry *entry)
+{
+	switch (folded_weight) {
+	case FOLDED_WEIGHT_TIME:
+		/* microseconds */
+		return (uint64_t) entry->time.tv_sec * 1000000
+		       + entry->time.tv_nsec / 1000;
+	case FOLDED_WEIGHT_ERRORS:
+		return entry->errors;
+	case FOLDED_WEIGHT_CALLS:
+		break;
+	}
+
+	return entry->calls;
+}
+
+/*
+ * Writes the profile in the folded format understood by flame graph
+ * tools, one "frame;...;frame;syscall weight" line per entry.
+ * The file is rewritten every time.
+ */
+void
+unwind_folded_dump(void)
+{
+	FILE *fp = fopen(stack_trace_folded, "w");
+
+	if (!fp) {
+		perror_msg("Can't fopen '%s'", stack_trace_folded);
+		return;
+	}
+
+	struct folded_entry **sorted =
+		xcalloc(folded_count ? folded_count : 1, sizeof(*sorted));
+	unsigned int n = 0;
+
+	for (unsigned int i = 0; folded_entries && i < FOLDED_HASH_SIZE; ++i) {
+		for (struct folded_entry *entry = folded_entries[i]; entry;
+		     entry = entry->next)
+			sorted[n++] = entry;
+	}
+
+	qsort(sorted, n, sizeof(*sorted), folded_entry_cmp);
+
+	for (unsigned int i = 0; i < n; ++i) {
+		const uint64_t weight = folded_entry_weight(sorted[i]);
+
+		if (!weight)
+			continue;
+
+		fprintf(fp, "%s%s%s %" PRIu64 "\n",
+			sorted[i]->folded, *sorted[i]->folded ? ";" : "",
+			sorted[i]->sys_name, weight);
+	}
+
+	free(sorted);
+
+	if (fclose(fp))
+		perror_msg("Can't write '%s'", stack_trace_folded);
+}
@@ -2,7 +2,7 @@
  * Unwinder backends interface.
  *
  * Copyright (c) 2013 Luca Clementi <luca.clementi@gmail.com>
- * Copyright (c) 2013-2018 The strace developers.
+ * Copyright (c) 2013-2021 The strace developers.
  *
  * SPDX-License-Identifier: LGPL-2.1-or-later
  */
@@ -28,23 +28,56 @@ typedef void (*unwind_error_action_fn)(void *data,
 				       const char *error,
 				       unsigned long true_offset);
 
+/* The maximum number of frames in a stack trace. */
+# define UNWIND_MAX_DEPTH 256
+
 struct unwind_unwinder_t {
 	const char *name;
 
 	/* Initialize the unwinder. */
 	void   (*init)(void);
+	/* Finalize the unwinder on exit. */
+	void   (*fin)(void);
 
 	/* Make/destroy the context data attached to tcb. */
 	void * (*tcb_init)(struct tcb *);
 	void   (*tcb_fin)(struct tcb *);
 
-	/* Walk the stack. */
+	/*
+	 * Walk the stack, symbolizing every frame.
+	 * Used only by unwinders that cannot do the two steps below.
+	 */
 	void   (*tcb_walk)(struct tcb *,
 			   unwind_call_action_fn,
 			   unwind_error_action_fn,
 			   void *);
+
+	/*
+	 * Collect the code addresses of at most size frames without
+	 * symbolizing them: the current instruction pointer first,
+	 * then return addresses minus one.  Returns the number of frames,
+	 * sets *error to the reason the walk stopped early, if any.
+	 */
+	unsigned int (*tcb_walk_pcs)(struct tcb *,
+				     unsigned long *pcs,
+				     unsigned int size,
+				     const char **error);
+
+	/* Resolve code addresses collected by tcb_walk_pcs. */
+	void   (*tcb_symbolize)(struct tcb *,
+				const unsigned long *pcs,
+				unsigned int count,
+				unwind_call_action_fn,
+				unwind_error_action_fn,
+				void *);
 };
 
+/* The backend strace is built with, libdw or libunwind. */
 extern const struct unwind_unwinder_t unwinder;
 
+# if HAVE_ARCH_FRAME_POINTER
+/* Frame pointer walker, symbolizes with the backend above. */
+extern const struct unwind_unwinder_t fp_unwinder;
+# endif
+
 #endif /* !STRACE_UNWIND_H */
@@ -60,11 +60,10 @@ uffdio_ioctl(struct tcb *const tcp, const unsigned int code,
 			PRINT_FIELD_X("{", ua, api);
 			PRINT_FIELD_FLAGS(", ", ua, features, uffd_api_features,
 					  "UFFD_FEATURE_???");
-			entering_features = malloc(sizeof(*entering_features));
-			if (entering_features) {
-				*entering_features = ua.features;
-				set_tcb_priv_data(tcp, entering_features, free);
-			}
+			entering_features =
+				tcb_alloc(tcp, sizeof(*entering_features));
+			*entering_features = ua.features;
+			set_tcb_priv_data(tcp, entering_features, NULL);
 
 			return 0;
 		}
@@ -26,6 +26,7 @@
 #include "largefile_wrappers.h"
 #include "number_set.h"
 #include "print_utils.h"
+#include "procfs.h"
 #include "static_assert.h"
 #include "string_to_uint.h"
 #include "xlat.h"
@@ -587,10 +588,10 @@ pidfd_get_pid(pid_t pid_of_fd, int fd)
 	if (!proc_pid)
 		return -1;
 
-	char fdi_path[sizeof("/proc/%u/fdinfo/%u") + 2 * sizeof(int) * 3];
-	xsprintf(fdi_path, "/proc/%u/fdinfo/%u", proc_pid, fd);
+	char fdi_name[sizeof("fdinfo/%u") + sizeof(int) * 3];
+	xsprintf(fdi_name, "fdinfo/%u", fd);
 
-	FILE *f = fopen_stream(fdi_path, "r");
+	FILE *f = proc_fopen(proc_pid, fdi_name);
 	if (!f)
 		return -1;
 
@@ -688,6 +689,7 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 	unsigned int i;
 	int usehex, c, eol;
 	bool printable;
+	unsigned int plain_len = 0;
 
 	if (style & QUOTE_0_TERMINATED)
 		eol = '\0';
@@ -700,24 +702,11 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 	} else if (xflag) {
 		/* Check for presence of symbol which require
 		   to hex-quote the whole string. */
-		for (i = 0; i < size; ++i) {
-			c = ustr[i];
-			/* Check for NUL-terminated string. */
-			if (c == eol)
-				break;
-
+		i = text_prefix_len(ustr, size);
+		/* Check for NUL-terminated string. */
+		if (i < size && ustr[i] != eol) {
 			/* Force hex unless c is printable or whitespace */
-			if (c > 0x7e) {
-				usehex = 1;
-				break;
-			}
-			/* In ASCII isspace is only these chars: "\t\n\v\f\r".
-			 * They happen to have ASCII codes 9,10,11,12,13.
-			 */
-			if (c < ' ' && (unsigned)(c - 9) >= 5) {
-				usehex = 1;
-				break;
-			}
+			usehex = 1;
 		}
 	}
 
@@ -728,15 +717,14 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 
 	if (usehex) {
 		/* Hex-quote the whole string. */
-		for (i = 0; i < size; ++i) {
-			c = ustr[i];
-			/* Check for NUL-terminated string. */
-			if (c == eol)
-				goto asciz_ended;
-			*s++ = '\\';
-			*s++ = 'x';
-			s = sprint_byte_hex(s, c);
-		}
+		const unsigned char *const nul = eol == '\0'
+			? memchr(ustr, '\0', size) : NULL;
+
+		i = nul ? (unsigned int) (nul - ustr) : size;
+		s = sprint_hex_escaped(s, ustr, i);
+		/* Check for NUL-terminated string. */
+		if (nul)
+			goto asciz_ended;
 
 		goto string_ended;
 	}
@@ -780,9 +768,32 @@ string_quote(const char *instr, char *outstr, const unsigned int size,
 			if (printable && escape_chars)
 				printable = !strchr(escape_chars, c);
 
-			if (printable) {
+			if (printable && ++plain_len < PLAIN_RUN_MIN) {
 				*s++ = c;
+			} else if (printable) {
+				/*
+				 * Copy the rest of the run of characters
+				 * that need no quoting at once.
+				 */
+				unsigned int n =
+					copy_plain_prefix(s, ustr + i, size - i);
+
+				for (const char *e = escape_chars; e && *e; ++e) {
+					const void *p = memchr(ustr + i, *e, n);
+
+					if (p)
+						n = (const unsigned char *) p
+						    - (ustr + i);
+				}
+				s += n;
+				i += n - 1;
+				plain_len = 0;
 			} else {
+				/*
+				 * Unlike the escaped whitespace and quotes,
+				 * which are common in text, these end the run.
+				 */
+				plain_len = 0;
 				/* Print \octal */
 				*s++ = '\\';
 				if (i + 1 < size
@@ -1166,6 +1177,15 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 		      "DUMPSTR_GROUP_BYTES is not power of 2");
 	static_assert(!(DUMPSTR_WIDTH_BYTES & DUMPSTR_BYTES_MASK),
 		      "DUMPSTR_WIDTH_BYTES is not power of 2");
+	static_assert(DUMPSTR_WIDTH_BYTES == DUMP_LINE_BYTES &&
+		      DUMPSTR_WIDTH_CHARS == 4 * DUMP_LINE_BYTES + 2,
+		      "sprint_dump_line does not match the dumpstr format");
+
+	/* The dumps are made by dumpio, the descriptor is the 1st argument.  */
+	if (capture_dir) {
+		capture_data(tcp, tcp->u_arg[0], addr, len);
+		return;
+	}
 
 	if (len > len + DUMPSTR_WIDTH_BYTES || addr + len < addr) {
 		debug_func_msg("len %" PRI_klu " at addr %#" PRI_klx
@@ -1201,14 +1221,9 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 	const unsigned char *src;
 
 	while (i < len) {
-		/*
-		 * It is important to overwrite all the byte values, as we
-		 * re-use the buffer in order to avoid its re-initialisation.
-		 */
-		static char outbuf[] = {
-			[0 ... DUMPSTR_WIDTH_CHARS - 1] = ' ',
-			'\0'
-		};
+		/* " | " offset "  " dump " |\n" */
+		char outbuf[3 + sizeof(kernel_ulong_t) * 2 + 2 +
+			    DUMPSTR_WIDTH_CHARS + 3 + 1];
 		char *dst = outbuf;
 
 		/* Fetching data from tracee.  */
@@ -1232,38 +1247,17 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 			src = str;
 		}
 
-		/* hex dump */
-		do {
-			if (i < len) {
-				dst = sprint_byte_hex(dst, *src);
-			} else {
-				*dst++ = ' ';
-				*dst++ = ' ';
-			}
-			dst++; /* space is there */
-			i++;
-			if ((i & DUMPSTR_GROUP_MASK) == 0)
-				dst++; /* space is there */
-			src++;
-		} while (i & DUMPSTR_BYTES_MASK);
-
-		/* ASCII dump */
-		i -= DUMPSTR_WIDTH_BYTES;
-		src -= DUMPSTR_WIDTH_BYTES;
-		do {
-			if (i < len) {
-				if (is_print(*src))
-					*dst++ = *src;
-				else
-					*dst++ = '.';
-			} else {
-				*dst++ = ' ';
-			}
-			src++;
-		} while (++i & DUMPSTR_BYTES_MASK);
-
-		tprintf(" | %0*" PRI_klx "  %s |\n",
-			offs_chars, i - DUMPSTR_WIDTH_BYTES, outbuf);
+		dst = stpcpy(dst, " | ");
+		for (int n = offs_chars - 1; n >= 0; --n)
+			*dst++ = hex_chars[(i >> (n * HEX_BIT)) & 0xf];
+		dst = stpcpy(dst, "  ");
+		dst = sprint_dump_line(dst, src,
+				       MIN(len - i, DUMPSTR_WIDTH_BYTES));
+		strcpy(dst, " |\n");
+		tprints(outbuf);
+
+		src += DUMPSTR_WIDTH_BYTES;
+		i += DUMPSTR_WIDTH_BYTES;
 	}
 }
 
@@ -1351,6 +1345,29 @@ print_xint64_array_member(struct tcb *tcp, void *elem_buf, size_t elem_size,
 	return true;
 }
 
+/*
+ * Once the first element of an array is fetched, the elements to be printed
+ * are read from the tracee at once, unless they span just a couple of pages
+ * that the umove cache handles as well.  Elements beyond a fault in this
+ * read are fetched one by one as usual.
+ */
+#define PRINT_ARRAY_PREFETCH_MAX	(256 * 1024)
+
+static void
+prefetch_array(struct tcb *const tcp, const kernel_ulong_t start_addr,
+	       const kernel_ulong_t end_addr, const kernel_ulong_t abbrev_end,
+	       const size_t elem_size)
+{
+	/* The element after the abbreviation limit is fetched, too.  */
+	const kernel_ulong_t fetch_end =
+		abbrev_end < end_addr ? abbrev_end + elem_size : end_addr;
+	const kernel_ulong_t len = MIN(fetch_end - start_addr,
+				       PRINT_ARRAY_PREFETCH_MAX);
+
+	if (len > 2 * get_pagesize())
+		umove_prefetch(tcp, start_addr, len);
+}
+
 /*
  * Iteratively fetch and print up to nmemb elements of elem_size size
  * from the array that starts at tracee's address start_addr.
@@ -1439,6 +1456,9 @@ print_array_ex(struct tcb *const tcp,
 				}
 				break;
 			}
+			if (cur == start_addr)
+				prefetch_array(tcp, start_addr, end_addr,
+					       abbrev_end, elem_size);
 		} else {
 			elem_buf = (void *) (uintptr_t) cur;
 		}
@@ -50,6 +50,174 @@ print_xlat_val(uint64_t val, enum xlat_style style)
 	tprints(sprint_xlat_val(val, style));
 }
 
+/*
+ * Linear scans of large tables are replaced with lookups in an index
+ * that is built on the first use of the table.  The values of the entries
+ * are known only to the compiler, so the generated tables just provide
+ * the storage for the index.
+ */
+#define XLAT_INDEX_MIN_SIZE	16
+
+struct xlat_index {
+	/* Open addressing hash of the first entries with each value, plus 1.  */
+	uint32_t *slots;
+	uint32_t slots_mask;
+	/*
+	 * Bitmaps of the entries with a non-zero value and a string,
+	 * bit_words 64-bit words for each bit, which is the lowest set bit
+	 * of the values of the entries.
+	 */
+	uint64_t *bit_entries;
+	uint32_t bit_words;
+};
+
+static inline unsigned int
+lowest_bit(const uint64_t val)
+{
+#if GNUC_PREREQ(3, 4)
+	return __builtin_ctzll(val);
+#else
+	unsigned int n = 0;
+
+	for (uint64_t v = val; !(v & 1); v >>= 1)
+		++n;
+
+	return n;
+#endif
+}
+
+static struct xlat_index *
+get_xlat_index(const struct xlat *xlat)
+{
+	if (!xlat->index || xlat->size < XLAT_INDEX_MIN_SIZE)
+		return NULL;
+
+	if (!*xlat->index)
+		*xlat->index = xzalloc(sizeof(**xlat->index));
+
+	return *xlat->index;
+}
+
+static inline uint32_t
+xlat_hash(const uint64_t val, const uint32_t mask)
+{
+	return ((val * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+static const struct xlat_index *
+get_xlat_value_index(const struct xlat *xlat)
+{
+	struct xlat_index *const index = get_xlat_index(xlat);
+
+	if (!index || index->slots)
+		return index;
+
+	uint32_t nslots = 2;
+	while (nslots < 2 * xlat->size)
+		nslots <<= 1;
+
+	const uint32_t mask = nslots - 1;
+	uint32_t *const slots = xcalloc(nslots, sizeof(*slots));
+
+	for (uint32_t idx = 0; idx < xlat->size; ++idx) {
+		const uint64_t val = xlat->data[idx].val;
+		uint32_t h = xlat_hash(val, mask);
+
+		for (; slots[h]; h = (h + 1) & mask) {
+			if (xlat->data[slots[h] - 1].val == val)
+				break;
+		}
+		if (!slots[h])
+			slots[h] = idx + 1;
+	}
+
+	index->slots_mask = mask;
+	index->slots = slots;
+
+	return index;
+}
+
+/*
+ * Returns the index of the first entry with the value val,
+ * or xlat->size if there is none.
+ */
+static size_t
+xlat_index_lookup(const struct xlat *xlat, const struct xlat_index *index,
+		  const uint64_t val)
+{
+	for (uint32_t h = xlat_hash(val, index->slots_mask); index->slots[h];
+	     h = (h + 1) & index->slots_mask) {
+		if (xlat->data[index->slots[h] - 1].val == val)
+			return index->slots[h] - 1;
+	}
+
+	return xlat->size;
+}
+
+static const struct xlat_index *
+get_xlat_flags_index(const struct xlat *xlat)
+{
+	struct xlat_index *const index = get_xlat_index(xlat);
+
+	if (!index || index->bit_entries)
+		return index;
+
+	const uint32_t words = (xlat->size + 63) / 64;
+	uint64_t *const entries = xcalloc(64 * words, sizeof(*entries));
+
+	for (uint32_t idx = 0; idx < xlat->size; ++idx) {
+		if (!xlat->data[idx].val || !xlat->data[idx].str)
+			continue;
+
+		const unsigned int bit = lowest_bit(xlat->data[idx].val);
+
+		entries[bit * words + idx / 64] |= 1ULL << (idx % 64);
+	}
+
+	index->bit_words = words;
+	index->bit_entries = entries;
+
+	return index;
+}
+
+/*
+ * Iterates over the entries that may be contained in flags: an entry
+ * may be contained in flags only if the lowest set bit of its value
+ * is set in flags, the caller has to check the rest of the bits.
+ * Without an index every entry is a candidate.
+ */
+struct xlat_flags_iter {
+	const struct xlat_index *index;
+	uint64_t candidates;
+	uint32_t word;
+};
+
+static size_t
+xlat_next_flag(const struct xlat *xlat, struct xlat_flags_iter *it,
+	       const size_t idx, const uint64_t flags)
+{
+	if (!it->index)
+		return idx;
+
+	while (!it->candidates) {
+		if (it->word >= it->index->bit_words)
+			return xlat->size;
+
+		for (uint64_t bits = flags; bits; bits &= bits - 1)
+			it->candidates |=
+				it->index->bit_entries[lowest_bit(bits) *
+						       it->index->bit_words +
+						       it->word];
+		++it->word;
+	}
+
+	const unsigned int bit = lowest_bit(it->candidates);
+
+	it->candidates &= it->candidates - 1;
+
+	return (it->word - 1) * 64 + bit;
+}
+
 static int
 xlat_bsearch_compare(const void *a, const void *b)
 {
@@ -64,6 +232,7 @@ xlookup(const struct xlat *xlat, const uint64_t val)
 	static const struct xlat *x;
 	static size_t idx;
 	const struct xlat_data *e;
+	const struct xlat_index *index;
 
 	if (xlat) {
 		x = xlat;
@@ -75,6 +244,14 @@ xlookup(const struct xlat *xlat, const uint64_t val)
 
 	switch (x->type) {
 	case XT_NORMAL:
+		/* The search continues linearly if xlat is NULL.  */
+		if (xlat && (index = get_xlat_value_index(x))) {
+			idx = xlat_index_lookup(x, index, val);
+			if (idx < x->size)
+				return x->data[idx].str;
+			break;
+		}
+
 		for (; idx < x->size; idx++)
 			if (x->data[idx].val == val)
 				return x->data[idx].str;
@@ -357,7 +534,11 @@ sprintflags_ex(const char *prefix, const struct xlat *xlat, uint64_t flags,
 				    sprint_xlat_val(flags, style));
 	}
 
-	for (size_t idx = 0; flags && idx < xlat->size; idx++) {
+	struct xlat_flags_iter it = { .index = get_xlat_flags_index(xlat) };
+
+	for (size_t idx = xlat_next_flag(xlat, &it, 0, flags);
+	     flags && idx < xlat->size;
+	     idx = xlat_next_flag(xlat, &it, idx + 1, flags)) {
 		if (xlat->data[idx].val && xlat->data[idx].str
 		    && (flags & xlat->data[idx].val) == xlat->data[idx].val) {
 			if (sep) {
@@ -441,7 +622,14 @@ printflags_ex(uint64_t flags, const char *dflt, enum xlat_style style,
 
 	va_start(args, xlat);
 	for (; xlat; xlat = va_arg(args, const struct xlat *)) {
-		for (size_t idx = 0; (flags || !n) && idx < xlat->size; ++idx) {
+		/* Only the first entry is checked if flags is 0.  */
+		struct xlat_flags_iter it = {
+			.index = flags ? get_xlat_flags_index(xlat) : NULL
+		};
+
+		for (size_t idx = xlat_next_flag(xlat, &it, 0, flags);
+		     (flags || !n) && idx < xlat->size;
+		     idx = xlat_next_flag(xlat, &it, idx + 1, flags)) {
 			uint64_t v = xlat->data[idx].val;
 			if (xlat->data[idx].str
 			    && ((flags == v) || (v && (flags & v) == v))) {
@@ -53,12 +53,16 @@ struct xlat_data {
 	const char *str;
 };
 
+struct xlat_index;
+
 struct xlat {
 	const struct xlat_data *data;
 	size_t flags_strsz;
 	uint32_t size;
 	enum xlat_type type;
 	uint64_t flags_mask;
+	/* Storage for the lookup index built on demand, optional.  */
+	struct xlat_index **index;
 };
 
 # define XLAT(val)			{ (unsigned)(val), #val }
@@ -305,6 +305,7 @@ gen_header()
 		esac
 	done < "${input}"
 	echo '};'
+	echo "static struct xlat_index *${name}_index;"
 
 	[ "$enum" != 1 ] || (
 		printf '\n]),,, [\n'
@@ -334,6 +335,7 @@ gen_header()
 			 .data = ${name}_xdata,
 			 .size = ARRAY_SIZE(${name}_xdata),
 			 .type = ${xlat_type},
+			 .index = &${name}_index,
 	EOF
 
 	echo " .flags_mask = 0"